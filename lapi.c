@@ -30,6 +30,10 @@
 #include "lundump.h"
 #include "lvm.h"
 
+#if defined(VMK_USE_OPSTATS) || defined(VMKI_OPPAIRS)
+#include "lopnames.h"
+#endif
+
 
 
 const char vmk_ident[] =
@@ -785,11 +789,25 @@ VMK_API int vmk_rawgetp (vmk_State *L, int idx, const void *p) {
 VMK_API void vmk_createtable (vmk_State *L, int narray, int nrec) {
   Table *t;
   vmk_lock(L);
-  t = vmkH_new(L);
+  t = vmkH_newsized(L, NULL, cast_uint(narray), cast_uint(nrec));
   sethvalue2s(L, L->top.p, t);
   api_incr_top(L);
   if (narray > 0 || nrec > 0)
-    vmkH_resize(L, t, cast_uint(narray), cast_uint(nrec));
+    vmkH_presize(L, t, cast_uint(narray), cast_uint(nrec));
+  vmkC_checkGC(L);
+  vmk_unlock(L);
+}
+
+
+VMK_API void vmk_clonetable (vmk_State *L, int idx) {
+  Table *t;
+  Table *nt;
+  vmk_lock(L);
+  t = gettable(L, idx);
+  nt = vmkH_newsized(L, NULL, t->asize, hasslots(t) ? sizeslots(t) : 0);
+  sethvalue2s(L, L->top.p, nt);
+  api_incr_top(L);
+  vmkH_copy(L, nt, t);
   vmkC_checkGC(L);
   vmk_unlock(L);
 }
@@ -1229,6 +1247,11 @@ VMK_API int vmk_gc (vmk_State *L, int what, ...) {
         g->gcparams[param] = vmkO_codeparam(cast_uint(value));
       break;
     }
+    case VMK_GCSWEEPER: {
+      int on = va_arg(argp, int);
+      res = vmkC_setsweeper(L, on);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   va_end(argp);
@@ -1274,6 +1297,20 @@ VMK_API int vmk_next (vmk_State *L, int idx) {
 }
 
 
+/*
+** Registers the iterators returned by 'pairs' and 'ipairs', so that
+** generic for loops can run them without a call (see 'tforcall' in
+** lvm.c).
+*/
+VMK_API void vmk_setiterators (vmk_State *L, vmk_CFunction next,
+                                             vmk_CFunction inext) {
+  vmk_lock(L);
+  G(L)->tforiter[0] = next;
+  G(L)->tforiter[1] = inext;
+  vmk_unlock(L);
+}
+
+
 VMK_API void vmk_toclose (vmk_State *L, int idx) {
   StkId o;
   vmk_lock(L);
@@ -1322,6 +1359,7 @@ VMK_API vmk_Alloc vmk_getallocf (vmk_State *L, void **ud) {
 
 VMK_API void vmk_setallocf (vmk_State *L, vmk_Alloc f, void *ud) {
   vmk_lock(L);
+  vmkC_syncsweeper(G(L));  /* old allocator must free its pending blocks */
   G(L)->ud = ud;
   G(L)->frealloc = f;
   vmk_unlock(L);
@@ -1465,3 +1503,164 @@ VMK_API void vmk_upvaluejoin (vmk_State *L, int fidx1, int n1,
 }
 
 
+
+
+/*
+** {======================================================
+** Counters of opcode pairs (only with VMKI_OPPAIRS)
+** =======================================================
+*/
+
+VMK_API int vmk_oppairs (vmk_State *L) {
+#if defined(VMKI_OPPAIRS)
+  const lu_mem *c = G(L)->oppairs;
+  int op1, op2;
+  vmk_createtable(L, 0, 0);
+  for (op1 = 0; op1 < NUM_OPCODES; op1++) {
+    for (op2 = 0; op2 < NUM_OPCODES; op2++) {
+      lu_mem n = c[op1 * NUM_OPCODES + op2];
+      if (n > 0) {
+        vmk_pushfstring(L, "%s %s", opnames[op1], opnames[op2]);
+        vmk_pushinteger(L, l_castU2S(n));
+        vmk_rawset(L, -3);
+      }
+    }
+  }
+  return 1;
+#else
+  UNUSED(L);
+  return 0;
+#endif
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Opcode profiler (only with VMK_USE_OPSTATS)
+** =======================================================
+*/
+
+#if defined(VMK_USE_OPSTATS)
+
+static void pushopcounters (vmk_State *L, const OpStats *s) {
+  int op;
+  vmk_createtable(L, 0, 0);
+  for (op = 0; op < NUM_OPCODES; op++) {
+    if (s->count[op] > 0) {
+      vmk_createtable(L, 0, 3);
+      vmk_pushinteger(L, l_castU2S(s->count[op]));
+      vmk_setfield(L, -2, "count");
+      vmk_pushinteger(L, l_castU2S(s->samples[op]));
+      vmk_setfield(L, -2, "samples");
+      vmk_pushinteger(L, l_castU2S(s->cycles[op]));
+      vmk_setfield(L, -2, "cycles");
+      vmk_setfield(L, -2, opnames[op]);
+    }
+  }
+}
+
+
+static void pushpccounters (vmk_State *L, int sizecode, const lu_mem *c) {
+  int pc;
+  vmk_createtable(L, sizecode, 0);
+  for (pc = 0; pc < sizecode; pc++) {
+    vmk_pushinteger(L, (c != NULL) ? l_castU2S(c[pc]) : 0);
+    vmk_rawseti(L, -2, pc + 1);
+  }
+}
+
+#endif
+
+
+VMK_API int vmk_opstats (vmk_State *L, int funcindex) {
+#if defined(VMK_USE_OPSTATS)
+  if (funcindex == 0)  /* counters for each opcode? */
+    pushopcounters(L, G(L)->opstats);
+  else {  /* counters for each instruction of a function */
+    const TValue *fi;
+    Proto *p;
+    const lu_mem *c;
+    vmk_lock(L);
+    fi = index2value(L, funcindex);
+    if (!ttisLclosure(fi)) {
+      vmk_unlock(L);
+      return 0;
+    }
+    p = clLvalue(fi)->p;  /* anchored by the function */
+    c = vmkV_opcount(G(L), p);
+    vmk_unlock(L);
+    pushpccounters(L, p->sizecode, c);
+  }
+  return 1;
+#else
+  UNUSED(L); UNUSED(funcindex);
+  return 0;
+#endif
+}
+
+
+VMK_API void vmk_resetopstats (vmk_State *L, int perpc) {
+#if defined(VMK_USE_OPSTATS)
+  vmk_lock(L);
+  vmkV_resetopstats(G(L), perpc);
+  vmk_unlock(L);
+#else
+  UNUSED(L); UNUSED(perpc);
+#endif
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Size feedback of table constructors (see 'vmkH_presize')
+** =======================================================
+*/
+
+static void setintfield (vmk_State *L, const char *k, vmk_Integer v) {
+  vmk_pushinteger(L, v);
+  vmk_setfield(L, -2, k);
+}
+
+
+VMK_API int vmk_tablesites (vmk_State *L, int funcindex) {
+  const TValue *fi;
+  Proto *p;
+  int pc;
+  int n = 0;
+  vmk_lock(L);
+  fi = index2value(L, funcindex);
+  if (!ttisLclosure(fi)) {
+    vmk_unlock(L);
+    return 0;
+  }
+  p = clLvalue(fi)->p;  /* anchored by the function */
+  vmk_unlock(L);
+  vmk_createtable(L, 0, 0);
+  for (pc = 0; pc < p->sizecode; pc++) {
+    if (GET_OPCODE(p->code[pc]) == OP_NEWTABLE) {
+      unsigned int fb = (p->icache != NULL) ? p->icache[pc] : 0;
+      vmk_createtable(L, 0, 7);
+      setintfield(L, "pc", pc + 1);
+      setintfield(L, "line", vmkG_getfuncline(p, pc));
+      setintfield(L, "asize", fbsize(fbarray(fb)));
+      setintfield(L, "hsize", fbsize(fbhash(fb)));
+      setintfield(L, "samples", fbsamples(fb));
+      vmk_pushboolean(L, fbslots(fb));
+      vmk_setfield(L, -2, "record");
+      vmk_pushstring(L, (fbtyped(fb) == 0) ? "any"
+                      : (fbtyped(fb) == 1) ? "integer" : "float");
+      vmk_setfield(L, -2, "atype");
+      vmk_rawseti(L, -2, ++n);
+    }
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
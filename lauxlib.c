@@ -144,7 +144,14 @@ VMKLIB_API void vmkL_traceback (vmk_State *L, vmk_State *L1,
       level += n;  /* and skip to last levels */
     }
     else {
-      vmk_getinfo(L1, "Slnt", &ar);
+      vmk_getinfo(L1, "Slnti", &ar);
+      if (ar.inlined != NULL) {  /* running code of an inlined call? */
+        vmk_pushfstring(L, "\n\t%s:%d: in inlined fn '%s'",
+                           ar.short_src, ar.currentline, ar.inlined);
+        vmkL_addvalue(&b);
+        ar.currentline = ar.callline;  /* caller is at the call */
+        ar.namewhat = "";  /* its name is the inlined one */
+      }
       if (ar.currentline <= 0)
         vmk_pushfstring(L, "\n\t%s: in ", ar.short_src);
       else
@@ -1057,6 +1064,234 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
 }
 
 
+/*
+** {======================================================
+** Slab allocator
+** The allocator of 'vmkL_newslabstate'. Blocks up to SLABMAX bytes
+** come from pages of SLABPAGE bytes. Each page holds blocks of one size
+** class for one type of object (the type that Vmk gives when it creates
+** an object; any other block counts as type 0), so that objects of a
+** kind stay together. Pages are aligned to their size, so the header
+** of a page, which tells the pool of its blocks, is found from any of
+** them. Pages come from the system in chunks, which go back only when
+** the allocator dies, with its state. Larger blocks go to 'realloc'.
+** This allocator cannot be called from several threads at once.
+** =======================================================
+*/
+
+#define SLABPAGE	(1u << 14)	/* size of a page */
+#define SLABCHUNK	64	/* number of pages in a chunk */
+#define SLABMAX		512	/* largest block that goes to a page */
+#define SLABHEAD	16	/* size of the header of a page (keeps alignment) */
+
+/* size classes: multiples of 16 up to 256, then of 64 up to SLABMAX */
+#define NCLASSES	(256 / 16 + (SLABMAX - 256) / 64)
+
+#define sizeclass(s)  \
+	((s) <= 256 ? (int)(((s) + 15) / 16) - 1  \
+	            : 256 / 16 + (int)(((s) - 256 + 63) / 64) - 1)
+
+#define classsize(c)  \
+	((c) < 256 / 16 ? ((size_t)(c) + 1) * 16 : 256 + ((size_t)(c) - 15) * 64)
+
+/* page of a block from a page */
+#define pageof(b)	((SlabPage *)((char *)(b) - (size_t)(b) % SLABPAGE))
+
+
+typedef struct SlabPool {
+  void *free;  /* list of free blocks */
+  char *next;  /* first block never used in the current page */
+  size_t left;  /* number of bytes after 'next' in the current page */
+  int sclass;  /* size class of its blocks */
+} SlabPool;
+
+
+typedef struct SlabPage {
+  SlabPool *pool;
+} SlabPage;
+
+
+typedef struct SlabChunk {
+  struct SlabChunk *previous;
+} SlabChunk;
+
+
+typedef struct Slab {
+  SlabPool pools[VMK_NUMTYPES][NCLASSES];
+  struct {
+    size_t live;  /* bytes in blocks being used */
+    size_t requested;  /* bytes asked for those blocks */
+    size_t reserved;  /* bytes in pages of this class */
+  } stats[NCLASSES];
+  size_t large;  /* bytes in large blocks */
+  size_t nblocks;  /* number of blocks being used */
+  SlabChunk *chunks;  /* list of chunks */
+  char *nextpage;  /* next page never used in the last chunk */
+  unsigned npages;  /* number of pages after 'nextpage' */
+  int owned;  /* true after its state is created */
+} Slab;
+
+
+static void freeslab (Slab *s) {
+  while (s->chunks != NULL) {
+    SlabChunk *c = s->chunks;
+    s->chunks = c->previous;
+    free(c);
+  }
+  free(s);
+}
+
+
+/*
+** Give a new page to pool 'p'. Returns 0 if there is no memory.
+*/
+static int newpage (Slab *s, SlabPool *p) {
+  SlabPage *pg;
+  if (s->npages == 0) {  /* last chunk is used up? */
+    size_t skip;
+    SlabChunk *c = (SlabChunk *)malloc((SLABCHUNK + 1) * SLABPAGE);
+    if (c == NULL)
+      return 0;
+    c->previous = s->chunks;
+    s->chunks = c;
+    /* first page starts at the first aligned address after the link */
+    skip = SLABPAGE - ((size_t)(c + 1) % SLABPAGE);
+    s->nextpage = (char *)(c + 1) + skip % SLABPAGE;
+    s->npages = SLABCHUNK;
+  }
+  pg = (SlabPage *)s->nextpage;
+  s->nextpage += SLABPAGE;
+  s->npages--;
+  pg->pool = p;
+  p->next = (char *)pg + SLABHEAD;
+  p->left = SLABPAGE - SLABHEAD;
+  s->stats[p->sclass].reserved += SLABPAGE - SLABHEAD;
+  return 1;
+}
+
+
+static void *slabnew (Slab *s, size_t nsize, int tt) {
+  void *b;
+  if (nsize > SLABMAX) {
+    b = malloc(nsize);
+    if (b == NULL)
+      return NULL;
+    s->large += nsize;
+  }
+  else {
+    int c = sizeclass(nsize);
+    size_t size = classsize(c);
+    SlabPool *p = &s->pools[tt][c];
+    if ((b = p->free) != NULL)
+      p->free = *(void **)b;
+    else {
+      if (p->left < size && !newpage(s, p))
+        return NULL;
+      b = p->next;
+      p->next += size;
+      p->left -= size;
+    }
+    s->stats[c].live += size;
+    s->stats[c].requested += nsize;
+  }
+  s->nblocks++;
+  return b;
+}
+
+
+static void slabfree (Slab *s, void *b, size_t osize) {
+  if (osize > SLABMAX) {
+    free(b);
+    s->large -= osize;
+  }
+  else {
+    SlabPool *p = pageof(b)->pool;
+    *(void **)b = p->free;
+    p->free = b;
+    s->stats[p->sclass].live -= classsize(p->sclass);
+    s->stats[p->sclass].requested -= osize;
+  }
+  s->nblocks--;
+}
+
+
+static void *slab_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Slab *s = (Slab *)ud;
+  if (ptr == NULL) {  /* new block? ('osize' is the type of an object) */
+    int tt = (osize < VMK_NUMTYPES) ? (int)osize : 0;
+    return (nsize == 0) ? NULL : slabnew(s, nsize, tt);
+  }
+  else if (nsize == 0) {
+    slabfree(s, ptr, osize);
+    if (s->nblocks == 0 && s->owned)  /* state is gone? */
+      freeslab(s);
+    return NULL;
+  }
+  else if (osize > SLABMAX && nsize > SLABMAX) {  /* both are large? */
+    void *b = realloc(ptr, nsize);
+    if (b != NULL)
+      s->large = s->large - osize + nsize;
+    return b;
+  }
+  else if (osize <= SLABMAX && nsize <= SLABMAX &&
+           sizeclass(osize) == sizeclass(nsize)) {  /* same class? */
+    int c = sizeclass(osize);
+    s->stats[c].requested = s->stats[c].requested - osize + nsize;
+    return ptr;
+  }
+  else {  /* move the block */
+    void *b = slabnew(s, nsize, 0);
+    if (b == NULL)
+      return NULL;
+    memcpy(b, ptr, (osize < nsize) ? osize : nsize);
+    slabfree(s, ptr, osize);
+    return b;
+  }
+}
+
+
+static void setsizefield (vmk_State *L, const char *k, size_t v) {
+  vmk_pushinteger(L, (vmk_Integer)v);
+  vmk_setfield(L, -2, k);
+}
+
+
+VMKLIB_API int vmkL_slabstats (vmk_State *L) {
+  void *ud;
+  Slab *s;
+  int c;
+  size_t live = 0, requested = 0, reserved = 0;
+  if (vmk_getallocf(L, &ud) != slab_alloc)
+    return 0;  /* state does not use the slab allocator */
+  s = (Slab *)ud;
+  vmk_createtable(L, NCLASSES, 5);
+  for (c = 0; c < NCLASSES; c++) {
+    vmk_createtable(L, 0, 4);
+    setsizefield(L, "size", classsize(c));
+    setsizefield(L, "live", s->stats[c].live);
+    setsizefield(L, "requested", s->stats[c].requested);
+    setsizefield(L, "reserved", s->stats[c].reserved);
+    vmk_rawseti(L, -2, c + 1);
+  }
+  for (c = 0; c < NCLASSES; c++) {  /* totals, after all allocations */
+    live += s->stats[c].live;
+    requested += s->stats[c].requested;
+    reserved += s->stats[c].reserved;
+  }
+  setsizefield(L, "live", live);
+  setsizefield(L, "requested", requested);
+  setsizefield(L, "reserved", reserved);
+  setsizefield(L, "large", s->large);
+  /* part of the pages not holding requested bytes */
+  vmk_pushnumber(L, (reserved == 0) ? 0 :
+                    1 - (vmk_Number)requested / (vmk_Number)reserved);
+  vmk_setfield(L, -2, "fragmentation");
+  return 1;
+}
+
+/* }====================================================== */
+
+
 /*
 ** Standard panic fn just prints an error message. The test
 ** with 'vmk_type' avoids possible memory errors in 'vmk_tostring'.
@@ -1182,11 +1417,34 @@ VMKLIB_API vmk_State *vmkL_newstate (void) {
   if (l_likely(L)) {
     vmk_atpanic(L, &panic);
     vmk_setwarnf(L, warnfoff, L);  /* default is warnings off */
+    vmk_gc(L, VMK_GCSWEEPER, 1);  /* 'l_alloc' can free in any thread */
   }
   return L;
 }
 
 
+VMKLIB_API vmk_State *vmkL_newslabstate (void) {
+  Slab *s = (Slab *)calloc(1, sizeof(Slab));
+  vmk_State *L;
+  int tt, c;
+  if (s == NULL)
+    return NULL;
+  for (tt = 0; tt < VMK_NUMTYPES; tt++) {
+    for (c = 0; c < NCLASSES; c++)
+      s->pools[tt][c].sclass = c;
+  }
+  L = vmk_newstate(slab_alloc, s, vmki_makeseed());
+  if (l_likely(L)) {
+    s->owned = 1;  /* from now on, dies with its state */
+    vmk_atpanic(L, &panic);
+    vmk_setwarnf(L, warnfoff, L);  /* default is warnings off */
+  }
+  else
+    freeslab(s);
+  return L;
+}
+
+
 VMKLIB_API void vmkL_checkversion_ (vmk_State *L, vmk_Number ver, size_t sz) {
   vmk_Number v = vmk_version(L);
   if (sz != VMKL_NUMSIZES)  /* check numeric types */
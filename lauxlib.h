@@ -99,6 +99,8 @@ VMKLIB_API int (vmkL_loadbufferx) (vmk_State *L, const char *buff, size_t sz,
 VMKLIB_API int (vmkL_loadstring) (vmk_State *L, const char *s);
 
 VMKLIB_API vmk_State *(vmkL_newstate) (void);
+VMKLIB_API vmk_State *(vmkL_newslabstate) (void);
+VMKLIB_API int (vmkL_slabstats) (vmk_State *L);
 
 VMKLIB_API unsigned vmkL_makeseed (vmk_State *L);
 
@@ -236,10 +236,10 @@ static int vmkB_collectgarbage (vmk_State *L) {
     case VMK_GCPARAM: {
       static const char *const params[] = {
         "minormul", "majorminor", "minormajor",
-        "pause", "stepmul", "stepsize", NULL};
+        "pause", "stepmul", "stepsize", "markthreads", NULL};
       static const char pnum[] = {
         VMK_GCPMINORMUL, VMK_GCPMAJORMINOR, VMK_GCPMINORMAJOR,
-        VMK_GCPPAUSE, VMK_GCPSTEPMUL, VMK_GCPSTEPSIZE};
+        VMK_GCPPAUSE, VMK_GCPSTEPMUL, VMK_GCPSTEPSIZE, VMK_GCPMARKTHREADS};
       int p = pnum[vmkL_checkoption(L, 2, NULL, params)];
       vmk_Integer value = vmkL_optinteger(L, 3, -1);
       vmk_pushinteger(L, vmk_gc(L, o, p, (int)value));
@@ -553,6 +553,8 @@ VMKMOD_API int vmkopen_base (vmk_State *L) {
   /* set global _VERSION */
   vmk_pushliteral(L, VMK_VERSION);
   vmk_setfield(L, -2, "_VERSION");
+  /* let generic for loops run the iterators of 'pairs' and 'ipairs' */
+  vmk_setiterators(L, vmkB_next, ipairsaux);
   return 1;
 }
 
@@ -342,6 +342,22 @@ static void savelineinfo (FuncState *fs, Proto *f, int line) {
 }
 
 
+/*
+** Rebuild the line information of the whole fn from the line of
+** each instruction. (Used after the optimizer changes the code.)
+*/
+void vmkK_relines (FuncState *fs, const int *lines) {
+  Proto *f = fs->f;
+  int n = fs->pc;
+  fs->nabslineinfo = 0;
+  fs->previousline = f->linedefined;
+  fs->iwthabs = 0;
+  for (fs->pc = 1; fs->pc <= n; fs->pc++)
+    savelineinfo(fs, f, lines[fs->pc - 1]);
+  fs->pc = n;
+}
+
+
 /*
 ** Remove line information from the last instruction.
 ** If line information for that instruction is absolute, set 'iwthabs'
@@ -666,6 +682,22 @@ static int nilK (FuncState *fs) {
 }
 
 
+/*
+** Add constant 'v', taken from another prototype, to the list of
+** constants and return its index.
+*/
+int vmkK_constant (FuncState *fs, const TValue *v) {
+  switch (ttypetag(v)) {
+    case VMK_VSHRSTR: case VMK_VLNGSTR: return stringK(fs, tsvalue(v));
+    case VMK_VNUMINT: return vmkK_intK(fs, ivalue(v));
+    case VMK_VNUMFLT: return vmkK_numberK(fs, fltvalue(v));
+    case VMK_VFALSE: return boolF(fs);
+    case VMK_VTRUE: return boolT(fs);
+    default: vmk_assert(ttisnil(v)); return nilK(fs);
+  }
+}
+
+
 /*
 ** Check whether 'i' can be stored in an 'sC' operand. Equivalent to
 ** (0 <= int2sC(i) && int2sC(i) <= MAXARG_C) but without risk of
@@ -1901,4 +1933,5 @@ void vmkK_finish (FuncState *fs) {
       default: break;
     }
   }
+  vmkP_fuse(p->code, fs->pc);
 }
@@ -67,6 +67,8 @@ VMKI_FUNC int vmkK_codevABCk (FuncState *fs, OpCode o, int A, int B, int C,
                                              int k);
 VMKI_FUNC int vmkK_exp2const (FuncState *fs, const expdesc *e, TValue *v);
 VMKI_FUNC void vmkK_fixline (FuncState *fs, int line);
+VMKI_FUNC int vmkK_constant (FuncState *fs, const TValue *v);
+VMKI_FUNC void vmkK_relines (FuncState *fs, const int *lines);
 VMKI_FUNC void vmkK_nil (FuncState *fs, int from, int n);
 VMKI_FUNC void vmkK_reserveregs (FuncState *fs, int n);
 VMKI_FUNC void vmkK_checkstack (FuncState *fs, int n);
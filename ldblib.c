@@ -151,7 +151,7 @@ static int db_getinfo (vmk_State *L) {
   vmk_Debug ar;
   int arg;
   vmk_State *L1 = getthread(L, &arg);
-  const char *options = vmkL_optstring(L, arg+2, "flnSrtu");
+  const char *options = vmkL_optstring(L, arg+2, "flnSrtui");
   checkstack(L, L1, 3);
   vmkL_argcheck(L, options[0] != '>', arg + 2, "invalid option '>'");
   if (vmk_isfunction(L, arg + 1)) {  /* info about a fn? */
@@ -195,6 +195,10 @@ static int db_getinfo (vmk_State *L) {
     settabsb(L, "istailcall", ar.istailcall);
     settabsi(L, "extraargs", ar.extraargs);
   }
+  if (strchr(options, 'i')) {
+    settabss(L, "inlined", ar.inlined);
+    settabsi(L, "callline", ar.callline);
+  }
   if (strchr(options, 'L'))
     treatstackoption(L, L1, "activelines");
   if (strchr(options, 'f'))
@@ -449,6 +453,63 @@ static int db_traceback (vmk_State *L) {
 }
 
 
+/*
+** Counters of pairs of opcodes dispatched one after the other; 'fail'
+** when they were not compiled in (see 'vmk_oppairs').
+*/
+static int db_oppairs (vmk_State *L) {
+  if (!vmk_oppairs(L))
+    vmkL_pushfail(L);
+  return 1;
+}
+
+
+/*
+** Counters of the opcode profiler: for each opcode, or for each
+** instruction of a given function; 'fail' when the profiler was not
+** compiled in (see 'vmk_opstats').
+*/
+static int db_opstats (vmk_State *L) {
+  int funcindex = 0;
+  if (!vmk_isnoneornil(L, 1)) {
+    vmkL_checktype(L, 1, VMK_TFUNCTION);
+    funcindex = 1;
+  }
+  if (!vmk_opstats(L, funcindex))
+    vmkL_pushfail(L);
+  return 1;
+}
+
+
+static int db_resetopstats (vmk_State *L) {
+  vmk_resetopstats(L, vmk_toboolean(L, 1));
+  return 0;
+}
+
+
+/*
+** Statistics of the slab allocator (see 'vmkL_slabstats'); 'fail' if
+** the state does not use it.
+*/
+static int db_slabstats (vmk_State *L) {
+  if (!vmkL_slabstats(L))
+    vmkL_pushfail(L);
+  return 1;
+}
+
+
+/*
+** Size feedback of the table constructors of a function (see
+** 'vmk_tablesites'); 'fail' if it is not a Vmk function.
+*/
+static int db_tablesites (vmk_State *L) {
+  vmkL_checktype(L, 1, VMK_TFUNCTION);
+  if (!vmk_tablesites(L, 1))
+    vmkL_pushfail(L);
+  return 1;
+}
+
+
 static const vmkL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
@@ -458,6 +519,10 @@ static const vmkL_Reg dblib[] = {
   {"getregistry", db_getregistry},
   {"getmetatable", db_getmetatable},
   {"getupvalue", db_getupvalue},
+  {"oppairs", db_oppairs},
+  {"opstats", db_opstats},
+  {"resetopstats", db_resetopstats},
+  {"slabstats", db_slabstats},
   {"upvaluejoin", db_upvaluejoin},
   {"upvalueid", db_upvalueid},
   {"setuservalue", db_setuservalue},
@@ -465,6 +530,7 @@ static const vmkL_Reg dblib[] = {
   {"setlocal", db_setlocal},
   {"setmetatable", db_setmetatable},
   {"setupvalue", db_setupvalue},
+  {"tablesites", db_tablesites},
   {"traceback", db_traceback},
   {NULL, NULL}
 };
@@ -21,6 +21,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -142,6 +143,35 @@ VMK_API void vmk_sethook (vmk_State *L, vmk_Hook func, int mask, int count) {
 }
 
 
+/*
+** The sampler is called before the next instruction of the running
+** thread after each call to 'vmk_requestsample'. It can inspect the
+** stack through the debug API, but it cannot change it, call Vmk
+** functions, or raise errors.
+*/
+VMK_API void vmk_setsampler (vmk_State *L, vmk_Sampler f, void *ud) {
+  global_State *g = G(L);
+  g->sampler = NULL;  /* no calls while changing 'ud_sampler' */
+  g->samplereq = 0;
+  g->ud_sampler = ud;
+  g->sampler = f;
+}
+
+
+/*
+** This fn can be called during a signal, under the same
+** "reasonable" assumptions as 'vmk_sethook'. The sample is taken
+** when the running thread executes its next Vmk instruction.
+*/
+VMK_API void vmk_requestsample (vmk_State *L) {
+  global_State *g = G(L);
+  if (g->sampler != NULL) {
+    g->samplereq = 1;
+    settraps(g->running->ci);  /* to stop inside 'vmkV_execute' */
+  }
+}
+
+
 VMK_API vmk_Hook vmk_gethook (vmk_State *L) {
   return L->hook;
 }
@@ -319,6 +349,13 @@ static void collectvalidlines (vmk_State *L, Closure *f) {
 
 
 static const char *getfuncname (vmk_State *L, CallInfo *ci, const char **name) {
+  if (ci != NULL && isVmk(ci)) {  /* running code of an inlined call? */
+    const InlineInfo *ii = vmkF_getinlined(ci_func(ci)->p, currentpc(ci));
+    if (ii != NULL) {
+      *name = getstr(ii->name);
+      return "lck";
+    }
+  }
   /* calling fn is a known fn? */
   if (ci != NULL && !(ci->callstatus & CIST_TAIL))
     return funcnamefromcall(L, ci->previous, name);
@@ -380,6 +417,20 @@ static int auxgetinfo (vmk_State *L, const char *what, vmk_Debug *ar,
         }
         break;
       }
+      case 'i': {
+        const InlineInfo *ii = NULL;
+        if (ci != NULL && isVmk(ci))
+          ii = vmkF_getinlined(ci_func(ci)->p, currentpc(ci));
+        if (ii == NULL) {
+          ar->inlined = NULL;
+          ar->callline = -1;
+        }
+        else {
+          ar->inlined = getstr(ii->name);
+          ar->callline = ii->line;
+        }
+        break;
+      }
       case 'L':
       case 'f':  /* handled by vmk_getinfo */
         break;
@@ -445,7 +496,7 @@ static int findsetreg (const Proto *p, int lastpc, int reg) {
   if (testMMMode(GET_OPCODE(p->code[lastpc])))
     lastpc--;  /* previous instruction was not actually executed */
   for (pc = 0; pc < lastpc; pc++) {
-    Instruction i = p->code[pc];
+    Instruction i = vmkP_unquicken(p->code[pc]);
     OpCode op = GET_OPCODE(i);
     int a = GETARG_A(i);
     int change;  /* true if current instruction changed 'reg' */
@@ -509,7 +560,7 @@ static const char *basicgetobjname (const Proto *p, int *ppc, int reg,
   /* else try symbolic execution */
   *ppc = pc = findsetreg(p, pc, reg);
   if (pc != -1) {  /* could find instruction? */
-    Instruction i = p->code[pc];
+    Instruction i = vmkP_unquicken(p->code[pc]);
     OpCode op = GET_OPCODE(i);
     switch (op) {
       case OP_MOVE: {
@@ -565,7 +616,7 @@ static const char *getobjname (const Proto *p, int lastpc, int reg,
   if (kind != NULL)
     return kind;
   else if (lastpc != -1) {  /* could find instruction? */
-    Instruction i = p->code[lastpc];
+    Instruction i = vmkP_unquicken(p->code[lastpc]);
     OpCode op = GET_OPCODE(i);
     switch (op) {
       case OP_GETTABUP: {
@@ -608,7 +659,7 @@ static const char *getobjname (const Proto *p, int lastpc, int reg,
 static const char *funcnamefromcode (vmk_State *L, const Proto *p,
                                      int pc, const char **name) {
   TMS tm = (TMS)0;  /* (initial value avoids warnings) */
-  Instruction i = p->code[pc];  /* calling instruction */
+  Instruction i = vmkP_unquicken(p->code[pc]);  /* calling instruction */
   switch (GET_OPCODE(i)) {
     case OP_CALL:
     case OP_TAILCALL:
@@ -905,6 +956,24 @@ int vmkG_tracecall (vmk_State *L) {
 }
 
 
+/*
+** Calls the sampler with 'savedpc' as it would be while running the
+** instruction at 'pc', so that it is the current instruction for the
+** debug API.
+*/
+static void takesample (vmk_State *L, const Instruction *pc) {
+  global_State *g = G(L);
+  vmk_Sampler f = g->sampler;
+  g->samplereq = 0;
+  if (f != NULL) {
+    L->ci->u.l.savedpc = pc + 1;
+    vmk_unlock(L);
+    f(L, g->ud_sampler);
+    vmk_lock(L);
+  }
+}
+
+
 /*
 ** Traces the execution of a Vmk fn. Called before the execution
 ** of each opcode, when debug is on. 'L->oldpc' stores the last
@@ -922,7 +991,13 @@ int vmkG_traceexec (vmk_State *L, const Instruction *pc) {
   lu_byte mask = cast_byte(L->hookmask);
   const Proto *p = ci_func(ci)->p;
   int counthook;
+  if (l_unlikely(G(L)->samplereq))
+    takesample(L, pc);
   if (!(mask & (VMK_MASKLINE | VMK_MASKCOUNT))) {  /* no hooks? */
+#if defined(VMK_USE_JIT)
+    if (G(L)->jitrec != NULL && vmkJ_record(L, pc))
+      return 1;  /* recording a trace; stop again */
+#endif
     ci->u.l.trap = 0;  /* don't need to stop again */
     return 0;  /* turn off 'trap' */
   }
@@ -610,6 +610,20 @@ l_sinline int precallC (vmk_State *L, StkId func, unsigned status,
 }
 
 
+/*
+** A prototype loaded from a fixed buffer gets its inline caches (see
+** 'vmkF_newicache') when it is called for the first time, so that a
+** big chunk kept in fixed memory does not cost memory for the code
+** that never runs. (The allocation may run an emergency collection,
+** so it preserves 'func' like 'checkstackp'.)
+*/
+#define checkicache(L,p,func)  \
+  if (l_unlikely((p)->icache == NULL)) { \
+    ptrdiff_t t__ = savestack(L, func); \
+    vmkF_newicache(L, p); \
+    func = restorestack(L, t__); }
+
+
 /*
 ** Prepare a fn for a tail call, building its call info on top
 ** of the current call info. 'narg1' is the number of arguments plus 1
@@ -630,6 +644,7 @@ int vmkD_pretailcall (vmk_State *L, CallInfo *ci, StkId func,
       int fsize = p->maxstacksize;  /* frame size */
       int nfixparams = p->numparams;
       int i;
+      checkicache(L, p, func);
       checkstackp(L, fsize - delta, func);
       ci->func.p -= delta;  /* restore 'func' (if vararg) */
       for (i = 0; i < narg1; i++)  /* move down fn and arguments */
@@ -679,6 +694,7 @@ CallInfo *vmkD_precall (vmk_State *L, StkId func, int nresults) {
       int narg = cast_int(L->top.p - func) - 1;  /* number of real arguments */
       int nfixparams = p->numparams;
       int fsize = p->maxstacksize;  /* frame size */
+      checkicache(L, p, func);
       checkstackp(L, fsize, func);
       L->ci = ci = prepCallInfo(L, func, status, func + 1 + fsize);
       ci->u.l.savedpc = p->code;  /* starting point */
@@ -915,6 +931,7 @@ static int precover (vmk_State *L, int status) {
 VMK_API int vmk_resume (vmk_State *L, vmk_State *from, int nargs,
                                       int *nresults) {
   int status;
+  vmk_State *running;
   vmk_lock(L);
   if (L->status == VMK_OK) {  /* may be starting a coroutine */
     if (L->ci != &L->base_ci)  /* not in base level? */
@@ -930,9 +947,12 @@ VMK_API int vmk_resume (vmk_State *L, vmk_State *from, int nargs,
   L->nCcalls++;
   vmki_userstateresume(L, nargs);
   api_checkpop(L, (L->status == VMK_OK) ? nargs + 1 : nargs);
+  running = G(L)->running;
+  G(L)->running = L;
   status = vmkD_rawrunprotected(L, resume, &nargs);
    /* continue running after recoverable errors */
   status = precover(L, status);
+  G(L)->running = running;
   if (l_likely(!errorstatus(status)))
     vmk_assert(status == L->status);  /* normal end or yield */
   else {  /* unrecoverable error */
@@ -1084,7 +1104,8 @@ static void f_parser (vmk_State *L, void *ud) {
   }
   else {
     checkmode(L, mode, "text");
-    cl = vmkY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
+    cl = vmkY_parser(L, p->z, &p->buff, &p->dyd, p->name, c,
+                     strchr(mode, 'O') != NULL);
   }
   vmk_assert(cl->nupvalues == cl->p->sizeupvalues);
   vmkF_initupvals(L, cl);
@@ -1100,12 +1121,14 @@ int vmkD_protectedparser (vmk_State *L, ZIO *z, const char *name,
   p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
   p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
   p.dyd.label.arr = NULL; p.dyd.label.size = 0;
+  p.dyd.inl.arr = NULL; p.dyd.inl.size = 0;
   vmkZ_initbuffer(L, &p.buff);
   status = vmkD_pcall(L, f_parser, &p, savestack(L, L->top.p), L->errfunc);
   vmkZ_freebuffer(L, &p.buff);
   vmkM_freearray(L, p.dyd.actvar.arr, cast_sizet(p.dyd.actvar.size));
   vmkM_freearray(L, p.dyd.gt.arr, cast_sizet(p.dyd.gt.size));
   vmkM_freearray(L, p.dyd.label.arr, cast_sizet(p.dyd.label.size));
+  vmkM_freearray(L, p.dyd.inl.arr, cast_sizet(p.dyd.inl.size));
   decnny(L);
   return status;
 }
@@ -18,6 +18,7 @@
 #include "lapi.h"
 #include "lgc.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "ltable.h"
 #include "lundump.h"
@@ -155,11 +156,26 @@ static void dumpString (DumpState *D, TString *ts) {
 }
 
 
+/*
+** Dump the code of a fn. Instructions quickened by the interpreter
+** or fused into superinstructions are dumped in their generic form;
+** runs of other instructions are dumped as blocks.
+*/
 static void dumpCode (DumpState *D, const Proto *f) {
+  int i;
+  int first = 0;  /* first instruction not dumped yet */
   dumpInt(D, f->sizecode);
   dumpAlign(D, sizeof(f->code[0]));
   vmk_assert(f->code != NULL);
-  dumpVector(D, f->code, cast_uint(f->sizecode));
+  for (i = 0; i < f->sizecode; i++) {
+    Instruction inst = vmkP_unquicken(f->code[i]);
+    if (inst != f->code[i]) {  /* quickened instruction? */
+      dumpVector(D, f->code + first, cast_uint(i - first));
+      dumpVar(D, inst);
+      first = i + 1;
+    }
+  }
+  dumpVector(D, f->code + first, cast_uint(f->sizecode - first));
 }
 
 
@@ -231,6 +247,14 @@ static void dumpDebug (DumpState *D, const Proto *f) {
     dumpInt(D, f->locvars[i].startpc);
     dumpInt(D, f->locvars[i].endpc);
   }
+  n = (D->strip) ? 0 : f->sizeinlines;
+  dumpInt(D, n);
+  for (i = 0; i < n; i++) {
+    dumpString(D, f->inlines[i].name);
+    dumpInt(D, f->inlines[i].startpc);
+    dumpInt(D, f->inlines[i].endpc);
+    dumpInt(D, f->inlines[i].line);
+  }
   n = (D->strip) ? 0 : f->sizeupvalues;
   dumpInt(D, n);
   for (i = 0; i < n; i++)
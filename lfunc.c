@@ -18,9 +18,11 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lvm.h"
 
 
 
@@ -246,6 +248,16 @@ Proto *vmkF_newproto (vmk_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->sizecode = 0;
+  f->icache = NULL;
+#if defined(VMK_USE_JIT)
+  f->jitcount = 0;
+  f->jit = NULL;
+  f->traces = NULL;
+#endif
+#if defined(VMK_USE_OPSTATS)
+  f->opcount = NULL;
+  f->opepoch = 0;
+#endif
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
   f->abslineinfo = NULL;
@@ -257,6 +269,8 @@ Proto *vmkF_newproto (vmk_State *L) {
   f->maxstacksize = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
+  f->inlines = NULL;
+  f->sizeinlines = 0;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
@@ -264,12 +278,34 @@ Proto *vmkF_newproto (vmk_State *L) {
 }
 
 
+/*
+** Create the inline caches for a prototype whose code is complete (or,
+** for code in a fixed buffer, when the prototype is first called).
+** There is one cache for each instruction; it keeps the index of the
+** node where a field access found its key the last time. A zeroed
+** cache is valid: it just misses.
+*/
+void vmkF_newicache (vmk_State *L, Proto *f) {
+  int i;
+  vmk_assert(f->icache == NULL && f->sizecode > 0);
+  f->icache = vmkM_newvector(L, cast_sizet(f->sizecode), unsigned int);
+  for (i = 0; i < f->sizecode; i++)
+    f->icache[i] = 0;
+}
+
+
 lu_mem vmkF_protosize (Proto *p) {
   lu_mem sz = cast(lu_mem, sizeof(Proto))
             + cast_uint(p->sizep) * sizeof(Proto*)
             + cast_uint(p->sizek) * sizeof(TValue)
             + cast_uint(p->sizelocvars) * sizeof(LocVar)
+            + cast_uint(p->sizeinlines) * sizeof(InlineInfo)
             + cast_uint(p->sizeupvalues) * sizeof(Upvaldesc);
+  if (p->icache != NULL)
+    sz += cast_uint(p->sizecode) * sizeof(unsigned int);
+#if defined(VMK_USE_JIT)
+  sz += vmkJ_size(p);
+#endif
   if (!(p->flag & PF_FIXED)) {
     sz += cast_uint(p->sizecode) * sizeof(Instruction);
     sz += cast_uint(p->sizelineinfo) * sizeof(lu_byte);
@@ -280,6 +316,14 @@ lu_mem vmkF_protosize (Proto *p) {
 
 
 void vmkF_freeproto (vmk_State *L, Proto *f) {
+#if defined(VMK_USE_JIT)
+  vmkJ_free(L, f);
+#endif
+#if defined(VMK_USE_OPSTATS)
+  vmkV_freeopcount(G(L), f);
+#endif
+  if (f->icache != NULL)
+    vmkM_freearray(L, f->icache, cast_sizet(f->sizecode));
   if (!(f->flag & PF_FIXED)) {
     vmkM_freearray(L, f->code, cast_sizet(f->sizecode));
     vmkM_freearray(L, f->lineinfo, cast_sizet(f->sizelineinfo));
@@ -288,6 +332,7 @@ void vmkF_freeproto (vmk_State *L, Proto *f) {
   vmkM_freearray(L, f->p, cast_sizet(f->sizep));
   vmkM_freearray(L, f->k, cast_sizet(f->sizek));
   vmkM_freearray(L, f->locvars, cast_sizet(f->sizelocvars));
+  vmkM_freearray(L, f->inlines, cast_sizet(f->sizeinlines));
   vmkM_freearray(L, f->upvalues, cast_sizet(f->sizeupvalues));
   vmkM_free(L, f);
 }
@@ -309,3 +354,17 @@ const char *vmkF_getlocalname (const Proto *f, int local_number, int pc) {
   return NULL;  /* not found */
 }
 
+
+/*
+** Look for a call inlined in fn 'f' whose code contains instruction
+** 'pc'. Returns NULL if not found.
+*/
+const InlineInfo *vmkF_getinlined (const Proto *f, int pc) {
+  int i;
+  for (i = 0; i < f->sizeinlines; i++) {
+    if (f->inlines[i].startpc <= pc && pc < f->inlines[i].endpc)
+      return &f->inlines[i];
+  }
+  return NULL;  /* not found */
+}
+
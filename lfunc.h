@@ -56,10 +56,12 @@ VMKI_FUNC void vmkF_newtbcupval (vmk_State *L, StkId level);
 VMKI_FUNC void vmkF_closeupval (vmk_State *L, StkId level);
 VMKI_FUNC StkId vmkF_close (vmk_State *L, StkId level, int status, int yy);
 VMKI_FUNC void vmkF_unlinkupval (UpVal *uv);
+VMKI_FUNC void vmkF_newicache (vmk_State *L, Proto *f);
 VMKI_FUNC lu_mem vmkF_protosize (Proto *p);
 VMKI_FUNC void vmkF_freeproto (vmk_State *L, Proto *f);
 VMKI_FUNC const char *vmkF_getlocalname (const Proto *func, int local_number,
                                          int pc);
+VMKI_FUNC const InlineInfo *vmkF_getinlined (const Proto *f, int pc);
 
 
 #endif
@@ -11,6 +11,10 @@
 
 #include <string.h>
 
+#if defined(VMK_USE_PARMARK) || defined(VMK_USE_BGSWEEP)
+#include <pthread.h>
+#endif
+
 
 #include "vmk.h"
 
@@ -97,6 +101,185 @@ static void atomic (vmk_State *L);
 static void entersweep (vmk_State *L);
 
 
+/*
+** {======================================================
+** Nursery
+** In generational mode, small objects of the most common types are
+** bump-allocated in the pages of a region (the nursery) instead of
+** being allocated one by one. Objects are never moved: each page
+** counts its live objects, and a page whose objects are all dead is
+** ready for new ones. So, freeing a young object only decrements that
+** count, and the survivors of a minor collection are promoted in place,
+** retaining their page until they die. When no page is empty, new
+** objects go to the allocator as usual.
+** =======================================================
+*/
+
+#if defined(VMK_USE_NURSERY)
+
+/* size of a page of the nursery */
+#if !defined(VMKI_NURSERYPAGE)
+#define VMKI_NURSERYPAGE	(1 << 13)
+#endif
+
+/* number of pages in the nursery */
+#if !defined(VMKI_NURSERYPAGES)
+#define VMKI_NURSERYPAGES	128
+#endif
+
+/* objects larger than that always go to the allocator */
+#define NURSERYMAX	256
+
+/* allows tests to send all objects to the allocator */
+#if !defined(vmki_nurseryoff)
+#define vmki_nurseryoff(g)	0
+#endif
+
+#define NURSERYSIZE	(cast_sizet(VMKI_NURSERYPAGE) * VMKI_NURSERYPAGES)
+
+
+typedef union { VMKI_MAXALIGN; } NurseryAlign;
+
+/* space used in the nursery by a block with 's' bytes */
+#define nurseryblock(s)  \
+	(((s) + sizeof(NurseryAlign) - 1) & ~(sizeof(NurseryAlign) - 1))
+
+
+typedef struct Nursery {
+  char *top;  /* first free byte in current page */
+  char *limit;  /* end of current page */
+  char *base;  /* first page */
+  vmk_Alloc frealloc;  /* allocator that owns the region */
+  void *ud;
+  unsigned cur;  /* current page */
+  int full;  /* true if there are no empty pages */
+  unsigned live[VMKI_NURSERYPAGES];  /* number of live objects per page */
+} Nursery;
+
+
+#define innursery(ns,p)  \
+	(cast(L_P2I, p) - cast(L_P2I, (ns)->base) < NURSERYSIZE)
+
+#define nurserypage(ns,p)  \
+	cast_uint((cast(L_P2I, p) - cast(L_P2I, (ns)->base)) / VMKI_NURSERYPAGE)
+
+
+static void setpage (Nursery *ns, unsigned n) {
+  ns->cur = n;
+  ns->top = ns->base + cast_sizet(n) * VMKI_NURSERYPAGE;
+  ns->limit = ns->top + VMKI_NURSERYPAGE;
+}
+
+
+static void newnursery (global_State *g) {
+  Nursery *ns = cast(Nursery *, (*g->frealloc)(g->ud, NULL, 0,
+                                                sizeof(Nursery)));
+  if (ns == NULL)
+    return;  /* go on without a nursery */
+  ns->base = cast_charp((*g->frealloc)(g->ud, NULL, 0, NURSERYSIZE));
+  if (ns->base == NULL) {
+    (*g->frealloc)(g->ud, ns, sizeof(Nursery), 0);
+    return;
+  }
+  ns->frealloc = g->frealloc;
+  ns->ud = g->ud;
+  ns->full = 0;
+  memset(ns->live, 0, sizeof(ns->live));
+  setpage(ns, 0);
+  g->nursery = ns;
+}
+
+
+static void freenursery (global_State *g) {
+  Nursery *ns = g->nursery;
+  if (ns != NULL) {
+    g->nursery = NULL;
+    (*ns->frealloc)(ns->ud, ns->base, NURSERYSIZE, 0);
+    (*ns->frealloc)(ns->ud, ns, sizeof(Nursery), 0);
+  }
+}
+
+
+/*
+** Move the allocation to an empty page other than the current one.
+** Returns false if there is none. It takes the first empty page, so
+** that the same few pages (still in the cache) serve most objects.
+*/
+static int nextpage (Nursery *ns) {
+  unsigned n;
+  if (ns->full)
+    return 0;
+  for (n = 0; n < VMKI_NURSERYPAGES; n++) {
+    if (ns->live[n] == 0 && n != ns->cur) {
+      setpage(ns, n);
+      return 1;
+    }
+  }
+  ns->full = 1;
+  return 0;
+}
+
+
+/*
+** Try to allocate a new object in the nursery. Returns NULL if the
+** object must go to the allocator.
+*/
+static void *nurseryalloc (global_State *g, lu_byte tt, size_t sz) {
+  Nursery *ns = g->nursery;
+  size_t bsz = nurseryblock(sz);
+  char *p;
+  if (ns == NULL || g->gckind != KGC_GENMINOR || sz > NURSERYMAX ||
+      vmki_nurseryoff(g))
+    return NULL;
+  switch (tt) {
+    case VMK_VTABLE: case VMK_VLCL: case VMK_VCCL:
+    case VMK_VUPVAL: case VMK_VSHRSTR: case VMK_VUSERDATA:
+      break;
+    default: return NULL;  /* not worth it */
+  }
+  if (cast_sizet(ns->limit - ns->top) < bsz && !nextpage(ns))
+    return NULL;
+  p = ns->top;
+  ns->top += bsz;
+  ns->live[ns->cur]++;
+  g->GCdebt -= cast(l_mem, sz);
+  return p;
+}
+
+
+/*
+** Free the block of a dead object, which may live in the nursery.
+*/
+void vmkC_freeobject (vmk_State *L, void *block, size_t size) {
+  global_State *g = G(L);
+  Nursery *ns = g->nursery;
+  if (ns != NULL && innursery(ns, block)) {
+    unsigned n = nurserypage(ns, block);
+    vmk_assert(ns->live[n] > 0);
+    if (--ns->live[n] == 0) {  /* page is empty? */
+      if (n == ns->cur)
+        setpage(ns, n);  /* reuse it from the start */
+      else
+        ns->full = 0;
+    }
+    g->GCdebt += cast(l_mem, size);
+  }
+  else
+    vmkM_freemem(L, block, size);
+}
+
+#else
+
+#define newnursery(g)		((void)0)
+#define freenursery(g)		((void)0)
+#define nurseryalloc(g,tt,sz)	NULL
+
+#endif
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** Generic functions
@@ -280,6 +463,33 @@ void vmkC_barrierback_ (vmk_State *L, GCObject *o) {
 }
 
 
+/*
+** Barrier for a store of the white object 'v' into the black object
+** 'o' (usually a table). A backward barrier would make the collector
+** traverse 'o' again, which for a big table means all its entries for
+** what often is a single store (and, in generational mode, in every
+** minor collection while the table gets stores). So, stores into big
+** tables mark 'v' instead. (Weak tables keep the backward barrier, so
+** that their entries do not get marked.) In generational mode, 'v'
+** then becomes old: if it is overwritten, it lives until the next
+** major collection, not the next minor one. Those values count as
+** bytes becoming old, so they bring that major collection once they
+** reach 'minormajor'% of the heap (see 'checkminormajor').
+*/
+void vmkC_barriertable_ (vmk_State *L, GCObject *o, GCObject *v) {
+  global_State *g = G(L);
+  if (o->tt == VMK_VTABLE) {
+    Table *h = gco2t(o);
+    if (h->asize + allocsizenode(h) >= VMKI_BIGTABLE &&
+        gfasttm(g, h->metatable, TM_MODE) == NULL) {
+      vmkC_barrier_(L, o, v);
+      return;
+    }
+  }
+  vmkC_barrierback_(L, o);
+}
+
+
 void vmkC_fix (vmk_State *L, GCObject *o) {
   global_State *g = G(L);
   vmk_assert(g->allgc == o);  /* object must be 1st in 'allgc' list! */
@@ -297,8 +507,12 @@ void vmkC_fix (vmk_State *L, GCObject *o) {
 */
 GCObject *vmkC_newobjdt (vmk_State *L, lu_byte tt, size_t sz, size_t offset) {
   global_State *g = G(L);
-  char *p = cast_charp(vmkM_newobject(L, novariant(tt), sz));
-  GCObject *o = cast(GCObject *, p + offset);
+  char *p = cast_charp(nurseryalloc(g, tt, sz));
+  GCObject *o;
+  vmk_assert(p == NULL || offset == 0);
+  if (p == NULL)
+    p = cast_charp(vmkM_newobject(L, novariant(tt), sz));
+  o = cast(GCObject *, p + offset);
   o->marked = vmkC_white(g);
   o->tt = tt;
   o->next = g->allgc;
@@ -484,9 +698,14 @@ static void genlink (global_State *g, GCObject *o) {
 */
 static void traverseweakvalue (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
-  /* if there is array part, assume it may have white values (it is not
-     worth traversing it now just to check) */
-  int hasclears = (h->asize > 0);
+  /* if there is a generic array part, assume it may have white values
+     (it is not worth traversing it now just to check) */
+  int hasclears = (h->asize > 0 && !isarrtyped(h));
+  unsigned i;
+  for (i = 0; !hasclears && i < nslots(h); i++) {  /* traverse slots */
+    if (iscleared(g, gcvalueN(&h->slots[i])))  /* a white value? */
+      hasclears = 1;  /* table will have to be cleared */
+  }
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
@@ -505,12 +724,15 @@ static void traverseweakvalue (global_State *g, Table *h) {
 
 
 /*
-** Traverse the array part of a table.
+** Traverse the array part of a table. (A typed array part has only
+** numbers.)
 */
 static int traversearray (global_State *g, Table *h) {
   unsigned asize = h->asize;
   int marked = 0;  /* true if some object is marked in this traversal */
   unsigned i;
+  if (hastypedarray(h))
+    return 0;
   for (i = 0; i < asize; i++) {
     GCObject *o = gcvalarr(h, i);
     if (o != NULL && iswhite(o)) {
@@ -540,6 +762,13 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
   unsigned int i;
   unsigned int nsize = sizenode(h);
   int marked = traversearray(g, h);  /* traverse array part */
+  /* keys in slots are strings, which are never cleared */
+  for (i = 0; i < nslots(h); i++) {
+    if (valiswhite(&h->slots[i])) {  /* value not marked yet? */
+      marked = 1;
+      reallymarkobject(g, gcvalue(&h->slots[i]));  /* mark it now */
+    }
+  }
   /* traverse hash part; if 'inv', traverse descending
      (see 'convergeephemerons') */
   for (i = 0; i < nsize; i++) {
@@ -571,7 +800,10 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
 
 static void traversestrongtable (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
+  unsigned i;
   traversearray(g, h);
+  for (i = 0; i < nslots(h); i++)  /* traverse slots */
+    markvalue(g, &h->slots[i]);
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
@@ -585,11 +817,32 @@ static void traversestrongtable (global_State *g, Table *h) {
 }
 
 
+/*
+** Measure table 'h' for the last time. An emergency collection may come
+** in the middle of the filling of 'h', so it records nothing; it still
+** clears the site, as the prototype holding that site may be freed in
+** this same cycle.
+*/
+static void lastsample (global_State *g, Table *h) {
+  if (g->gcemergency)
+    tabext(h)->site = NULL;
+  else
+    vmkH_sample(h, 1);
+}
+
+
 static l_mem traversetable (global_State *g, Table *h) {
   const char *weakkey, *weakvalue;
   const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
   TString *smode;
+  if (getsite(h) != NULL)  /* not measured for the last time yet? */
+    lastsample(g, h);
   markobjectN(g, h->metatable);
+  if (hasslots(h)) {  /* mark the keys in its shape, if any */
+    unsigned i;
+    for (i = 0; i < nslots(h); i++)
+      markobject(g, getshape(h)->keys[i]);
+  }
   if (mode && ttisshrstring(mode) &&  /* is there a weak mode? */
       (cast_void(smode = tsvalue(mode)),
        cast_void(weakkey = strchr(getshrstr(smode), 'k')),
@@ -604,7 +857,7 @@ static l_mem traversetable (global_State *g, Table *h) {
   }
   else  /* not weak */
     traversestrongtable(g, h);
-  return 1 + 2*sizenode(h) + h->asize;
+  return 1 + 2*sizenode(h) + (hastypedarray(h) ? 0 : h->asize) + nslots(h);
 }
 
 
@@ -634,7 +887,10 @@ static l_mem traverseproto (global_State *g, Proto *f) {
     markobjectN(g, f->p[i]);
   for (i = 0; i < f->sizelocvars; i++)  /* mark lck-variable names */
     markobjectN(g, f->locvars[i].varname);
-  return 1 + f->sizek + f->sizeupvalues + f->sizep + f->sizelocvars;
+  for (i = 0; i < f->sizeinlines; i++)  /* mark names of inlined functions */
+    markobjectN(g, f->inlines[i].name);
+  return 1 + f->sizek + f->sizeupvalues + f->sizep + f->sizelocvars +
+             f->sizeinlines;
 }
 
 
@@ -756,6 +1012,406 @@ static void convergeephemerons (global_State *g) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Parallel marking
+** A full collection can propagate marks with helper threads. Each
+** thread keeps its own list of gray objects; a thread with enough
+** objects shares half of them when some thread is waiting for work,
+** and marking ends when all threads are waiting. A thread owns the
+** objects it turns from white to gray (with an atomic operation on
+** their 'marked' fields), so no two threads traverse the same object.
+** Other threads may still read the 'marked' field of an object while
+** its owner changes it, so all accesses to that field while helper
+** threads run are atomic. (Relaxed order is enough: that field is
+** the only one written by more than one thread, and lists of objects
+** pass from one thread to another under the lock of 'MarkShared'.)
+** Objects that would need changes to other lists of the collector
+** (threads, weak tables, objects with ages from generational mode)
+** are left to the collector thread (the one running the collector),
+** which traverses them after the helper threads finish; objects marked
+** by that traversal start another parallel round. Tables with size
+** feedback are also sampled at that point, as tables from the same
+** constructor share a site.
+** =======================================================
+*/
+
+#if defined(VMK_USE_PARMARK)
+
+/* maximum number of lists of gray objects shared by threads */
+#define MAXSHARED	64
+
+/* minimum number of gray objects for a thread to share them */
+#define MINSHARE	32
+
+
+typedef struct Marker {
+  struct MarkShared *ms;
+  GCObject *gray;  /* gray objects to be traversed by this thread */
+  unsigned ngray;  /* number of objects in 'gray' */
+  GCObject *serial;  /* gray objects left to the collector thread */
+  GCObject *tosample;  /* traversed tables with size feedback */
+  l_mem marked;  /* number of bytes marked by this thread */
+} Marker;
+
+
+typedef struct MarkShared {
+  global_State *g;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;  /* signals new shared objects or the end */
+  struct {
+    GCObject *list;
+    unsigned n;
+  } pool[MAXSHARED];  /* lists of gray objects shared by threads */
+  int npool;  /* number of lists in 'pool' */
+  int nidle;  /* number of threads waiting for work */
+  int nthreads;  /* number of threads marking objects */
+} MarkShared;
+
+
+/* atomic versions of the macros that access field 'marked' */
+#define pgetmarked(o)	__atomic_load_n(&(o)->marked, __ATOMIC_RELAXED)
+#define piswhite(o)	testbits(pgetmarked(o), WHITEBITS)
+#define pgetage(o)	(pgetmarked(o) & AGEBITS)
+#define pnw2black(o)	check_exp(!piswhite(o), cast_void(  \
+	__atomic_fetch_or(&(o)->marked, bitmask(BLACKBIT), __ATOMIC_RELAXED)))
+
+
+#define pmarkvalue(w,o)  \
+	{ if (iscollectable(o) && piswhite(gcvalue(o))) pmark(w, gcvalue(o)); }
+
+#define pmarkobjectN(w,t)  \
+	{ if ((t) && piswhite(t)) pmark(w, obj2gco(t)); }
+
+
+/*
+** Turn white object 'o' into gray (or into black, if 'black' is true).
+** Returns true iff the calling thread did it, and so it owns 'o'.
+*/
+static int pclaim (GCObject *o, int black) {
+  lu_byte m = pgetmarked(o);
+  while (m & WHITEBITS) {
+    lu_byte nm = cast_byte((m & ~maskcolors) |
+                           (black ? bitmask(BLACKBIT) : 0));
+    if (__atomic_compare_exchange_n(&o->marked, &m, nm, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return 1;
+  }
+  return 0;  /* another thread marked it */
+}
+
+
+/*
+** Parallel version of 'reallymarkobject'.
+*/
+static void pmark (Marker *w, GCObject *o) {
+  switch (o->tt) {
+    case VMK_VSHRSTR:
+    case VMK_VLNGSTR: {
+      if (!pclaim(o, 1))
+        return;
+      break;
+    }
+    case VMK_VUPVAL: {
+      UpVal *uv = gco2upv(o);
+      if (!pclaim(o, !upisopen(uv)))  /* open upvalues are kept gray */
+        return;
+      pmarkvalue(w, uv->v.p);
+      break;
+    }
+    case VMK_VUSERDATA: {
+      Udata *u = gco2u(o);
+      if (u->nuvalue == 0) {  /* no user values? */
+        if (!pclaim(o, 1))
+          return;
+        pmarkobjectN(w, u->metatable);
+        break;
+      }
+      /* else... */
+    }  /* FALLTHROUGH */
+    default: {
+      if (!pclaim(o, 0))
+        return;
+      *getgclist(o) = w->gray;  /* to be visited later */
+      w->gray = o;
+      w->ngray++;
+      break;
+    }
+  }
+  w->marked += objsize(o);
+}
+
+
+/*
+** Parallel version of 'traversestrongtable'.
+*/
+static void ptraversetable (Marker *w, Table *h) {
+  Node *n, *limit = gnodelast(h);
+  unsigned i;
+  pmarkobjectN(w, h->metatable);
+  if (hasslots(h)) {
+    for (i = 0; i < nslots(h); i++)
+      pmarkobjectN(w, getshape(h)->keys[i]);
+  }
+  if (!hastypedarray(h)) {
+    for (i = 0; i < h->asize; i++) {
+      GCObject *o = gcvalarr(h, i);
+      if (o != NULL && piswhite(o))
+        pmark(w, o);
+    }
+  }
+  for (i = 0; i < nslots(h); i++)
+    pmarkvalue(w, &h->slots[i]);
+  for (n = gnode(h, 0); n < limit; n++) {
+    if (isempty(gval(n)))  /* entry is empty? */
+      clearkey(n);  /* clear its key */
+    else {
+      if (keyiscollectable(n) && piswhite(gckey(n)))
+        pmark(w, gckey(n));
+      pmarkvalue(w, gval(n));
+    }
+  }
+}
+
+
+static void ptraverseproto (Marker *w, Proto *f) {
+  int i;
+  pmarkobjectN(w, f->source);
+  for (i = 0; i < f->sizek; i++)
+    pmarkvalue(w, &f->k[i]);
+  for (i = 0; i < f->sizeupvalues; i++)
+    pmarkobjectN(w, f->upvalues[i].name);
+  for (i = 0; i < f->sizep; i++)
+    pmarkobjectN(w, f->p[i]);
+  for (i = 0; i < f->sizelocvars; i++)
+    pmarkobjectN(w, f->locvars[i].varname);
+  for (i = 0; i < f->sizeinlines; i++)
+    pmarkobjectN(w, f->inlines[i].name);
+}
+
+
+/*
+** Check whether table 'h' has a weak mode, without caching the absence
+** of '__mode' in its metatable (which other threads may be reading).
+*/
+static int hasmode (global_State *g, Table *h) {
+  Table *mt = h->metatable;
+  return (!checknoTM(mt, TM_MODE) &&
+          !notm(vmkH_Hgetshortstr(mt, g->tmname[TM_MODE])));
+}
+
+
+/*
+** Traverse gray object 'o', owned by the calling thread, or leave it
+** to the collector thread (see 'parpropagateall').
+*/
+static void ptraverse (Marker *w, GCObject *o) {
+  int i;
+  if (pgetage(o) == G_NEW) {  /* not part of generational lists? */
+    switch (o->tt) {
+      case VMK_VTABLE: {
+        Table *h = gco2t(o);
+        if (hasmode(w->ms->g, h))
+          break;  /* possibly weak table */
+        pnw2black(h);
+        ptraversetable(w, h);
+        if (getsite(h) != NULL) {  /* not measured for the last time? */
+          h->gclist = w->tosample;
+          w->tosample = o;
+        }
+        return;
+      }
+      case VMK_VUSERDATA: {
+        Udata *u = gco2u(o);
+        pnw2black(u);
+        pmarkobjectN(w, u->metatable);
+        for (i = 0; i < u->nuvalue; i++)
+          pmarkvalue(w, &u->uv[i].uv);
+        return;
+      }
+      case VMK_VLCL: {
+        LClosure *cl = gco2lcl(o);
+        pnw2black(cl);
+        pmarkobjectN(w, cl->p);
+        for (i = 0; i < cl->nupvalues; i++)
+          pmarkobjectN(w, cl->upvals[i]);
+        return;
+      }
+      case VMK_VCCL: {
+        CClosure *cl = gco2ccl(o);
+        pnw2black(cl);
+        for (i = 0; i < cl->nupvalues; i++)
+          pmarkvalue(w, &cl->upvalue[i]);
+        return;
+      }
+      case VMK_VPROTO: {
+        pnw2black(o);
+        ptraverseproto(w, gco2p(o));
+        return;
+      }
+      default: break;  /* threads */
+    }
+  }
+  *getgclist(o) = w->serial;  /* leave it to the collector thread */
+  w->serial = o;
+}
+
+
+/*
+** Share the older half of the gray objects of 'w' with other threads.
+*/
+static void pshare (Marker *w) {
+  MarkShared *ms = w->ms;
+  unsigned keep = w->ngray / 2;
+  GCObject **p = &w->gray;
+  unsigned i;
+  for (i = 0; i < keep; i++)
+    p = getgclist(*p);
+  pthread_mutex_lock(&ms->lock);
+  if (ms->npool < MAXSHARED) {
+    ms->pool[ms->npool].list = *p;
+    ms->pool[ms->npool].n = w->ngray - keep;
+    ms->npool++;
+    *p = NULL;
+    w->ngray = keep;
+    pthread_cond_signal(&ms->cond);
+  }
+  pthread_mutex_unlock(&ms->lock);
+}
+
+
+/*
+** Get a list of gray objects shared by another thread, waiting for
+** one if needed. Returns false when all threads are waiting, that is,
+** when there is nothing left to mark.
+*/
+static int ptake (Marker *w) {
+  MarkShared *ms = w->ms;
+  int res;
+  pthread_mutex_lock(&ms->lock);
+  __atomic_fetch_add(&ms->nidle, 1, __ATOMIC_RELAXED);  /* (see 'pdrain') */
+  while (ms->npool == 0 && ms->nidle < ms->nthreads)
+    pthread_cond_wait(&ms->cond, &ms->lock);
+  if (ms->npool > 0) {
+    ms->npool--;
+    w->gray = ms->pool[ms->npool].list;
+    w->ngray = ms->pool[ms->npool].n;
+    __atomic_fetch_sub(&ms->nidle, 1, __ATOMIC_RELAXED);
+    res = 1;
+  }
+  else {  /* all threads are waiting */
+    pthread_cond_broadcast(&ms->cond);  /* wake them to finish */
+    res = 0;
+  }
+  pthread_mutex_unlock(&ms->lock);
+  return res;
+}
+
+
+/*
+** Traverse gray objects until there are no more gray objects anywhere.
+*/
+static void pdrain (Marker *w) {
+  MarkShared *ms = w->ms;
+  do {
+    GCObject *o;
+    while ((o = w->gray) != NULL) {
+      w->gray = *getgclist(o);
+      w->ngray--;
+      if (w->ngray >= MINSHARE &&
+          __atomic_load_n(&ms->nidle, __ATOMIC_RELAXED) > 0)
+        pshare(w);
+      ptraverse(w, o);
+    }
+  } while (ptake(w));
+}
+
+
+static void *pmarker (void *ud) {
+  pdrain(cast(Marker *, ud));
+  return NULL;
+}
+
+
+/*
+** Propagate marks from the 'gray' list with 'nthreads' threads (the
+** one running the collector plus helpers). Each round marks in parallel
+** everything reachable from the 'gray' list, except for the objects
+** that only the collector thread can traverse; it traverses them after
+** the round, which may fill the 'gray' list again.
+*/
+static void parpropagateall (global_State *g, int nthreads) {
+  Marker w[VMKI_MAXMARKTHREADS];
+  pthread_t th[VMKI_MAXMARKTHREADS];
+  MarkShared ms;
+  ms.g = g;
+  pthread_mutex_init(&ms.lock, NULL);
+  pthread_cond_init(&ms.cond, NULL);
+  while (g->gray) {
+    GCObject *o;
+    int i, n;
+    for (i = 0; i < nthreads; i++) {
+      w[i].ms = &ms;
+      w[i].gray = w[i].serial = w[i].tosample = NULL;
+      w[i].ngray = 0;
+      w[i].marked = 0;
+    }
+    w[0].gray = g->gray;
+    for (o = g->gray; o != NULL; o = *getgclist(o))
+      w[0].ngray++;
+    g->gray = NULL;
+    ms.npool = ms.nidle = 0;
+    pthread_mutex_lock(&ms.lock);  /* helpers wait for 'nthreads' */
+    for (n = 1; n < nthreads; n++) {
+      if (pthread_create(&th[n], NULL, pmarker, &w[n]) != 0)
+        break;  /* go on with the threads already created */
+    }
+    ms.nthreads = n;
+    pthread_mutex_unlock(&ms.lock);
+    pdrain(&w[0]);
+    for (i = 1; i < n; i++)
+      pthread_join(th[i], NULL);
+    for (i = 0; i < n; i++) {
+      g->GCmarked += w[i].marked;
+      while ((o = w[i].tosample) != NULL) {
+        w[i].tosample = gco2t(o)->gclist;
+        lastsample(g, gco2t(o));
+      }
+      while ((o = w[i].serial) != NULL) {  /* traverse it here */
+        w[i].serial = *getgclist(o);
+        *getgclist(o) = g->gray;  /* 'propagatemark' takes it first */
+        g->gray = o;
+        propagatemark(g);
+      }
+    }
+  }
+  pthread_cond_destroy(&ms.cond);
+  pthread_mutex_destroy(&ms.lock);
+}
+
+#endif
+
+
+/*
+** Propagate all marks from the 'gray' list. A full collection may do
+** that with helper threads.
+*/
+static void propagatefull (global_State *g) {
+#if defined(VMK_USE_PARMARK)
+  int nthreads = cast_int(applygcparam(g, MARKTHREADS, 100));
+  if (nthreads > VMKI_MAXMARKTHREADS)
+    nthreads = VMKI_MAXMARKTHREADS;
+  if (g->gcfull && nthreads > 1 && gettotalbytes(g) >= VMKI_PARMARKMIN) {
+    parpropagateall(g, nthreads);
+    return;
+  }
+#endif
+  propagateall(g);
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Sweep Functions
@@ -790,11 +1446,17 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
     Table *h = gco2t(l);
     Node *n, *limit = gnodelast(h);
     unsigned int i;
-    unsigned int asize = h->asize;
+    unsigned int asize = (hastypedarray(h)) ? 0 : h->asize;
     for (i = 0; i < asize; i++) {
       GCObject *o = gcvalarr(h, i);
-      if (iscleared(g, o))  /* value was collected? */
+      if (iscleared(g, o)) {  /* value was collected? */
         *getArrTag(h, i) = VMK_VEMPTY;  /* remove entry */
+        *lenborder(h) = NOBORDER;  /* it may leave a hole */
+      }
+    }
+    for (i = 0; i < nslots(h); i++) {
+      if (iscleared(g, gcvalueN(&h->slots[i])))  /* unmarked value? */
+        setempty(&h->slots[i]);  /* remove entry */
     }
     for (n = gnode(h, 0); n < limit; n++) {
       if (iscleared(g, gcvalueN(gval(n))))  /* unmarked value? */
@@ -809,7 +1471,7 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
 static void freeupval (vmk_State *L, UpVal *uv) {
   if (upisopen(uv))
     vmkF_unlinkupval(uv);
-  vmkM_free(L, uv);
+  vmkC_freeobject(L, uv, sizeof(UpVal));
 }
 
 
@@ -824,12 +1486,12 @@ static void freeobj (vmk_State *L, GCObject *o) {
       break;
     case VMK_VLCL: {
       LClosure *cl = gco2lcl(o);
-      vmkM_freemem(L, cl, sizeLclosure(cl->nupvalues));
+      vmkC_freeobject(L, cl, sizeLclosure(cl->nupvalues));
       break;
     }
     case VMK_VCCL: {
       CClosure *cl = gco2ccl(o);
-      vmkM_freemem(L, cl, sizeCclosure(cl->nupvalues));
+      vmkC_freeobject(L, cl, sizeCclosure(cl->nupvalues));
       break;
     }
     case VMK_VTABLE:
@@ -840,13 +1502,13 @@ static void freeobj (vmk_State *L, GCObject *o) {
       break;
     case VMK_VUSERDATA: {
       Udata *u = gco2u(o);
-      vmkM_freemem(L, o, sizeudata(u->nuvalue, u->len));
+      vmkC_freeobject(L, o, sizeudata(u->nuvalue, u->len));
       break;
     }
     case VMK_VSHRSTR: {
       TString *ts = gco2ts(o);
       vmkS_remove(L, ts);  /* remove it from hash table */
-      vmkM_freemem(L, ts, sizestrshr(cast_uint(ts->shrlen)));
+      vmkC_freeobject(L, ts, sizestrshr(cast_uint(ts->shrlen)));
       break;
     }
     case VMK_VLNGSTR: {
@@ -902,6 +1564,230 @@ static GCObject **sweeptolive (vmk_State *L, GCObject **p) {
 
 /* }====================================================== */
 
+/*
+** {======================================================
+** Background sweeper
+** With a background sweeper, the blocks freed by the interpreter (most
+** of them by sweeps) do not go back to the allocator right away. They
+** are collected in batches, which another thread gives back to the
+** allocator. Sweeps still remove dead objects from their lists and
+** update the counts of the collector; only the calls to the allocator
+** move to that thread. So, the allocator must accept calls freeing
+** blocks from that thread, concurrently with any call from the state.
+** =======================================================
+*/
+
+#if defined(VMK_USE_BGSWEEP)
+
+/* number of blocks in a batch */
+#define FREEBATCH	1024
+
+/* maximum number of batches waiting for the sweeper thread */
+#define MAXQUEUED	8
+
+/* blocks at least that large go back to the allocator right away */
+#define MAXDEFERRED	(1 << 16)
+
+
+typedef struct FreeBatch {
+  struct FreeBatch *next;
+  unsigned n;  /* number of blocks in the batch */
+  struct {
+    void *block;
+    size_t size;
+  } b[FREEBATCH];
+} FreeBatch;
+
+
+typedef struct Sweeper {
+  global_State *g;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t work;  /* signals new batches or a request to stop */
+  pthread_cond_t done;  /* signals freed batches */
+  FreeBatch *cur;  /* batch being filled by the state */
+  FreeBatch *queue;  /* batches waiting for the thread */
+  FreeBatch *spare;  /* empty batches */
+  int nqueued;  /* batches in 'queue' plus the one being freed */
+  lu_byte started;  /* true if thread is running */
+  lu_byte stop;  /* true if thread must finish */
+} Sweeper;
+
+
+/* calls to the allocator not counted by the collector */
+#define rawalloc(g,s)	((*(g)->frealloc)((g)->ud, NULL, 0, (s)))
+#define rawfree(g,b,s)	cast_void((*(g)->frealloc)((g)->ud, (b), (s), 0))
+
+
+static void freebatch (global_State *g, FreeBatch *b) {
+  unsigned i;
+  for (i = 0; i < b->n; i++)
+    rawfree(g, b->b[i].block, b->b[i].size);
+  b->n = 0;
+}
+
+
+static void *sweeperthread (void *ud) {
+  Sweeper *sw = cast(Sweeper *, ud);
+  pthread_mutex_lock(&sw->lock);
+  for (;;) {
+    FreeBatch *b;
+    while (sw->queue == NULL && !sw->stop)
+      pthread_cond_wait(&sw->work, &sw->lock);
+    if ((b = sw->queue) == NULL)
+      break;  /* asked to stop, and nothing left to free */
+    sw->queue = b->next;
+    pthread_mutex_unlock(&sw->lock);
+    freebatch(sw->g, b);  /* free blocks without holding the lock */
+    pthread_mutex_lock(&sw->lock);
+    b->next = sw->spare;
+    sw->spare = b;
+    sw->nqueued--;
+    pthread_cond_signal(&sw->done);
+  }
+  pthread_mutex_unlock(&sw->lock);
+  return NULL;
+}
+
+
+/*
+** Hand the current batch to the sweeper thread and get an empty one.
+** If there are too many batches waiting, or if the thread cannot run,
+** free the batch here.
+*/
+static void submitbatch (global_State *g, Sweeper *sw) {
+  FreeBatch *b = sw->cur;
+  if (b == NULL || b->n == 0)
+    return;  /* nothing to submit */
+  if (!sw->started) {
+    if (pthread_create(&sw->thread, NULL, sweeperthread, sw) != 0) {
+      freebatch(g, b);
+      return;
+    }
+    sw->started = 1;
+  }
+  pthread_mutex_lock(&sw->lock);
+  if (sw->nqueued >= MAXQUEUED) {  /* thread is behind? */
+    pthread_mutex_unlock(&sw->lock);
+    freebatch(g, b);  /* do not let garbage pile up */
+    return;
+  }
+  b->next = sw->queue;
+  sw->queue = b;
+  sw->nqueued++;
+  sw->cur = sw->spare;
+  if (sw->cur != NULL)
+    sw->spare = sw->cur->next;
+  pthread_cond_signal(&sw->work);
+  pthread_mutex_unlock(&sw->lock);
+  if (sw->cur == NULL) {  /* no empty batch? */
+    sw->cur = cast(FreeBatch *, rawalloc(g, sizeof(FreeBatch)));
+    if (sw->cur != NULL)  /* else free blocks right away */
+      sw->cur->n = 0;
+  }
+}
+
+
+/*
+** Put a block being freed in the current batch. Returns false if the
+** caller must free it.
+*/
+int vmkC_deferfree (global_State *g, void *block, size_t osize) {
+  Sweeper *sw = g->sweeper;
+  FreeBatch *b = sw->cur;
+  if (block == NULL || osize >= MAXDEFERRED || b == NULL)
+    return 0;
+  b->b[b->n].block = block;
+  b->b[b->n].size = osize;
+  if (++b->n == FREEBATCH)
+    submitbatch(g, sw);
+  return 1;
+}
+
+
+/*
+** Wait until all blocks given to the sweeper went back to the
+** allocator.
+*/
+void vmkC_syncsweeper (global_State *g) {
+  Sweeper *sw = g->sweeper;
+  if (sw == NULL)
+    return;
+  submitbatch(g, sw);
+  if (sw->started) {
+    pthread_mutex_lock(&sw->lock);
+    while (sw->nqueued > 0)
+      pthread_cond_wait(&sw->done, &sw->lock);
+    pthread_mutex_unlock(&sw->lock);
+  }
+}
+
+
+/*
+** Turn the background sweeper on or off. Returns whether it was on.
+** (If it cannot be created, the state goes on without it.)
+*/
+int vmkC_setsweeper (vmk_State *L, int on) {
+  global_State *g = G(L);
+  Sweeper *sw = g->sweeper;
+  int res = (sw != NULL);
+  if (on && sw == NULL) {
+    sw = cast(Sweeper *, rawalloc(g, sizeof(Sweeper)));
+    if (sw == NULL)
+      return res;
+    sw->cur = cast(FreeBatch *, rawalloc(g, sizeof(FreeBatch)));
+    if (sw->cur == NULL) {
+      rawfree(g, sw, sizeof(Sweeper));
+      return res;
+    }
+    sw->g = g;
+    sw->cur->n = 0;
+    sw->queue = sw->spare = NULL;
+    sw->nqueued = 0;
+    sw->started = sw->stop = 0;
+    pthread_mutex_init(&sw->lock, NULL);
+    pthread_cond_init(&sw->work, NULL);
+    pthread_cond_init(&sw->done, NULL);
+    g->sweeper = sw;
+  }
+  else if (!on && sw != NULL) {
+    vmkC_syncsweeper(g);
+    g->sweeper = NULL;
+    if (sw->started) {
+      pthread_mutex_lock(&sw->lock);
+      sw->stop = 1;
+      pthread_cond_signal(&sw->work);
+      pthread_mutex_unlock(&sw->lock);
+      pthread_join(sw->thread, NULL);
+    }
+    if (sw->cur != NULL)
+      rawfree(g, sw->cur, sizeof(FreeBatch));
+    while (sw->spare != NULL) {
+      FreeBatch *b = sw->spare;
+      sw->spare = b->next;
+      rawfree(g, b, sizeof(FreeBatch));
+    }
+    pthread_cond_destroy(&sw->done);
+    pthread_cond_destroy(&sw->work);
+    pthread_mutex_destroy(&sw->lock);
+    rawfree(g, sw, sizeof(Sweeper));
+  }
+  return res;
+}
+
+
+/* at the end of a sweep, hand the blocks freed so far to the thread */
+#define endsweep(g)	{ if ((g)->sweeper) submitbatch(g, (g)->sweeper); }
+
+#else
+
+#define endsweep(g)	((void)0)
+
+#endif
+
+/* }====================================================== */
+
+
 
 /*
 ** {======================================================
@@ -913,6 +1799,7 @@ static GCObject **sweeptolive (vmk_State *L, GCObject **p) {
 ** If possible, shrink string table.
 */
 static void checkSizes (vmk_State *L, global_State *g) {
+  vmkH_freeshapes(L);  /* free shapes not used by live tables */
   if (!g->gcemergency) {
     if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
       vmkS_resize(L, g->strt.size / 2);
@@ -1272,6 +2159,7 @@ static void markold (global_State *g, GCObject *from, GCObject *to) {
 static void finishgencycle (vmk_State *L, global_State *g) {
   correctgraylists(g);
   checkSizes(L, g);
+  endsweep(g);
   g->gcstate = GCSpropagate;  /* skip restart */
   if (!g->gcemergency)
     callallpendingfinalizers(L);
@@ -1426,6 +2314,8 @@ void vmkC_changemode (vmk_State *L, int newmode) {
       minor2inc(L, g, KGC_INC);  /* entering incremental mode */
     else {
       vmk_assert(newmode == KGC_GENMINOR);
+      if (g->nursery == NULL)
+        newnursery(g);
       entergen(L, g);
     }
   }
@@ -1508,6 +2398,7 @@ static void deletelist (vmk_State *L, GCObject *p, GCObject *limit) {
 */
 void vmkC_freeallobjects (vmk_State *L) {
   global_State *g = G(L);
+  cast_void(vmkC_setsweeper(L, 0));  /* free everything right away */
   g->gcstp = GCSTPCLS;  /* no extra finalizers after here */
   vmkC_changemode(L, KGC_INC);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
@@ -1517,6 +2408,9 @@ void vmkC_freeallobjects (vmk_State *L) {
   vmk_assert(g->finobj == NULL);  /* no new finalizers */
   deletelist(L, g->fixedgc, NULL);  /* collect fixed objects */
   vmk_assert(g->strt.nuse == 0);
+  vmkH_freeshapes(L);
+  vmk_assert(g->shapes.nuse == 0);
+  freenursery(g);
 }
 
 
@@ -1532,12 +2426,12 @@ static void atomic (vmk_State *L) {
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
   markmt(g);  /* mark global metatables */
-  propagateall(g);  /* empties 'gray' list */
+  propagatefull(g);  /* empties 'gray' list */
   /* remark occasional upvalues of (maybe) dead threads */
   remarkupvals(g);
   propagateall(g);  /* propagate changes */
   g->gray = grayagain;
-  propagateall(g);  /* traverse 'grayagain' list */
+  propagatefull(g);  /* traverse 'grayagain' list */
   convergeephemerons(g);
   /* at this point, all strongly accessible objects are marked. */
   /* Clear values from weak tables, before checking finalizers */
@@ -1642,6 +2536,7 @@ static l_mem singlestep (vmk_State *L, int fast) {
     }
     case GCSswpend: {  /* finish sweeps */
       checkSizes(L, g);
+      endsweep(g);
       g->gcstate = GCScallfin;
       stepresult = GCSWEEPMAX;
       break;
@@ -1766,6 +2661,7 @@ void vmkC_fullgc (vmk_State *L, int isemergency) {
   global_State *g = G(L);
   vmk_assert(!g->gcemergency);
   g->gcemergency = cast_byte(isemergency);  /* set flag */
+  g->gcfull = cast_byte(!isemergency);
   switch (g->gckind) {
     case KGC_GENMINOR: fullgen(L, g); break;
     case KGC_INC: fullinc(L, g); break;
@@ -1775,7 +2671,10 @@ void vmkC_fullgc (vmk_State *L, int isemergency) {
       g->gckind = KGC_GENMAJOR;
       break;
   }
+  if (isemergency)  /* memory freed by the sweeper must be available */
+    vmkC_syncsweeper(g);
   g->gcemergency = 0;
+  g->gcfull = 0;
 }
 
 /* }====================================================== */
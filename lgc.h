@@ -201,6 +201,35 @@
 #define VMKI_GCSTEPSIZE	(200 * sizeof(Table))
 
 
+
+/* full collections */
+
+/*
+** Number of threads marking objects in a full collection, counting
+** the one running the collector (see 'parpropagateall' in lgc.c).
+*/
+#define VMKI_MARKTHREADS	1
+
+/* Maximum number of threads marking objects in a full collection */
+#define VMKI_MAXMARKTHREADS	16
+
+/* Heaps smaller than that are marked by the running thread alone */
+#if !defined(VMKI_PARMARKMIN)
+#define VMKI_PARMARKMIN		(1 << 20)
+#endif
+
+
+/*
+** Stores into tables with at least that many entries (in their array
+** and hash parts) take a forward barrier (see 'vmkC_barriertable_' in
+** lgc.c). In generational mode, values overwritten in those tables
+** live until the next major collection.
+*/
+#if !defined(VMKI_BIGTABLE)
+#define VMKI_BIGTABLE		(1u << 12)
+#endif
+
+
 #define setgcparam(g,p,v)  (g->gcparams[VMK_GCP##p] = vmkO_codeparam(v))
 #define applygcparam(g,p,x)  vmkO_applyparam(g->gcparams[VMK_GCP##p], x)
 
@@ -246,7 +275,8 @@
 	iscollectable(v) ? vmkC_objbarrier(L,p,gcvalue(v)) : cast_void(0))
 
 #define vmkC_objbarrierback(L,p,o) (  \
-	(isblack(p) && iswhite(o)) ? vmkC_barrierback_(L,p) : cast_void(0))
+	(isblack(p) && iswhite(o)) ? \
+	vmkC_barriertable_(L,obj2gco(p),obj2gco(o)) : cast_void(0))
 
 #define vmkC_barrierback(L,p,v) (  \
 	iscollectable(v) ? vmkC_objbarrierback(L, p, gcvalue(v)) : cast_void(0))
@@ -261,8 +291,24 @@ VMKI_FUNC GCObject *vmkC_newobjdt (vmk_State *L, lu_byte tt, size_t sz,
                                                  size_t offset);
 VMKI_FUNC void vmkC_barrier_ (vmk_State *L, GCObject *o, GCObject *v);
 VMKI_FUNC void vmkC_barrierback_ (vmk_State *L, GCObject *o);
+VMKI_FUNC void vmkC_barriertable_ (vmk_State *L, GCObject *o, GCObject *v);
 VMKI_FUNC void vmkC_checkfinalizer (vmk_State *L, GCObject *o, Table *mt);
 VMKI_FUNC void vmkC_changemode (vmk_State *L, int newmode);
 
+#if defined(VMK_USE_BGSWEEP)
+VMKI_FUNC int vmkC_setsweeper (vmk_State *L, int on);
+VMKI_FUNC void vmkC_syncsweeper (global_State *g);
+VMKI_FUNC int vmkC_deferfree (global_State *g, void *block, size_t osize);
+#else
+#define vmkC_setsweeper(L,on)	(cast_void(L), cast_void(on), 0)
+#define vmkC_syncsweeper(g)	cast_void(g)
+#endif
+
+#if defined(VMK_USE_NURSERY)
+VMKI_FUNC void vmkC_freeobject (vmk_State *L, void *block, size_t size);
+#else
+#define vmkC_freeobject(L,b,s)	vmkM_freemem(L, b, s)
+#endif
+
 
 #endif
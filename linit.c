@@ -36,6 +36,7 @@ static const vmkL_Reg stdlibs[] = {
   {VMK_STRLIBNAME, vmkopen_string},
   {VMK_TABLIBNAME, vmkopen_table},
   {VMK_UTF8LIBNAME, vmkopen_utf8},
+  {VMK_PROFLIBNAME, vmkopen_profiler},
   {NULL, NULL}
 };
 
@@ -57,7 +58,7 @@ VMKLIB_API void vmkL_openselectedlibs (vmk_State *L, int load, int preload) {
       vmk_setfield(L, -2, lib->name);  /* add library to PRELOAD table */
     }
   }
-  vmk_assert((mask >> 1) == VMK_UTF8LIBK);
+  vmk_assert((mask >> 1) == VMK_PROFLIBK);
   vmk_pop(L, 1);  /* remove PRELOAD table */
 }
 
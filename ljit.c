@@ -0,0 +1,1748 @@
+/*
+** $Id: ljit.c $
+** Baseline JIT compiler
+** See Copyright Notice in vmk.h
+*/
+
+#define ljit_c
+#define VMK_CORE
+
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE  /* for MAP_ANONYMOUS */
+#endif
+
+#include "lprefix.h"
+
+
+#include "vmk.h"
+
+#include "ljit.h"
+
+
+/*
+** The whole module only makes sense with VMK_USE_JIT on
+*/
+#if defined(VMK_USE_JIT)
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "ldebug.h"
+#include "lmem.h"
+#include "lopcodes.h"
+#include "ltable.h"
+
+
+/*
+** The compiler translates a whole prototype, one template per
+** instruction, into x86-64 code. Native code keeps all values in the
+** Vmk stack, exactly where the interpreter keeps them, so it can give
+** control back to the interpreter before any instruction. It does that
+** (returning the index of the instruction) whenever an instruction is
+** not handled by a template or a type guard fails; the interpreter then
+** runs that instruction with its full semantics (metamethods, errors,
+** calls, hooks, etc.). As native code never raises errors, calls
+** functions or allocates memory, debug information and the collector
+** always see a consistent interpreter state.
+**
+** Numeric for loops also get traces. When a loop gets hot in native
+** code, the interpreter runs one iteration recording the path taken and
+** the types it sees (see 'vmkJ_record'). The fn is then compiled
+** again with that trace in place of the loop's FORLOOP: type guards at
+** the entry of the trace check the registers it reads; inside it, types
+** are known, so most tag checks disappear, and branches become guards.
+** Any guard that fails (a side exit) jumps to the regular code of the
+** instruction, which handles the general case.
+*/
+
+
+/*
+** Native code for a prototype. The header lives in its own mapping,
+** so that its size can be known before generating the code.
+*/
+typedef struct JitCode {
+  unsigned char *mcode;  /* executable code */
+  size_t msize;  /* size of 'mcode' */
+  size_t size;  /* size of this block */
+  unsigned int entry[1];  /* position in 'mcode' of each instruction */
+} JitCode;
+
+
+/*
+** Native code is called with the frame base, the constants, the
+** upvalues, the address of the frame's trap, and the code position
+** where it must start; it returns the index of the next instruction for
+** the interpreter, or -(pc + 1) to ask for a recording of the loop
+** closed by the FORLOOP at 'pc'.
+*/
+typedef int (*JitFunction) (StkId base, const TValue *k, UpVal **upvals,
+                            volatile l_signalT *trap, const void *start);
+
+
+/* x86-64 registers */
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RBX	3
+#define RSI	6
+#define RDI	7
+#define R8	8
+#define R13	13
+#define R14	14
+#define R15	15
+#define XMM0	0
+#define XMM1	1
+#define XMM2	2
+#define XMM3	3
+
+/* registers holding the interpreter state inside native code */
+#define RBASE	RBX  /* base of the frame */
+#define RKST	R14  /* constants of the fn */
+#define RUPV	R13  /* upvalues of the closure */
+#define RTRAP	R15  /* address of 'ci->u.l.trap' */
+
+/* condition codes */
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_NS	0x9
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+
+/* size of an exit stub ('mov eax, imm32; jmp rel32') */
+#define STUBSIZE	10
+
+
+/* offsets of table and upvalue fields used by the fast paths */
+#define ASIZEOFF	cast_int(offsetof(Table, asize))
+#define ARRAYOFF	cast_int(offsetof(Table, array))
+#define MTOFF		cast_int(offsetof(Table, metatable))
+#define BORDEROFF	cast_int(sizeof(unsigned))  /* see 'lenborder' */
+#define TAGOFF		cast_int(2 * sizeof(unsigned))  /* tag 0 from 'array' */
+#define VALOFF		(-cast_int(sizeof(Value)))  /* value 0 from 'array' */
+#define UVOFF		cast_int(offsetof(UpVal, v.p))
+
+
+/* offset of the value and of the tag of a register */
+#define VOFF(r)		cast_int(cast_uint(r) * sizeof(StackValue))
+#define TTOFF		cast_int(offsetof(TValue, tt_))
+
+
+typedef struct JitState {
+  const Proto *p;
+  unsigned char *code;  /* code being generated (NULL while sizing) */
+  size_t pos;  /* current position in 'code' */
+  unsigned int *entry;  /* position of each instruction */
+  size_t epilogue;  /* position of the common exit code */
+  size_t stubs;  /* position of the exit stubs */
+} JitState;
+
+
+/* position of instruction 'pc' (unknown when only checking a trace) */
+#define pcpos(J,pc)	((J)->entry ? cast_sizet((J)->entry[pc]) : 0)
+
+/* position of the stub that exits to the interpreter at 'pc' */
+#define exitpos(J,pc)	((J)->stubs + cast_sizet(pc) * STUBSIZE)
+
+
+/*
+** An instruction operand: a value in memory at 'base + disp' (a
+** register or a constant) or, when 'base' is negative, the integer
+** immediate 'disp'.
+*/
+typedef struct Operand {
+  int base;
+  int disp;
+} Operand;
+
+#define isimm(o)	((o).base < 0)
+
+
+static Operand regop (int r) {
+  Operand o;
+  o.base = RBASE; o.disp = VOFF(r);
+  return o;
+}
+
+
+static Operand kop (int n) {
+  Operand o;
+  o.base = RKST; o.disp = cast_int(cast_uint(n) * sizeof(TValue));
+  return o;
+}
+
+
+static Operand immop (int imm) {
+  Operand o;
+  o.base = -1; o.disp = imm;
+  return o;
+}
+
+
+/* no tag known (or no register) */
+#define NOTAG		0xFF
+
+/* maximum number of instructions in a trace */
+#define MAXTRACE	100
+
+/* number of registers a trace can track */
+#define MAXREGS		256
+
+
+/*
+** A recorded instruction: its index, the tags of its operands (A, B and
+** C; A, A+1 and A+2 for a FORLOOP) before it ran, and the tag of R[A]
+** after it ran.
+*/
+typedef struct TraceIns {
+  int pc;
+  lu_byte tag[3];
+  lu_byte res;
+} TraceIns;
+
+
+/* a recorded iteration of a loop, from its first instruction to FORLOOP */
+typedef struct JitTrace {
+  struct JitTrace *next;  /* other traces of the same fn */
+  int n;  /* number of instructions */
+  TraceIns ins[1];
+} JitTrace;
+
+
+/* state of the recording in progress */
+typedef struct JitRecorder {
+  vmk_State *L;  /* thread being recorded */
+  CallInfo *ci;  /* frame being recorded */
+  Proto *p;
+  int loop;  /* index of the FORLOOP closing the loop */
+  int n;  /* number of instructions recorded */
+  TraceIns ins[MAXTRACE];
+} JitRecorder;
+
+
+/*
+** {==================================================================
+** Machine-code emission
+** ===================================================================
+*/
+
+static void put4 (unsigned char *c, unsigned int w) {
+  int n;
+  for (n = 0; n < 4; n++) {
+    c[n] = cast_byte(w & 0xFFu);
+    w >>= 8;
+  }
+}
+
+
+static void emit1 (JitState *J, unsigned int b) {
+  if (J->code != NULL)
+    J->code[J->pos] = cast_byte(b);
+  J->pos++;
+}
+
+
+static void emit4 (JitState *J, unsigned int w) {
+  if (J->code != NULL)
+    put4(J->code + J->pos, w);
+  J->pos += 4;
+}
+
+
+/*
+** Emit an optional prefix, the REX byte (when needed) and a one- or
+** two-byte opcode whose operands are 'reg' and 'rm'. 'w' selects a
+** 64-bit operand size.
+*/
+static void emitopcode (JitState *J, unsigned int prefix, int w,
+                        unsigned int op, int reg, int rm) {
+  unsigned int rex = 0x40u | (w ? 8u : 0u) | ((reg & 8) ? 4u : 0u)
+                           | ((rm & 8) ? 1u : 0u);
+  if (prefix != 0)
+    emit1(J, prefix);
+  if (rex != 0x40u)
+    emit1(J, rex);
+  if (op > 0xFFu)
+    emit1(J, op >> 8);
+  emit1(J, op & 0xFFu);
+}
+
+
+/* instruction with operands 'reg' and '[base + disp]' */
+static void emitmem (JitState *J, unsigned int prefix, int w,
+                     unsigned int op, int reg, int base, int disp) {
+  vmk_assert((base & 7) != 4);  /* no SIB byte */
+  emitopcode(J, prefix, w, op, reg, base);
+  emit1(J, 0x80u | (cast_uint(reg & 7) << 3) | cast_uint(base & 7));
+  emit4(J, cast_uint(disp));
+}
+
+
+/* instruction with operands 'reg' and 'rm', both registers */
+static void emitreg (JitState *J, unsigned int prefix, int w,
+                     unsigned int op, int reg, int rm) {
+  emitopcode(J, prefix, w, op, reg, rm);
+  emit1(J, 0xC0u | (cast_uint(reg & 7) << 3) | cast_uint(rm & 7));
+}
+
+
+static void emitrel (JitState *J, size_t target) {
+  emit4(J, cast_uint(target - (J->pos + 4)));
+}
+
+
+static void jmpto (JitState *J, size_t target) {
+  emit1(J, 0xE9);
+  emitrel(J, target);
+}
+
+
+static void jccto (JitState *J, unsigned int cc, size_t target) {
+  emit1(J, 0x0F);
+  emit1(J, 0x80u + cc);
+  emitrel(J, target);
+}
+
+
+/*
+** Forward jumps inside a template: they return the position of their
+** offset, to be fixed by 'patch' when the target is reached.
+*/
+static size_t jccfwd (JitState *J, unsigned int cc) {
+  jccto(J, cc, J->pos);
+  return J->pos - 4;
+}
+
+
+static size_t jmpfwd (JitState *J) {
+  jmpto(J, J->pos);
+  return J->pos - 4;
+}
+
+
+static void patch (JitState *J, size_t l) {
+  if (J->code != NULL)
+    put4(J->code + l, cast_uint(J->pos - (l + 4)));
+}
+
+/* }================================================================== */
+
+
+
+/*
+** {==================================================================
+** Templates
+** ===================================================================
+*/
+
+/* cmp byte [tag of 'o'], 'tag' */
+static void cmptag (JitState *J, Operand o, int tag) {
+  emitmem(J, 0, 0, 0x80, 7, o.base, o.disp + TTOFF);
+  emit1(J, cast_uint(tag));
+}
+
+
+/* mov byte [tag of register 'r'], 'tag' */
+static void settag (JitState *J, int r, int tag) {
+  emitmem(J, 0, 0, 0xC6, 0, RBASE, VOFF(r) + TTOFF);
+  emit1(J, cast_uint(tag));
+}
+
+
+static void loadint (JitState *J, int reg, Operand o) {
+  if (isimm(o)) {  /* mov reg, imm32 */
+    emitreg(J, 0, 1, 0xC7, 0, reg);
+    emit4(J, cast_uint(o.disp));
+  }
+  else  /* mov reg, [o] */
+    emitmem(J, 0, 1, 0x8B, reg, o.base, o.disp);
+}
+
+
+static void storeint (JitState *J, int r, int reg) {
+  emitmem(J, 0, 1, 0x89, reg, RBASE, VOFF(r));  /* mov [r], reg */
+  settag(J, r, VMK_VNUMINT);
+}
+
+
+static void loadflt (JitState *J, int xmm, Operand o) {
+  emitmem(J, 0xF2, 0, 0x0F10, xmm, o.base, o.disp);  /* movsd xmm, [o] */
+}
+
+
+static void storeflt (JitState *J, int r, int xmm) {
+  emitmem(J, 0xF2, 0, 0x0F11, xmm, RBASE, VOFF(r));  /* movsd [r], xmm */
+  settag(J, r, VMK_VNUMFLT);
+}
+
+
+/*
+** Convert numeric operand 'o' to a float in 'xmm'; exit at 'pc' if it
+** is not a number.
+*/
+static void tofloat (JitState *J, int xmm, Operand o, int pc) {
+  if (isimm(o)) {
+    loadint(J, RAX, o);
+    emitreg(J, 0xF2, 1, 0x0F2A, xmm, RAX);  /* cvtsi2sd xmm, rax */
+  }
+  else {
+    size_t l1, l2;
+    cmptag(J, o, VMK_VNUMFLT);
+    l1 = jccfwd(J, CC_NE);
+    loadflt(J, xmm, o);
+    l2 = jmpfwd(J);
+    patch(J, l1);
+    cmptag(J, o, VMK_VNUMINT);
+    jccto(J, CC_NE, exitpos(J, pc));
+    emitmem(J, 0xF2, 1, 0x0F2A, xmm, o.base, o.disp);  /* cvtsi2sd */
+    patch(J, l2);
+  }
+}
+
+
+/* copy the value of 'src' to 'dst' */
+static void copyvalue (JitState *J, Operand dst, Operand src) {
+  emitmem(J, 0, 1, 0x8B, RAX, src.base, src.disp);  /* mov rax, [src] */
+  emitmem(J, 0, 1, 0x89, RAX, dst.base, dst.disp);  /* mov [dst], rax */
+  emitmem(J, 0, 0, 0x0FB6, RAX, src.base, src.disp + TTOFF);  /* movzx */
+  emitmem(J, 0, 0, 0x88, RAX, dst.base, dst.disp + TTOFF);  /* mov al */
+}
+
+
+/*
+** Arithmetic: 'iop' is the opcode of the integer operation ('op reg,
+** r/m' form), or 0 if the result is always a float; 'fop' is the float
+** operation. A successful operation skips the following MMBIN.
+*/
+static void genarith (JitState *J, int pc, int a, Operand o1, Operand o2,
+                      unsigned int iop, unsigned int fop) {
+  if (iop != 0) {
+    size_t l[2];
+    int nl = 0;
+    if (!isimm(o1)) {
+      cmptag(J, o1, VMK_VNUMINT);
+      l[nl++] = jccfwd(J, CC_NE);
+    }
+    if (!isimm(o2)) {
+      cmptag(J, o2, VMK_VNUMINT);
+      l[nl++] = jccfwd(J, CC_NE);
+    }
+    loadint(J, RAX, o1);
+    loadint(J, RCX, o2);
+    emitreg(J, 0, 1, iop, RAX, RCX);
+    storeint(J, a, RAX);
+    jmpto(J, pcpos(J, pc + 2));
+    while (nl > 0)
+      patch(J, l[--nl]);
+  }
+  tofloat(J, XMM0, o1, pc);
+  tofloat(J, XMM1, o2, pc);
+  emitreg(J, 0xF2, 0, fop, XMM0, XMM1);
+  storeflt(J, a, XMM0);
+  jmpto(J, pcpos(J, pc + 2));
+}
+
+
+/*
+** Modulo of two integers (see 'vmkV_mod'); divisors 0 and -1 go to
+** 'fail'.
+*/
+static void modint (JitState *J, int a, Operand o1, Operand o2,
+                    size_t fail) {
+  size_t l1, l2;
+  loadint(J, RAX, o1);
+  loadint(J, RCX, o2);
+  emitmem(J, 0, 1, 0x8D, RDX, RCX, 1);  /* lea rdx, [rcx + 1] */
+  emitreg(J, 0, 1, 0x83, 7, RDX);  /* cmp rdx, 1 */
+  emit1(J, 1);
+  jccto(J, CC_BE, fail);
+  emit1(J, 0x48); emit1(J, 0x99);  /* cqo */
+  emitreg(J, 0, 1, 0xF7, 7, RCX);  /* idiv rcx */
+  emitreg(J, 0, 1, 0x85, RDX, RDX);  /* test rdx, rdx */
+  l1 = jccfwd(J, CC_E);
+  emitreg(J, 0, 1, 0x89, RDX, RAX);  /* mov rax, rdx */
+  emitreg(J, 0, 1, 0x31, RCX, RAX);  /* xor rax, rcx */
+  l2 = jccfwd(J, CC_NS);  /* same signs? */
+  emitreg(J, 0, 1, 0x01, RCX, RDX);  /* add rdx, rcx */
+  patch(J, l1);
+  patch(J, l2);
+  storeint(J, a, RDX);
+}
+
+
+/* integer modulo; non-integer operands are left to the interpreter */
+static void genmod (JitState *J, int pc, int a, Operand o1, Operand o2) {
+  cmptag(J, o1, VMK_VNUMINT);
+  jccto(J, CC_NE, exitpos(J, pc));
+  cmptag(J, o2, VMK_VNUMINT);
+  jccto(J, CC_NE, exitpos(J, pc));
+  modint(J, a, o1, o2, exitpos(J, pc));
+  jmpto(J, pcpos(J, pc + 2));
+}
+
+
+/*
+** Position where the test at 'pc' goes when its condition is 'cond':
+** it either does the following jump or skips it.
+*/
+static size_t condtarget (JitState *J, int pc, int cond) {
+  if (cond == GETARG_k(J->p->code[pc]))
+    return pcpos(J, pc + 2 + GETARG_sJ(J->p->code[pc + 1]));
+  else
+    return pcpos(J, pc + 2);
+}
+
+
+/* jump to the target of condition 'cc' and to the target of its negation */
+static void gencond (JitState *J, int pc, unsigned int cc) {
+  jccto(J, cc, condtarget(J, pc, 1));
+  jmpto(J, condtarget(J, pc, 0));
+}
+
+
+/* compare two integers */
+static void gencmpint (JitState *J, int pc, Operand o1, Operand o2,
+                       unsigned int cc) {
+  loadint(J, RAX, o1);
+  loadint(J, RCX, o2);
+  emitreg(J, 0, 1, 0x3B, RAX, RCX);  /* cmp rax, rcx */
+  gencond(J, pc, cc);
+}
+
+
+/*
+** Order between registers: two integers or two floats ('fcc' is the
+** condition for 'ucomisd' with swapped operands, so that NaN fails it).
+*/
+static void genorder (JitState *J, int pc, int a, int b,
+                      unsigned int icc, unsigned int fcc) {
+  Operand o1 = regop(a);
+  Operand o2 = regop(b);
+  size_t l1, l2;
+  cmptag(J, o1, VMK_VNUMINT);
+  l1 = jccfwd(J, CC_NE);
+  cmptag(J, o2, VMK_VNUMINT);
+  l2 = jccfwd(J, CC_NE);
+  gencmpint(J, pc, o1, o2, icc);
+  patch(J, l1);
+  patch(J, l2);
+  cmptag(J, o1, VMK_VNUMFLT);
+  jccto(J, CC_NE, exitpos(J, pc));
+  cmptag(J, o2, VMK_VNUMFLT);
+  jccto(J, CC_NE, exitpos(J, pc));
+  loadflt(J, XMM0, o1);
+  loadflt(J, XMM1, o2);
+  emitreg(J, 0x66, 0, 0x0F2E, XMM1, XMM0);  /* ucomisd xmm1, xmm0 */
+  gencond(J, pc, fcc);
+}
+
+
+/* equality between register 'a' and constant 'n' */
+static void geneqk (JitState *J, int pc, int a, int n) {
+  Operand o = regop(a);
+  size_t l;
+  int tag = rawtt(&J->p->k[n]);
+  switch (tag) {
+    case VMK_VNIL: case VMK_VFALSE: case VMK_VTRUE: {
+      cmptag(J, o, tag);
+      gencond(J, pc, CC_E);
+      break;
+    }
+    case VMK_VNUMINT: case ctb(VMK_VSHRSTR): {
+      cmptag(J, o, tag);
+      l = jccfwd(J, CC_NE);
+      gencmpint(J, pc, o, kop(n), CC_E);
+      patch(J, l);
+      /* floats and long strings may still be equal to it */
+      cmptag(J, o, (tag == VMK_VNUMINT) ? VMK_VNUMFLT : ctb(VMK_VLNGSTR));
+      jccto(J, CC_E, exitpos(J, pc));
+      jmpto(J, condtarget(J, pc, 0));
+      break;
+    }
+    default:
+      jmpto(J, exitpos(J, pc));
+  }
+}
+
+
+/*
+** A loop back-edge: leave native code if the interpreter must see
+** the loop (hooks, signals); otherwise, jump back to 'dest', where the
+** code for instruction 'target' is.
+*/
+static void genloop (JitState *J, int target, size_t dest) {
+  emitmem(J, 0, 0, 0x83, 7, RTRAP, 0);  /* cmp dword [trap], 0 */
+  emit1(J, 0);
+  jccto(J, CC_NE, exitpos(J, target));
+  jmpto(J, dest);
+}
+
+
+/*
+** Count an iteration of the loop closed by the FORLOOP at 'pc' (in the
+** inline-cache slot of that instruction, otherwise unused); when the
+** loop gets hot, leave native code asking for a recording.
+*/
+static void gencount (JitState *J, int pc) {
+  size_t slot = cast(size_t, &J->p->icache[pc]);
+  size_t l;
+  emit1(J, 0x48); emit1(J, 0xB8);  /* mov rax, slot */
+  emit4(J, cast_uint(slot & 0xFFFFFFFFu));
+  emit4(J, cast_uint(slot >> 32));
+  emitmem(J, 0, 0, 0x83, 0, RAX, 0);  /* add dword [rax], 1 */
+  emit1(J, 1);
+  emitmem(J, 0, 0, 0x81, 7, RAX, 0);  /* cmp dword [rax], VMKJ_TRACEHOT */
+  emit4(J, VMKJ_TRACEHOT);
+  l = jccfwd(J, CC_NE);
+  emit1(J, 0xB8);  /* mov eax, -(pc + 1) */
+  emit4(J, cast_uint(-(pc + 1)));
+  jmpto(J, J->epilogue);
+  patch(J, l);
+}
+
+
+/*
+** Step of an integer for loop (see 'OP_FORLOOP' in lvm.c). Return the
+** jump taken when the loop ends.
+*/
+static size_t forint (JitState *J, int a) {
+  size_t ldone;
+  loadint(J, RAX, regop(a));  /* count */
+  emitreg(J, 0, 1, 0x85, RAX, RAX);  /* test rax, rax */
+  ldone = jccfwd(J, CC_E);
+  emitreg(J, 0, 1, 0x83, 5, RAX);  /* sub rax, 1 */
+  emit1(J, 1);
+  emitmem(J, 0, 1, 0x89, RAX, RBASE, VOFF(a));
+  loadint(J, RCX, regop(a + 2));
+  emitmem(J, 0, 1, 0x03, RCX, RBASE, VOFF(a + 1));  /* add rcx, step */
+  emitmem(J, 0, 1, 0x89, RCX, RBASE, VOFF(a + 2));
+  return ldone;
+}
+
+
+/*
+** Step of a float for loop (see 'floatforloop' in lvm.c). 'ldone' gets
+** the jumps taken when the loop ends.
+*/
+static void forflt (JitState *J, int a, size_t ldone[2]) {
+  size_t lneg, lcont;
+  loadflt(J, XMM0, regop(a + 2));
+  loadflt(J, XMM1, regop(a + 1));  /* step */
+  loadflt(J, XMM3, regop(a));  /* limit */
+  emitreg(J, 0xF2, 0, 0x0F58, XMM0, XMM1);  /* addsd xmm0, xmm1 */
+  emitreg(J, 0x66, 0, 0x0F57, XMM2, XMM2);  /* xorpd xmm2, xmm2 */
+  emitreg(J, 0x66, 0, 0x0F2E, XMM1, XMM2);  /* ucomisd step, 0 */
+  lneg = jccfwd(J, CC_BE);
+  emitreg(J, 0x66, 0, 0x0F2E, XMM3, XMM0);  /* ucomisd limit, idx */
+  lcont = jccfwd(J, CC_AE);
+  ldone[0] = jmpfwd(J);
+  patch(J, lneg);  /* negative step */
+  emitreg(J, 0x66, 0, 0x0F2E, XMM0, XMM3);  /* ucomisd idx, limit */
+  ldone[1] = jccfwd(J, CC_B);
+  patch(J, lcont);
+  emitmem(J, 0xF2, 0, 0x0F11, XMM0, RBASE, VOFF(a + 2));
+}
+
+
+/*
+** FORLOOP at 'pc'; the loop continues at 'dest'. With 'count', its
+** iterations are counted to trigger a recording.
+*/
+static void genforloop (JitState *J, int pc, size_t dest, int count) {
+  Instruction i = J->p->code[pc];
+  int a = GETARG_A(i);
+  int target = pc + 1 - GETARG_Bx(i);
+  size_t lflt, ldone[3];
+  cmptag(J, regop(a + 1), VMK_VNUMINT);
+  lflt = jccfwd(J, CC_NE);
+  ldone[0] = forint(J, a);
+  if (count)
+    gencount(J, pc);
+  genloop(J, target, dest);
+  patch(J, lflt);
+  forflt(J, a, ldone + 1);
+  if (count)
+    gencount(J, pc);
+  genloop(J, target, dest);
+  patch(J, ldone[0]);
+  patch(J, ldone[1]);
+  patch(J, ldone[2]);
+}
+
+
+/*
+** Compute the array slot for integer 'key' in table 'tab' (see
+** 'vmkH_fastgeti'), going to 'fail' if the key is out of the array
+** part. Leave the table in RDX, the tag of the slot at [RAX + TAGOFF]
+** and its value at [RCX + VALOFF].
+*/
+static void arrayslot (JitState *J, Operand tab, Operand key, size_t fail) {
+  emitmem(J, 0, 1, 0x8B, RDX, tab.base, tab.disp);  /* mov rdx, [tab] */
+  loadint(J, RCX, key);
+  emitreg(J, 0, 1, 0x83, 5, RCX);  /* sub rcx, 1 */
+  emit1(J, 1);
+  emitmem(J, 0, 0, 0x8B, RAX, RDX, ASIZEOFF);  /* mov eax, [rdx].asize */
+  emitreg(J, 0, 1, 0x3B, RCX, RAX);  /* cmp rcx, rax */
+  jccto(J, CC_AE, fail);
+  emitmem(J, 0, 1, 0x8B, RSI, RDX, ARRAYOFF);  /* mov rsi, [rdx].array */
+  emitreg(J, 0, 1, 0x89, RSI, RAX);  /* mov rax, rsi */
+  emitreg(J, 0, 1, 0x01, RCX, RAX);  /* add rax, rcx */
+  emitreg(J, 0, 1, 0xC1, 4, RCX);  /* shl rcx, 3 */
+  emit1(J, 3);
+  emitreg(J, 0, 1, 0xF7, 3, RCX);  /* neg rcx */
+  emitreg(J, 0, 1, 0x01, RSI, RCX);  /* add rcx, rsi */
+}
+
+
+/*
+** Go forward (to the returned jump) if the array part computed by
+** 'arrayslot' is generic. Otherwise, leave the C-index of the slot in
+** EDI. (A typed array part has no tags; see 'isarrtyped'.)
+*/
+static size_t jmpgeneric (JitState *J) {
+  size_t l;
+  emitmem(J, 0, 0, 0x81, 7, RSI, 0);  /* cmp [hint], typedhint(0) */
+  emit4(J, typedhint(0));
+  l = jccfwd(J, CC_B);
+  emitreg(J, 0, 0, 0x89, RAX, RDI);  /* mov edi, eax */
+  emitreg(J, 0, 0, 0x29, RSI, RDI);  /* sub edi, esi (C-index) */
+  return l;
+}
+
+
+/*
+** R[a] := slot computed by 'arrayslot'. With 'tag' equal to NOTAG, any
+** non-empty value is accepted; otherwise, the value must have that tag.
+*/
+static void getslot (JitState *J, int a, int tag, size_t fail) {
+  size_t lgen = jmpgeneric(J);
+  size_t lload;
+  emitmem(J, 0, 0, 0x3B, RDI, RSI, BORDEROFF);  /* cmp edi, [border] */
+  jccto(J, CC_AE, fail);  /* entries after the border are empty */
+  emitmem(J, 0, 0, 0x0FB6, RDX, RSI, 0);  /* movzx edx, [hint] (tag) */
+  if (tag != NOTAG) {
+    emitreg(J, 0, 0, 0x80, 7, RDX);  /* cmp dl, tag */
+    emit1(J, cast_uint(tag));
+    jccto(J, CC_NE, fail);
+  }
+  lload = jmpfwd(J);
+  patch(J, lgen);
+  emitmem(J, 0, 0, 0x0FB6, RDX, RAX, TAGOFF);  /* movzx edx, [tag] */
+  if (tag == NOTAG) {
+    emitreg(J, 0, 0, 0xF6, 0, RDX);  /* test dl, 0x0F (empty?) */
+    emit1(J, 0x0F);
+    jccto(J, CC_E, fail);
+  }
+  else {
+    emitreg(J, 0, 0, 0x80, 7, RDX);  /* cmp dl, tag */
+    emit1(J, cast_uint(tag));
+    jccto(J, CC_NE, fail);
+  }
+  patch(J, lload);
+  emitmem(J, 0, 1, 0x8B, RAX, RCX, VALOFF);  /* mov rax, [value] */
+  emitmem(J, 0, 1, 0x89, RAX, RBASE, VOFF(a));
+  emitmem(J, 0, 0, 0x88, RDX, RBASE, VOFF(a) + TTOFF);  /* mov [a], dl */
+}
+
+
+/*
+** Update the border of the array part (see 'vmkH_setborder') for the
+** store of a value with tag DL into the slot computed by 'arrayslot'.
+*/
+static void setborder (JitState *J) {
+  size_t lnil, ldone[4], lhole[2];
+  emitreg(J, 0, 0, 0x89, RAX, RDI);  /* mov edi, eax */
+  emitreg(J, 0, 0, 0x29, RSI, RDI);  /* sub edi, esi (C-index) */
+  emitreg(J, 0, 0, 0xF6, 0, RDX);  /* test dl, 0x0F (empty?) */
+  emit1(J, 0x0F);
+  lnil = jccfwd(J, CC_E);
+  emitmem(J, 0, 0, 0x3B, RDI, RSI, BORDEROFF);  /* cmp edi, [border] */
+  ldone[0] = jccfwd(J, CC_B);  /* entry before the border */
+  lhole[0] = jccfwd(J, CC_NE);  /* entry after the border */
+  emitmem(J, 0, 0, 0xFF, 0, RSI, BORDEROFF);  /* inc [border] (append) */
+  ldone[1] = jmpfwd(J);
+  patch(J, lnil);
+  emitreg(J, 0, 0, 0xFF, 0, RDI);  /* inc edi */
+  emitmem(J, 0, 0, 0x3B, RDI, RSI, BORDEROFF);  /* cmp edi, [border] */
+  ldone[2] = jccfwd(J, CC_A);  /* entry after the border */
+  lhole[1] = jccfwd(J, CC_NE);  /* entry before the last one */
+  emitmem(J, 0, 0, 0xFF, 1, RSI, BORDEROFF);  /* dec [border] (last) */
+  ldone[3] = jmpfwd(J);
+  patch(J, lhole[0]);
+  patch(J, lhole[1]);
+  emitmem(J, 0, 0, 0xC7, 0, RSI, BORDEROFF);  /* mov [border], NOBORDER */
+  emit4(J, NOBORDER);
+  patch(J, ldone[0]);
+  patch(J, ldone[1]);
+  patch(J, ldone[2]);
+  patch(J, ldone[3]);
+}
+
+
+/*
+** Slot computed by 'arrayslot' := 'val', which cannot be collectable
+** (so that no barrier is needed). An empty slot can only be filled when
+** the table has no metatable (and so no '__newindex'). A typed array
+** part only takes values with its tag, before or at its border.
+*/
+static void setslot (JitState *J, Operand val, size_t fail) {
+  size_t l, lgen, lstore, ldone;
+  lgen = jmpgeneric(J);
+  emitmem(J, 0, 0, 0x0FB6, RAX, val.base, val.disp + TTOFF);  /* movzx */
+  emitmem(J, 0, 0, 0x3A, RAX, RSI, 0);  /* cmp al, [hint] (tag) */
+  jccto(J, CC_NE, fail);
+  emitmem(J, 0, 0, 0x3B, RDI, RSI, BORDEROFF);  /* cmp edi, [border] */
+  lstore = jccfwd(J, CC_B);  /* entry before the border */
+  jccto(J, CC_NE, fail);  /* entry after the border */
+  emitmem(J, 0, 1, 0x83, 7, RDX, MTOFF);  /* cmp [rdx].metatable, 0 */
+  emit1(J, 0);
+  jccto(J, CC_NE, fail);
+  emitmem(J, 0, 0, 0xFF, 0, RSI, BORDEROFF);  /* inc [border] (append) */
+  patch(J, lstore);
+  emitmem(J, 0, 1, 0x8B, RSI, val.base, val.disp);
+  emitmem(J, 0, 1, 0x89, RSI, RCX, VALOFF);
+  ldone = jmpfwd(J);
+  patch(J, lgen);
+  emitmem(J, 0, 0, 0xF6, 0, RAX, TAGOFF);  /* test byte [tag], 0x0F */
+  emit1(J, 0x0F);
+  l = jccfwd(J, CC_NE);
+  emitmem(J, 0, 1, 0x83, 7, RDX, MTOFF);  /* cmp [rdx].metatable, 0 */
+  emit1(J, 0);
+  jccto(J, CC_NE, fail);
+  patch(J, l);
+  emitmem(J, 0, 0, 0x0FB6, RDX, val.base, val.disp + TTOFF);  /* movzx */
+  setborder(J);
+  emitmem(J, 0, 0, 0x88, RDX, RAX, TAGOFF);  /* mov [tag], dl */
+  emitmem(J, 0, 1, 0x8B, RSI, val.base, val.disp);
+  emitmem(J, 0, 1, 0x89, RSI, RCX, VALOFF);
+  patch(J, ldone);
+}
+
+
+/* leave native code at 'pc' if 'o' is collectable */
+static void gennotcollectable (JitState *J, Operand o, int pc) {
+  emitmem(J, 0, 0, 0xF6, 0, o.base, o.disp + TTOFF);  /* test byte */
+  emit1(J, BIT_ISCOLLECTABLE);
+  jccto(J, CC_NE, exitpos(J, pc));
+}
+
+
+/* operand for the value of upvalue 'n' (its address goes to RDX) */
+static Operand upvalue (JitState *J, int n) {
+  Operand o;
+  emitmem(J, 0, 1, 0x8B, RDX, RUPV,
+          cast_int(cast_uint(n) * sizeof(UpVal *)));  /* mov rdx, uv */
+  emitmem(J, 0, 1, 0x8B, RDX, RDX, UVOFF);  /* mov rdx, uv->v.p */
+  o.base = RDX; o.disp = 0;
+  return o;
+}
+
+
+/* integer and float operations for an arithmetic opcode */
+static void arithops (OpCode op, unsigned int *iop, unsigned int *fop) {
+  switch (op) {
+    case OP_ADDI: case OP_ADDK: case OP_ADD:
+      *iop = 0x03; *fop = 0x0F58; break;  /* add, addsd */
+    case OP_SUBK: case OP_SUB:
+      *iop = 0x2B; *fop = 0x0F5C; break;  /* sub, subsd */
+    case OP_MULK: case OP_MUL:
+      *iop = 0x0FAF; *fop = 0x0F59; break;  /* imul, mulsd */
+    default:  /* division */
+      *iop = 0; *fop = 0x0F5E; break;  /* divsd */
+  }
+}
+
+
+/* the key and the value of a SETTABLE or a SETI */
+static void setoperands (JitState *J, Instruction i, Operand *key,
+                                                     Operand *val) {
+  UNUSED(J);
+  *key = (GET_OPCODE(i) == OP_SETI) ? immop(GETARG_B(i))
+                                    : regop(GETARG_B(i));
+  *val = TESTARG_k(i) ? kop(GETARG_C(i)) : regop(GETARG_C(i));
+}
+
+
+/*
+** {==================================================================
+** Traces
+** ===================================================================
+*/
+
+/* size of a trace with 'n' instructions */
+#define tracesize(n)	(offsetof(JitTrace, ins) + cast_sizet(n) * sizeof(TraceIns))
+
+
+typedef struct TraceState {
+  const JitTrace *tr;
+  size_t body;  /* position of the body of the trace */
+  lu_byte known[MAXREGS];  /* tag of each register, when known */
+  lu_byte entry[MAXREGS];  /* tags checked at the entry of the trace */
+} TraceState;
+
+
+#define isnumtag(t)	((t) == VMK_VNUMINT || (t) == VMK_VNUMFLT)
+
+#define iscollectabletag(t)	((t) == NOTAG || ((t) & BIT_ISCOLLECTABLE))
+
+
+/*
+** Registers read by instruction 'i', and the operand slot (0 to 2, for
+** A, B, and C) where the recorder keeps their tags; return how many.
+** For OP_FORLOOP, the slots keep registers A, A + 1, and A + 2.
+*/
+static int readregs (Instruction i, int reg[3], int slot[3]) {
+  int a = GETARG_A(i);
+  int b = getarg(i, POS_B, SIZE_B);  /* meaningful only in iABC modes */
+  int c = getarg(i, POS_C, SIZE_C);
+  int n = 0;
+#define addread(r,s)	{ reg[n] = (r); slot[n] = (s); n++; }
+  switch (GET_OPCODE(i)) {
+    case OP_FORLOOP:
+      addread(a, 0); addread(a + 1, 1); addread(a + 2, 2);
+      break;
+    case OP_EQ: case OP_LT: case OP_LE:
+      addread(a, 0); addread(b, 1);
+      break;
+    case OP_SETTABLE:
+      addread(a, 0); addread(b, 1);
+      if (!TESTARG_k(i)) addread(c, 2);
+      break;
+    case OP_SETI:
+      addread(a, 0);
+      if (!TESTARG_k(i)) addread(c, 2);
+      break;
+    case OP_SETUPVAL: case OP_EQK: case OP_EQI: case OP_LTI: case OP_LEI:
+    case OP_GTI: case OP_GEI: case OP_TEST:
+      addread(a, 0);
+      break;
+    case OP_MOVE: case OP_GETI: case OP_ADDI: case OP_ADDK: case OP_SUBK:
+    case OP_MULK: case OP_MODK: case OP_DIVK:
+      addread(b, 1);
+      break;
+    case OP_GETTABLE: case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+    case OP_DIV:
+      addread(b, 1); addread(c, 2);
+      break;
+    default: break;
+  }
+#undef addread
+  return n;
+}
+
+
+/*
+** Registers written by instruction 'i', from 'first' to the returned
+** one (none if the result is smaller than 'first'); return -1 if 'i'
+** cannot be part of a trace.
+*/
+static int writeregs (Instruction i, int *first) {
+  int a = GETARG_A(i);
+  *first = a;
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADI: case OP_LOADF: case OP_LOADK:
+    case OP_LOADFALSE: case OP_LFALSESKIP: case OP_LOADTRUE:
+    case OP_GETUPVAL: case OP_GETTABLE: case OP_GETI:
+    case OP_ADDI: case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK:
+    case OP_DIVK: case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+    case OP_DIV:
+      return a;
+    case OP_LOADNIL:
+      return a + GETARG_B(i);
+    case OP_FORLOOP:
+      return a + 2;
+    case OP_SETUPVAL: case OP_SETTABLE: case OP_SETI: case OP_JMP:
+    case OP_EQ: case OP_LT: case OP_LE: case OP_EQK: case OP_EQI:
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: case OP_TEST:
+      return a - 1;
+    default:
+      return -1;
+  }
+}
+
+
+/*
+** Whether the test at trace instruction 'j' was true when recorded
+** (that is, whether it went where its condition 'k' says); 'other' gets
+** the position of the path not taken.
+*/
+static int recordedcond (JitState *J, const TraceState *T, int j,
+                         size_t *other) {
+  int pc = T->tr->ins[j].pc;
+  int jt = pc + 2 + GETARG_sJ(J->p->code[pc + 1]);
+  int taken = (T->tr->ins[j + 1].pc == jt);
+  *other = pcpos(J, taken ? pc + 2 : jt);
+  return (taken == GETARG_k(J->p->code[pc]));
+}
+
+
+/*
+** Test at trace instruction 'j', after a comparison whose condition
+** code for "true" is 'cc': leave the trace if it does not go the way
+** it went when recorded.
+*/
+static void trcond (JitState *J, const TraceState *T, int j,
+                    unsigned int cc) {
+  size_t other;
+  int cond = recordedcond(J, T, j, &other);
+  jccto(J, cond ? (cc ^ 1u) : cc, other);
+}
+
+
+/* load number 'o', with tag 't', as a float */
+static void trtofloat (JitState *J, int xmm, Operand o, int t) {
+  if (isimm(o)) {
+    loadint(J, RAX, o);
+    emitreg(J, 0xF2, 1, 0x0F2A, xmm, RAX);  /* cvtsi2sd xmm, rax */
+  }
+  else if (t == VMK_VNUMINT)
+    emitmem(J, 0xF2, 1, 0x0F2A, xmm, o.base, o.disp);  /* cvtsi2sd */
+  else
+    loadflt(J, xmm, o);
+}
+
+
+static int trarith (JitState *J, TraceState *T, int pc, Instruction i,
+                    Operand o2, int t2) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  Operand o1 = regop(GETARG_B(i));
+  int t1 = T->known[GETARG_B(i)];
+  int ints = (t1 == VMK_VNUMINT && t2 == VMK_VNUMINT);
+  unsigned int iop, fop;
+  if (!isnumtag(t1) || !isnumtag(t2))
+    return 0;  /* arithmetic with metamethods */
+  if (op == OP_MOD || op == OP_MODK) {
+    if (!ints)
+      return 0;
+    modint(J, a, o1, o2, pcpos(J, pc));
+    T->known[a] = VMK_VNUMINT;
+    return 1;
+  }
+  arithops(op, &iop, &fop);
+  if (ints && iop != 0) {
+    loadint(J, RAX, o1);
+    loadint(J, RCX, o2);
+    emitreg(J, 0, 1, iop, RAX, RCX);
+    storeint(J, a, RAX);
+    T->known[a] = VMK_VNUMINT;
+  }
+  else {
+    trtofloat(J, XMM0, o1, t1);
+    trtofloat(J, XMM1, o2, t2);
+    emitreg(J, 0xF2, 0, fop, XMM0, XMM1);
+    storeflt(J, a, XMM0);
+    T->known[a] = VMK_VNUMFLT;
+  }
+  return 1;
+}
+
+
+/* comparison of two registers inside a trace */
+static int trorder (JitState *J, TraceState *T, int j, Instruction i,
+                    unsigned int icc, unsigned int fcc) {
+  int a = GETARG_A(i), b = GETARG_B(i);
+  if (T->known[a] == VMK_VNUMINT && T->known[b] == VMK_VNUMINT) {
+    loadint(J, RAX, regop(a));
+    loadint(J, RCX, regop(b));
+    emitreg(J, 0, 1, 0x3B, RAX, RCX);  /* cmp rax, rcx */
+    trcond(J, T, j, icc);
+  }
+  else if (fcc != 0 &&
+           T->known[a] == VMK_VNUMFLT && T->known[b] == VMK_VNUMFLT) {
+    loadflt(J, XMM0, regop(a));
+    loadflt(J, XMM1, regop(b));
+    emitreg(J, 0x66, 0, 0x0F2E, XMM1, XMM0);  /* ucomisd xmm1, xmm0 */
+    trcond(J, T, j, fcc);
+  }
+  else
+    return 0;
+  return 1;
+}
+
+
+/*
+** A test whose result depends only on types, which are known inside
+** the trace: it must go the way it went when recorded.
+*/
+static int trstatic (JitState *J, const TraceState *T, int j, int cond) {
+  size_t other;
+  return (recordedcond(J, T, j, &other) == cond);
+}
+
+
+static int trforloop (JitState *J, TraceState *T, int pc, Instruction i) {
+  int a = GETARG_A(i);
+  int target = pc + 1 - GETARG_Bx(i);
+  lu_byte *known = T->known;
+  if (known[a] == VMK_VNUMINT && known[a + 1] == VMK_VNUMINT &&
+      known[a + 2] == VMK_VNUMINT) {
+    size_t ldone = forint(J, a);
+    genloop(J, target, T->body);
+    patch(J, ldone);
+  }
+  else if (known[a] == VMK_VNUMFLT && known[a + 1] == VMK_VNUMFLT &&
+           known[a + 2] == VMK_VNUMFLT) {
+    size_t ldone[2];
+    forflt(J, a, ldone);
+    genloop(J, target, T->body);
+    patch(J, ldone[0]);
+    patch(J, ldone[1]);
+  }
+  else
+    return 0;
+  jmpto(J, pcpos(J, pc + 1));
+  return 1;
+}
+
+
+/*
+** Generate instruction 'j' of a trace. Return false if the trace cannot
+** be compiled.
+*/
+static int traceins (JitState *J, TraceState *T, int j) {
+  const TraceIns *ti = &T->tr->ins[j];
+  int pc = ti->pc;
+  Instruction i = vmkP_unquicken(J->p->code[pc]);
+  int a = GETARG_A(i);
+  lu_byte *known = T->known;
+  size_t fail = pcpos(J, pc);  /* side exit */
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: {
+      copyvalue(J, regop(a), regop(GETARG_B(i)));
+      known[a] = known[GETARG_B(i)];
+      break;
+    }
+    case OP_LOADI: {
+      loadint(J, RAX, immop(GETARG_sBx(i)));
+      storeint(J, a, RAX);
+      known[a] = VMK_VNUMINT;
+      break;
+    }
+    case OP_LOADF: {
+      trtofloat(J, XMM0, immop(GETARG_sBx(i)), VMK_VNUMINT);
+      storeflt(J, a, XMM0);
+      known[a] = VMK_VNUMFLT;
+      break;
+    }
+    case OP_LOADK: {
+      copyvalue(J, regop(a), kop(GETARG_Bx(i)));
+      known[a] = rawtt(&J->p->k[GETARG_Bx(i)]);
+      break;
+    }
+    case OP_LOADFALSE: case OP_LFALSESKIP: {
+      settag(J, a, VMK_VFALSE);
+      known[a] = VMK_VFALSE;
+      break;
+    }
+    case OP_LOADTRUE: {
+      settag(J, a, VMK_VTRUE);
+      known[a] = VMK_VTRUE;
+      break;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        known[a] = VMK_VNIL;
+        settag(J, a++, VMK_VNIL);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL: {
+      Operand uv = upvalue(J, GETARG_B(i));
+      cmptag(J, uv, ti->res);
+      jccto(J, CC_NE, fail);
+      copyvalue(J, regop(a), uv);
+      known[a] = ti->res;
+      break;
+    }
+    case OP_SETUPVAL: {
+      if (iscollectabletag(known[a]))
+        return 0;  /* would need a barrier */
+      copyvalue(J, upvalue(J, GETARG_B(i)), regop(a));
+      break;
+    }
+    case OP_GETTABLE: case OP_GETI: {
+      Operand key;
+      if (GET_OPCODE(i) == OP_GETI)
+        key = immop(GETARG_C(i));
+      else if (known[GETARG_C(i)] == VMK_VNUMINT)
+        key = regop(GETARG_C(i));
+      else
+        return 0;
+      if (known[GETARG_B(i)] != ctb(VMK_VTABLE) || ti->res == NOTAG ||
+          tagisempty(ti->res))
+        return 0;
+      arrayslot(J, regop(GETARG_B(i)), key, fail);
+      getslot(J, a, ti->res, fail);
+      known[a] = ti->res;
+      break;
+    }
+    case OP_SETTABLE: case OP_SETI: {
+      Operand key, val;
+      int vtag;
+      setoperands(J, i, &key, &val);
+      vtag = TESTARG_k(i) ? rawtt(&J->p->k[GETARG_C(i)])
+                          : known[GETARG_C(i)];
+      if (known[a] != ctb(VMK_VTABLE) || iscollectabletag(vtag) ||
+          (!isimm(key) && known[GETARG_B(i)] != VMK_VNUMINT))
+        return 0;
+      arrayslot(J, regop(a), key, fail);
+      setslot(J, val, fail);
+      break;
+    }
+    case OP_ADDI: {
+      return trarith(J, T, pc, i, immop(GETARG_sC(i)), VMK_VNUMINT);
+    }
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK: case OP_DIVK: {
+      return trarith(J, T, pc, i, kop(GETARG_C(i)),
+                                  rawtt(&J->p->k[GETARG_C(i)]));
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_DIV: {
+      return trarith(J, T, pc, i, regop(GETARG_C(i)), known[GETARG_C(i)]);
+    }
+    case OP_JMP: {  /* the trace already follows it */
+      break;
+    }
+    case OP_EQ: {
+      return trorder(J, T, j, i, CC_E, 0);
+    }
+    case OP_LT: {
+      return trorder(J, T, j, i, CC_L, CC_A);
+    }
+    case OP_LE: {
+      return trorder(J, T, j, i, CC_LE, CC_AE);
+    }
+    case OP_EQK: {
+      int n = GETARG_B(i);
+      int kt = rawtt(&J->p->k[n]);
+      if (kt == VMK_VNIL || kt == VMK_VFALSE || kt == VMK_VTRUE)
+        return trstatic(J, T, j, known[a] == kt);
+      else if (known[a] == kt &&
+               (kt == VMK_VNUMINT || kt == ctb(VMK_VSHRSTR))) {
+        loadint(J, RAX, regop(a));
+        loadint(J, RCX, kop(n));
+        emitreg(J, 0, 1, 0x3B, RAX, RCX);  /* cmp rax, rcx */
+        trcond(J, T, j, CC_E);
+      }
+      else
+        return 0;
+      break;
+    }
+    case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
+      static const unsigned int ccs[] = {CC_E, CC_L, CC_LE, CC_G, CC_GE};
+      if (known[a] != VMK_VNUMINT)
+        return 0;
+      loadint(J, RAX, regop(a));
+      loadint(J, RCX, immop(GETARG_sB(i)));
+      emitreg(J, 0, 1, 0x3B, RAX, RCX);  /* cmp rax, rcx */
+      trcond(J, T, j, ccs[GET_OPCODE(i) - OP_EQI]);
+      break;
+    }
+    case OP_TEST: {
+      int t = known[a];
+      return trstatic(J, T, j, !(t == VMK_VFALSE || novariant(t) == VMK_TNIL));
+    }
+    case OP_FORLOOP: {
+      return trforloop(J, T, pc, i);
+    }
+    default:
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+** Generate trace 'tr' for the loop closed by the FORLOOP at 'loop', in
+** place of that instruction. Return false (leaving garbage in the code)
+** if the trace cannot be compiled.
+*/
+static int gentrace (JitState *J, const JitTrace *tr, int loop) {
+  TraceState T;
+  lu_byte written[MAXREGS];
+  int target = loop + 1 - GETARG_Bx(J->p->code[loop]);
+  int j, r;
+  size_t lhead, lentry;
+  T.tr = tr;
+  memset(T.entry, NOTAG, sizeof(T.entry));
+  memset(written, 0, sizeof(written));
+  /* registers read before being written are checked at the entry */
+  for (j = 0; j < tr->n; j++) {
+    Instruction i = vmkP_unquicken(J->p->code[tr->ins[j].pc]);
+    int reg[3], slot[3];
+    int n = readregs(i, reg, slot);
+    int last = writeregs(i, &r);
+    while (n-- > 0) {
+      if (!written[reg[n]] && T.entry[reg[n]] == NOTAG)
+        T.entry[reg[n]] = tr->ins[j].tag[slot[n]];
+    }
+    for (; r <= last; r++)
+      written[r] = 1;
+  }
+  lhead = jmpfwd(J);
+  lentry = J->pos;
+  for (r = 0; r < MAXREGS; r++) {
+    if (T.entry[r] != NOTAG) {
+      cmptag(J, regop(r), T.entry[r]);
+      jccto(J, CC_NE, pcpos(J, target));
+    }
+  }
+  memcpy(T.known, T.entry, sizeof(T.known));
+  T.body = J->pos;
+  for (j = 0; j < tr->n; j++) {
+    if (!traceins(J, &T, j))
+      return 0;
+  }
+  for (r = 0; r < MAXREGS; r++) {  /* types must hold for next iteration */
+    if (T.entry[r] != NOTAG && T.known[r] != T.entry[r])
+      return 0;
+  }
+  patch(J, lhead);  /* FORLOOP coming from regular code */
+  genforloop(J, loop, lentry, 0);
+  return 1;
+}
+
+
+static const JitTrace *findtrace (const Proto *p, int loop) {
+  const JitTrace *tr;
+  for (tr = p->traces; tr != NULL; tr = tr->next) {
+    if (tr->ins[tr->n - 1].pc == loop)
+      return tr;
+  }
+  return NULL;
+}
+
+/* }================================================================== */
+
+
+static void genins (JitState *J, int pc) {
+  Instruction i = vmkP_unquicken(J->p->code[pc]);
+  int a = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: {
+      copyvalue(J, regop(a), regop(GETARG_B(i)));
+      break;
+    }
+    case OP_LOADI: {
+      loadint(J, RAX, immop(GETARG_sBx(i)));
+      storeint(J, a, RAX);
+      break;
+    }
+    case OP_LOADF: {
+      tofloat(J, XMM0, immop(GETARG_sBx(i)), pc);
+      storeflt(J, a, XMM0);
+      break;
+    }
+    case OP_LOADK: {
+      copyvalue(J, regop(a), kop(GETARG_Bx(i)));
+      break;
+    }
+    case OP_LOADFALSE: {
+      settag(J, a, VMK_VFALSE);
+      break;
+    }
+    case OP_LFALSESKIP: {
+      settag(J, a, VMK_VFALSE);
+      jmpto(J, pcpos(J, pc + 2));
+      break;
+    }
+    case OP_LOADTRUE: {
+      settag(J, a, VMK_VTRUE);
+      break;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        settag(J, a++, VMK_VNIL);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL: {
+      copyvalue(J, regop(a), upvalue(J, GETARG_B(i)));
+      break;
+    }
+    case OP_SETUPVAL: {
+      gennotcollectable(J, regop(a), pc);
+      copyvalue(J, upvalue(J, GETARG_B(i)), regop(a));
+      break;
+    }
+    case OP_GETTABLE: case OP_GETI: {
+      Operand tab = regop(GETARG_B(i));
+      Operand key = (GET_OPCODE(i) == OP_GETI) ? immop(GETARG_C(i))
+                                               : regop(GETARG_C(i));
+      cmptag(J, tab, ctb(VMK_VTABLE));
+      jccto(J, CC_NE, exitpos(J, pc));
+      if (!isimm(key)) {
+        cmptag(J, key, VMK_VNUMINT);
+        jccto(J, CC_NE, exitpos(J, pc));
+      }
+      arrayslot(J, tab, key, exitpos(J, pc));
+      getslot(J, a, NOTAG, exitpos(J, pc));
+      break;
+    }
+    case OP_SETTABLE: case OP_SETI: {
+      Operand key, val;
+      setoperands(J, i, &key, &val);
+      cmptag(J, regop(a), ctb(VMK_VTABLE));
+      jccto(J, CC_NE, exitpos(J, pc));
+      if (!isimm(key)) {
+        cmptag(J, key, VMK_VNUMINT);
+        jccto(J, CC_NE, exitpos(J, pc));
+      }
+      gennotcollectable(J, val, pc);
+      arrayslot(J, regop(a), key, exitpos(J, pc));
+      setslot(J, val, exitpos(J, pc));
+      break;
+    }
+    case OP_ADDI: {
+      genarith(J, pc, a, regop(GETARG_B(i)), immop(GETARG_sC(i)),
+                      0x03, 0x0F58);
+      break;
+    }
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_DIVK:
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: {
+      OpCode op = GET_OPCODE(i);
+      Operand o2 = (op <= OP_DIVK) ? kop(GETARG_C(i))
+                                   : regop(GETARG_C(i));
+      unsigned int iop, fop;
+      arithops(op, &iop, &fop);
+      genarith(J, pc, a, regop(GETARG_B(i)), o2, iop, fop);
+      break;
+    }
+    case OP_MODK: {
+      genmod(J, pc, a, regop(GETARG_B(i)), kop(GETARG_C(i)));
+      break;
+    }
+    case OP_MOD: {
+      genmod(J, pc, a, regop(GETARG_B(i)), regop(GETARG_C(i)));
+      break;
+    }
+    case OP_JMP: {
+      int target = pc + 1 + GETARG_sJ(i);
+      if (target <= pc)
+        genloop(J, target, pcpos(J, target));
+      else
+        jmpto(J, pcpos(J, target));
+      break;
+    }
+    case OP_EQ: {
+      Operand o1 = regop(a);
+      Operand o2 = regop(GETARG_B(i));
+      cmptag(J, o1, VMK_VNUMINT);
+      jccto(J, CC_NE, exitpos(J, pc));
+      cmptag(J, o2, VMK_VNUMINT);
+      jccto(J, CC_NE, exitpos(J, pc));
+      gencmpint(J, pc, o1, o2, CC_E);
+      break;
+    }
+    case OP_LT: {
+      genorder(J, pc, a, GETARG_B(i), CC_L, CC_A);
+      break;
+    }
+    case OP_LE: {
+      genorder(J, pc, a, GETARG_B(i), CC_LE, CC_AE);
+      break;
+    }
+    case OP_EQK: {
+      geneqk(J, pc, a, GETARG_B(i));
+      break;
+    }
+    case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
+      static const unsigned int ccs[] = {CC_E, CC_L, CC_LE, CC_G, CC_GE};
+      cmptag(J, regop(a), VMK_VNUMINT);
+      jccto(J, CC_NE, exitpos(J, pc));
+      gencmpint(J, pc, regop(a), immop(GETARG_sB(i)),
+                       ccs[GET_OPCODE(i) - OP_EQI]);
+      break;
+    }
+    case OP_TEST: {
+      size_t l1, l2;
+      emitmem(J, 0, 0, 0x0FB6, RAX, RBASE, VOFF(a) + TTOFF);  /* movzx */
+      emit1(J, 0x3C);  /* cmp al, false */
+      emit1(J, VMK_VFALSE);
+      l1 = jccfwd(J, CC_E);
+      emit1(J, 0xA8);  /* test al, 0x0F (nil?) */
+      emit1(J, 0x0F);
+      l2 = jccfwd(J, CC_E);
+      jmpto(J, condtarget(J, pc, 1));
+      patch(J, l1);
+      patch(J, l2);
+      jmpto(J, condtarget(J, pc, 0));
+      break;
+    }
+    case OP_FORLOOP: {
+      size_t start = J->pos;
+      const JitTrace *tr = findtrace(J->p, pc);
+      if (tr == NULL || !gentrace(J, tr, pc)) {
+        J->pos = start;  /* discard a failed trace */
+        genforloop(J, pc, pcpos(J, pc + 1 - GETARG_Bx(i)),
+                          J->p->icache[pc] < VMKJ_TRACEHOT);
+      }
+      break;
+    }
+    default:  /* let the interpreter do it */
+      jmpto(J, exitpos(J, pc));
+  }
+}
+
+
+/*
+** Generate the whole fn: prologue, one template per instruction,
+** the common exit code and one exit stub per instruction.
+*/
+static void genproto (JitState *J) {
+  int pc;
+  J->pos = 0;
+  emit1(J, 0x53);  /* push rbx */
+  emit1(J, 0x41); emit1(J, 0x55);  /* push r13 */
+  emit1(J, 0x41); emit1(J, 0x56);  /* push r14 */
+  emit1(J, 0x41); emit1(J, 0x57);  /* push r15 */
+  emitreg(J, 0, 1, 0x89, RDI, RBASE);  /* mov rbx, rdi */
+  emitreg(J, 0, 1, 0x89, RSI, RKST);  /* mov r14, rsi */
+  emitreg(J, 0, 1, 0x89, RDX, RUPV);  /* mov r13, rdx */
+  emitreg(J, 0, 1, 0x89, RCX, RTRAP);  /* mov r15, rcx */
+  emitreg(J, 0, 0, 0xFF, 4, R8);  /* jmp r8 */
+  for (pc = 0; pc < J->p->sizecode; pc++) {
+    vmk_assert(J->code == NULL || J->entry[pc] == J->pos);
+    J->entry[pc] = cast_uint(J->pos);
+    genins(J, pc);
+  }
+  J->epilogue = J->pos;
+  emit1(J, 0x41); emit1(J, 0x5F);  /* pop r15 */
+  emit1(J, 0x41); emit1(J, 0x5E);  /* pop r14 */
+  emit1(J, 0x41); emit1(J, 0x5D);  /* pop r13 */
+  emit1(J, 0x5B);  /* pop rbx */
+  emit1(J, 0xC3);  /* ret */
+  J->stubs = J->pos;
+  for (pc = 0; pc < J->p->sizecode; pc++) {
+    emit1(J, 0xB8);  /* mov eax, pc */
+    emit4(J, cast_uint(pc));
+    jmpto(J, J->epilogue);
+  }
+}
+
+
+/*
+** Compile 'p' to native code. Return true on success; otherwise 'p'
+** keeps running in the interpreter.
+*/
+int vmkJ_compile (Proto *p) {
+  JitState J;
+  JitCode *jc;
+  void *mc;
+  size_t size = offsetof(JitCode, entry) +
+                cast_sizet(p->sizecode) * sizeof(unsigned int);
+  if (sizeof(vmk_Integer) != 8 || sizeof(vmk_Number) != 8 ||
+      sizeof(Value) != 8)
+    return 0;  /* templates assume 64-bit values */
+  jc = (JitCode *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (jc == MAP_FAILED)
+    return 0;
+  J.p = p;
+  J.code = NULL;
+  J.entry = jc->entry;
+  J.epilogue = J.stubs = 0;
+  genproto(&J);  /* first pass computes the position of everything */
+  mc = mmap(NULL, J.pos, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mc == MAP_FAILED) {
+    munmap(jc, size);
+    return 0;
+  }
+  J.code = (unsigned char *)mc;
+  genproto(&J);  /* second pass generates the code */
+  if (mprotect(mc, J.pos, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mc, J.pos);
+    munmap(jc, size);
+    return 0;
+  }
+  jc->mcode = J.code;
+  jc->msize = J.pos;
+  jc->size = size;
+  p->jit = jc;
+  return 1;
+}
+
+
+static void freecode (Proto *p) {
+  JitCode *jc = p->jit;
+  munmap(jc->mcode, jc->msize);
+  munmap(jc, jc->size);
+  p->jit = NULL;
+}
+
+
+/*
+** {==================================================================
+** Trace recording
+** ===================================================================
+*/
+
+static void stoprecord (vmk_State *L) {
+  global_State *g = G(L);
+  vmkM_freemem(L, g->jitrec, sizeof(JitRecorder));
+  g->jitrec = NULL;
+}
+
+
+/*
+** Start recording the loop closed by the FORLOOP at 'loop', in frame
+** 'ci'. A recording in progress (probably from a frame that is gone)
+** is dropped.
+*/
+static void startrecord (vmk_State *L, CallInfo *ci, Proto *p, int loop) {
+  global_State *g = G(L);
+  JitRecorder *R = g->jitrec;
+  if (R == NULL) {
+    R = (JitRecorder *)vmkM_realloc_(L, NULL, 0, sizeof(JitRecorder));
+    if (R == NULL)
+      return;  /* no memory; just do not record it */
+    g->jitrec = R;
+  }
+  R->L = L;
+  R->ci = ci;
+  R->p = p;
+  R->loop = loop;
+  R->n = 0;
+  ci->u.l.trap = 1;  /* interpreter must call 'vmkG_traceexec' */
+}
+
+
+/* add a complete recording to its fn, which is compiled again */
+static void newtrace (vmk_State *L, JitRecorder *R) {
+  Proto *p = R->p;
+  JitTrace *tr = (JitTrace *)vmkM_realloc_(L, NULL, 0, tracesize(R->n));
+  JitState J;
+  if (tr == NULL)
+    return;
+  tr->n = R->n;
+  memcpy(tr->ins, R->ins, cast_sizet(R->n) * sizeof(TraceIns));
+  J.p = p;  /* check whether it can be compiled */
+  J.code = NULL;
+  J.entry = NULL;
+  J.pos = J.epilogue = J.stubs = 0;
+  if (!gentrace(&J, tr, R->loop)) {
+    vmkM_freemem(L, tr, tracesize(tr->n));
+    return;
+  }
+  tr->next = p->traces;
+  p->traces = tr;
+  if (p->jit != NULL)
+    freecode(p);
+  vmkJ_compile(p);
+}
+
+
+/*
+** Called by 'vmkG_traceexec' before the interpreter runs instruction
+** 'pc' while a recording is active. Return true to keep recording.
+*/
+int vmkJ_record (vmk_State *L, const Instruction *pc) {
+  JitRecorder *R = G(L)->jitrec;
+  CallInfo *ci = L->ci;
+  Proto *p = R->p;
+  StkId base = ci->func.p + 1;
+  Instruction i;
+  TraceIns *ti;
+  int npc, first, r, s, dummy;
+  if (R->L != L || R->ci != ci || ci_func(ci)->p != p)
+    return 0;  /* not the frame being recorded */
+  npc = cast_int(pc - p->code);
+  first = R->loop + 1 - GETARG_Bx(p->code[R->loop]);
+  if (R->n > 0) {  /* complete previous instruction */
+    ti = &R->ins[R->n - 1];
+    ti->res = rawtt(s2v(base + GETARG_A(p->code[ti->pc])));
+  }
+  i = vmkP_unquicken(p->code[npc]);
+  if (R->n == MAXTRACE || npc > R->loop ||
+      ((R->n == 0) ? (npc != first) : (npc <= R->ins[R->n - 1].pc)) ||
+      writeregs(i, &dummy) < 0 ||
+      (GET_OPCODE(i) == OP_FORLOOP && npc != R->loop)) {
+    stoprecord(L);  /* cannot trace this loop */
+    return 0;
+  }
+  ti = &R->ins[R->n++];
+  ti->pc = npc;
+  ti->res = NOTAG;
+  for (s = 0; s < 3; s++) {
+    if (GET_OPCODE(i) == OP_FORLOOP)
+      r = GETARG_A(i) + s;
+    else if (s == 0)
+      r = GETARG_A(i);
+    else if (getOpMode(GET_OPCODE(i)) != iABC)
+      r = -1;  /* no other register operands */
+    else
+      r = (s == 1) ? GETARG_B(i) : GETARG_C(i);
+    ti->tag[s] = (0 <= r && r < p->maxstacksize) ? rawtt(s2v(base + r))
+                                                 : NOTAG;
+  }
+  if (npc == R->loop) {  /* got back to the FORLOOP? */
+    newtrace(L, R);
+    stoprecord(L);
+    return 0;
+  }
+  return 1;
+}
+
+/* }================================================================== */
+
+
+/*
+** Run the native code of the fn running in 'ci' from instruction
+** 'pc'. Return the index of the instruction where the interpreter must
+** continue.
+*/
+int vmkJ_run (vmk_State *L, CallInfo *ci, StkId base, int pc) {
+  LClosure *cl = ci_func(ci);
+  Proto *p = cl->p;
+  JitCode *jc = p->jit;
+  JitFunction f = (JitFunction)(void *)jc->mcode;
+  pc = f(base, p->k, cl->upvals, &ci->u.l.trap, jc->mcode + jc->entry[pc]);
+  if (l_unlikely(pc < 0)) {  /* a loop asks to be recorded? */
+    int loop = -(pc + 1);
+    pc = loop + 1 - GETARG_Bx(p->code[loop]);  /* continue in its body */
+    startrecord(L, ci, p, loop);
+  }
+  return pc;
+}
+
+
+void vmkJ_free (vmk_State *L, Proto *p) {
+  JitTrace *tr = p->traces;
+  if (p->jit != NULL)
+    freecode(p);
+  while (tr != NULL) {
+    JitTrace *next = tr->next;
+    vmkM_freemem(L, tr, tracesize(tr->n));
+    tr = next;
+  }
+  p->traces = NULL;
+  if (G(L)->jitrec != NULL && G(L)->jitrec->p == p)
+    G(L)->jitrec->p = NULL;  /* its fn is gone; record nothing else */
+}
+
+
+/* memory used by the traces of 'p' (counted as part of the prototype) */
+size_t vmkJ_size (const Proto *p) {
+  const JitTrace *tr;
+  size_t sz = 0;
+  for (tr = p->traces; tr != NULL; tr = tr->next)
+    sz += tracesize(tr->n);
+  return sz;
+}
+
+
+void vmkJ_close (vmk_State *L) {
+  if (G(L)->jitrec != NULL)
+    stoprecord(L);
+}
+
+#endif
@@ -0,0 +1,37 @@
+/*
+** $Id: ljit.h $
+** Baseline JIT compiler
+** See Copyright Notice in vmk.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+#if defined(VMK_USE_JIT)
+
+/* number of calls plus loop iterations that make a fn hot */
+#if !defined(VMKJ_HOTCOUNT)
+#define VMKJ_HOTCOUNT	50
+#endif
+
+/* iterations of a loop in native code that make it worth a trace */
+#if !defined(VMKJ_TRACEHOT)
+#define VMKJ_TRACEHOT	100
+#endif
+
+
+VMKI_FUNC int vmkJ_compile (Proto *p);
+VMKI_FUNC int vmkJ_run (vmk_State *L, CallInfo *ci, StkId base, int pc);
+VMKI_FUNC int vmkJ_record (vmk_State *L, const Instruction *pc);
+VMKI_FUNC void vmkJ_free (vmk_State *L, Proto *p);
+VMKI_FUNC size_t vmkJ_size (const Proto *p);
+VMKI_FUNC void vmkJ_close (vmk_State *L);
+
+#endif
+
+#endif
@@ -277,6 +277,16 @@ typedef unsigned long l_uint32;
 #endif
 
 
+/*
+** The baseline JIT (ljit.c) is turned on with VMK_USE_JIT, and only
+** exists for x86-64 with Posix memory mapping.
+*/
+#if defined(VMK_USE_JIT) && \
+    !(defined(__x86_64__) && defined(VMK_USE_POSIX))
+#undef VMK_USE_JIT
+#endif
+
+
 /*
 ** {==================================================================
 ** "Abstraction Layer" for basic report of messages and errors
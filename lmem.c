@@ -47,6 +47,18 @@
 #define callfrealloc(g,block,os,ns)    ((*g->frealloc)(g->ud, block, os, ns))
 
 
+/*
+** With a background sweeper, blocks being freed go to it (which may
+** refuse some of them).
+*/
+#if defined(VMK_USE_BGSWEEP)
+#define deferfree(g,block,os)  \
+	((g)->sweeper != NULL && vmkC_deferfree(g, block, os))
+#else
+#define deferfree(g,block,os)	0
+#endif
+
+
 /*
 ** When an allocation fails, it will try again after an emergency
 ** collection, except when it cannot run a collection.  The GC should
@@ -150,7 +162,8 @@ l_noret vmkM_toobig (vmk_State *L) {
 void vmkM_free_ (vmk_State *L, void *block, size_t osize) {
   global_State *g = G(L);
   vmk_assert((osize == 0) == (block == NULL));
-  callfrealloc(g, block, osize, 0);
+  if (!deferfree(g, block, osize))
+    callfrealloc(g, block, osize, 0);
   g->GCdebt += cast(l_mem, osize);
 }
 
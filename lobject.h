@@ -563,6 +563,19 @@ typedef struct LocVar {
 } LocVar;
 
 
+/*
+** Description of a call inlined by the optimizer (used for debug
+** information): instructions in [startpc, endpc) run the code of fn
+** 'name', called at line 'line'.
+*/
+typedef struct InlineInfo {
+  TString *name;
+  int startpc;
+  int endpc;
+  int line;
+} InlineInfo;
+
+
 /*
 ** Associates the absolute line source for a given instruction ('pc').
 ** The array 'lineinfo' gives, for each instruction, the difference in
@@ -600,18 +613,30 @@ typedef struct Proto {
   int sizelineinfo;
   int sizep;  /* size of 'p' */
   int sizelocvars;
+  int sizeinlines;  /* size of 'inlines' */
   int sizeabslineinfo;  /* size of 'abslineinfo' */
   int linedefined;  /* debug information  */
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the fn */
   Instruction *code;  /* opcodes */
+  unsigned int *icache;  /* inline caches for field accesses (see lvm.c) */
   struct Proto **p;  /* functions defined inside the fn */
   Upvaldesc *upvalues;  /* upvalue information */
   ls_byte *lineinfo;  /* information about source lines (debug information) */
   AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about lck variables (debug information) */
+  InlineInfo *inlines;  /* inlined calls (debug information) */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
+#if defined(VMK_USE_JIT)
+  int jitcount;  /* calls and loop iterations before compilation */
+  struct JitCode *jit;  /* native code (see ljit.c) */
+  struct JitTrace *traces;  /* recorded traces of its loops */
+#endif
+#if defined(VMK_USE_OPSTATS)
+  lu_mem *opcount;  /* executions of each instruction (see 'vmkV_opcount') */
+  unsigned int opepoch;  /* profiler epoch of the counts in 'opcount' */
+#endif
 } Proto;
 
 /* }================================================================== */
@@ -763,6 +788,20 @@ typedef union Node {
 
 
 
+/*
+** Shapes describe the fields of tables with only a few keys, all of
+** them short strings, in the order they were inserted (see ltable.c).
+*/
+typedef struct Shape {
+  struct Shape *parent;  /* shape without the last key */
+  struct Shape *hnext;  /* chain in the cache of shapes */
+  size_t nref;  /* number of tables and shapes using this one */
+  unsigned int hash;  /* position in the cache of shapes */
+  lu_byte nkeys;  /* number of keys */
+  TString *keys[1];  /* keys, in slot order */
+} Shape;
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
@@ -770,6 +809,7 @@ typedef struct Table {
   unsigned int asize;  /* number of slots in 'array' array */
   Value *array;  /* array part */
   Node *node;
+  TValue *slots;  /* values of fields described by a shape, or NULL */
   struct Table *metatable;
   GCObject *gclist;
 } Table;
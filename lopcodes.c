@@ -17,6 +17,15 @@
     (((mm) << 7) | ((ot) << 6) | ((it) << 5) | ((t) << 4) | ((a) << 3) | (m))
 
 
+/*
+** By default, common pairs of instructions are fused into
+** superinstructions (see 'vmkP_fuse').
+*/
+#if !defined(VMK_USE_FUSION)
+#define VMK_USE_FUSION	1
+#endif
+
+
 /* ORDER OP */
 
 VMKI_DDEF const lu_byte vmkP_opmodes[NUM_OPCODES] = {
@@ -104,6 +113,19 @@ VMKI_DDEF const lu_byte vmkP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, 0, 0, 1, iABC)		/* OP_VARARG */
  ,opmode(0, 0, 1, 0, 1, iABC)		/* OP_VARARGPREP */
  ,opmode(0, 0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDINT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDFLT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBINT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBFLT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULINT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULFLT */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTINT */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTFLT */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEINT */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEFLT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABUPF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SELFCALL */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MOVECALL */
 };
 
 
@@ -136,3 +158,51 @@ int vmkP_isIT (Instruction i) {
   }
 }
 
+
+/*
+** Return the generic form of an instruction that may have been
+** quickened by the interpreter or fused into a superinstruction.
+*/
+Instruction vmkP_unquicken (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_ADDINT: case OP_ADDFLT: SET_OPCODE(i, OP_ADD); break;
+    case OP_SUBINT: case OP_SUBFLT: SET_OPCODE(i, OP_SUB); break;
+    case OP_MULINT: case OP_MULFLT: SET_OPCODE(i, OP_MUL); break;
+    case OP_LTINT: case OP_LTFLT: SET_OPCODE(i, OP_LT); break;
+    case OP_LEINT: case OP_LEFLT: SET_OPCODE(i, OP_LE); break;
+    case OP_GETTABUPF: SET_OPCODE(i, OP_GETTABUP); break;
+    case OP_SELFCALL: SET_OPCODE(i, OP_SELF); break;
+    case OP_MOVECALL: SET_OPCODE(i, OP_MOVE); break;
+    default: break;
+  }
+  return i;
+}
+
+
+/*
+** Turn the first instruction of each pair that a superinstruction
+** covers into that superinstruction. The code must be complete (jumps
+** may go to any of its instructions).
+*/
+void vmkP_fuse (Instruction *code, int n) {
+#if VMK_USE_FUSION
+  int pc;
+  for (pc = 0; pc + 1 < n; pc++) {
+    OpCode next = GET_OPCODE(code[pc + 1]);
+    switch (GET_OPCODE(code[pc])) {
+      case OP_GETTABUP:  /* e.g., 'math.floor' */
+        if (next == OP_GETFIELD) SET_OPCODE(code[pc], OP_GETTABUPF);
+        break;
+      case OP_SELF:  /* 'o:m()' */
+        if (next == OP_CALL) SET_OPCODE(code[pc], OP_SELFCALL);
+        break;
+      case OP_MOVE:  /* 'f(..., x)' */
+        if (next == OP_CALL) SET_OPCODE(code[pc], OP_MOVECALL);
+        break;
+      default: break;
+    }
+  }
+#else
+  UNUSED(code); UNUSED(n);
+#endif
+}
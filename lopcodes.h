@@ -340,11 +340,28 @@ OP_VARARG,/*	A C	R[A], R[A+1], ..., R[A+C-2] = vararg		*/
 
 OP_VARARGPREP,/*A	(adjust vararg parameters)			*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/* quickened opcodes: never generated by the compiler (*) */
+OP_ADDINT,/*	A B C	R[A] := R[B] + R[C]	(integers)		*/
+OP_ADDFLT,/*	A B C	R[A] := R[B] + R[C]	(floats)		*/
+OP_SUBINT,/*	A B C	R[A] := R[B] - R[C]	(integers)		*/
+OP_SUBFLT,/*	A B C	R[A] := R[B] - R[C]	(floats)		*/
+OP_MULINT,/*	A B C	R[A] := R[B] * R[C]	(integers)		*/
+OP_MULFLT,/*	A B C	R[A] := R[B] * R[C]	(floats)		*/
+OP_LTINT,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++ (integers)	*/
+OP_LTFLT,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++ (floats)	*/
+OP_LEINT,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++ (integers)	*/
+OP_LEFLT,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++ (floats)	*/
+
+/* superinstructions: generated only by 'vmkP_fuse' (*) */
+OP_GETTABUPF,/*	A B C	OP_GETTABUP, then the OP_GETFIELD that follows	*/
+OP_SELFCALL,/*	A B C k	OP_SELF, then the OP_CALL that follows		*/
+OP_MOVECALL/*	A B	OP_MOVE, then the OP_CALL that follows		*/
 } OpCode;
 
 
-#define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
+#define NUM_OPCODES	((int)(OP_MOVECALL) + 1)
 
 
 
@@ -399,6 +416,21 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   original operand was a float. (It must be corrected in case of
   metamethods.)
 
+  (*) Quickened opcodes replace, at run time, a generic OP_ADD, OP_SUB,
+  OP_MUL, OP_LT, or OP_LE whose operands had the given numeric variant.
+  They have the same operands and properties as their generic
+  versions. When their operands have other types, they rewrite
+  themselves back to the generic opcode. Dumps and debug information
+  always see the generic opcode (see 'vmkP_unquicken').
+
+  (*) A superinstruction replaces the first instruction of a pair that
+  often runs in sequence. It has the same operands and properties as
+  that first instruction, and the second instruction stays in place:
+  after doing the work of the first one, the interpreter runs the second
+  one without a new dispatch (unless it must check hooks). So, a jump
+  can still go to the second instruction, and 'vmkP_unquicken' gives
+  back the first one.
+
 ===========================================================================*/
 
 
@@ -424,6 +456,8 @@ VMKI_DDEC(const lu_byte vmkP_opmodes[NUM_OPCODES];)
 
 VMKI_FUNC int vmkP_isOT (Instruction i);
 VMKI_FUNC int vmkP_isIT (Instruction i);
+VMKI_FUNC Instruction vmkP_unquicken (Instruction i);
+VMKI_FUNC void vmkP_fuse (Instruction *code, int n);
 
 
 #endif
@@ -96,6 +96,19 @@ static const char *const opnames[] = {
   "VARARG",
   "VARARGPREP",
   "EXTRAARG",
+  "ADDINT",
+  "ADDFLT",
+  "SUBINT",
+  "SUBFLT",
+  "MULINT",
+  "MULFLT",
+  "LTINT",
+  "LTFLT",
+  "LEINT",
+  "LEFLT",
+  "GETTABUPF",
+  "SELFCALL",
+  "MOVECALL",
   NULL
 };
 
@@ -0,0 +1,1535 @@
+/*
+** $Id: lopt.c $
+** Bytecode optimizer
+** See Copyright Notice in vmk.h
+*/
+
+#define lopt_c
+#define VMK_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "vmk.h"
+
+#include "lcode.h"
+#include "ldebug.h"
+#include "ldo.h"
+#include "llex.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lopt.h"
+#include "lparser.h"
+#include "lstate.h"
+#include "lstring.h"
+
+
+/*
+** The optimizer works on the code of a fn after the parser has
+** generated it and before 'vmkK_finish'. It repeats a few simple
+** passes while they find something to do:
+** - jumps go directly to their final targets; a jump to a return
+**   becomes a copy of that return, and a jump to the next instruction
+**   is removed ('jumps');
+** - unreachable code is removed ('reachable');
+** - reads of registers known to hold a constant along all paths are
+**   replaced by the constant itself, which also solves tests over
+**   constants ('constprop');
+** - inside a basic block, reads of a register that is a copy of
+**   another one read the original register ('copyprop');
+** - moves and loads into registers never read again are removed
+**   ('deadcode'); assignments of nil are kept, as programs use them to
+**   release values to the collector.
+** Registers captured as upvalues by a closure are left alone, as the
+** closure can change them in any call. Only 'compact' removes code,
+** keeping jumps, variable ranges, and line information consistent.
+*/
+
+
+/* maximum number of rounds of passes */
+#define MAXROUNDS	4
+
+
+/* a set of registers (registers fit in 8 bits) */
+#define NREGWORDS	((MAX_FSTACK + 32) / 32)
+
+typedef l_uint32 RegSet[NREGWORDS];
+
+#define setreg(s,r)	((s)[(r) >> 5] |= cast(l_uint32, 1) << ((r) & 31))
+#define testreg(s,r)	(((s)[(r) >> 5] >> ((r) & 31)) & 1)
+
+
+/* flags for instructions */
+#define LEADER		1  /* first instruction of a basic block */
+#define REACHED		2  /* reachable from the entry */
+#define VISITED		4  /* (leaders) block already seen by 'constprop' */
+#define REMOVE		8  /* to be removed by 'compact' */
+
+
+/* value for a register not known to be a constant */
+#define NOTCONST	(~cast(Instruction, 0))
+
+
+typedef struct OptState {
+  FuncState *fs;
+  Instruction *code;
+  RegSet *live;  /* registers live at the entry of each block */
+  Instruction *kst;  /* constants at the entry of each block */
+  int *line;  /* line of each instruction */
+  int *aux;  /* new position of each instruction (or a work list) */
+  int *bid;  /* block of each instruction */
+  int *block;  /* first instruction of each block */
+  lu_byte *flag;  /* flags of each instruction */
+  RegSet captured;  /* registers captured by closures */
+  int n;  /* number of instructions */
+  int nregs;  /* number of registers */
+  int nblocks;  /* number of basic blocks */
+} OptState;
+
+
+/*
+** Effects of an instruction over the registers
+*/
+typedef struct Effects {
+  RegSet use;  /* registers that may be read */
+  int def, edef;  /* registers surely written: [def, edef) */
+  int clob, eclob;  /* registers that may be written: [clob, eclob) */
+} Effects;
+
+
+static void userange (OptState *os, Effects *e, int from, int to) {
+  if (to > os->nregs)
+    to = os->nregs;
+  for (; from < to; from++)
+    setreg(e->use, from);
+}
+
+
+/*
+** Compute the effects of instruction 'i'. Uses are over-approximated
+** (e.g., "up to the top" is the whole frame), while definitions are
+** only the registers the instruction always writes.
+*/
+static void effects (OptState *os, Instruction i, Effects *e) {
+  int a = GETARG_A(i);
+  int top = os->nregs;
+  memset(e->use, 0, sizeof(RegSet));
+  e->def = e->edef = e->clob = e->eclob = 0;
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_GETI: case OP_GETFIELD:
+    case OP_ADDI: case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK:
+    case OP_POWK: case OP_DIVK: case OP_IDIVK: case OP_BANDK:
+    case OP_BORK: case OP_BXORK: case OP_SHRI: case OP_SHLI:
+    case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN: {
+      setreg(e->use, GETARG_B(i));
+      e->def = a; e->edef = a + 1;
+      break;
+    }
+    case OP_LOADI: case OP_LOADF: case OP_LOADK: case OP_LOADKX:
+    case OP_LOADFALSE: case OP_LFALSESKIP: case OP_LOADTRUE:
+    case OP_GETUPVAL: case OP_GETTABUP: case OP_NEWTABLE: case OP_CLOSURE: {
+      e->def = a; e->edef = a + 1;
+      break;
+    }
+    case OP_LOADNIL: {
+      e->def = a; e->edef = a + GETARG_B(i) + 1;
+      break;
+    }
+    case OP_GETTABLE:
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: {
+      setreg(e->use, GETARG_B(i));
+      setreg(e->use, GETARG_C(i));
+      e->def = a; e->edef = a + 1;
+      break;
+    }
+    case OP_SELF: {
+      setreg(e->use, GETARG_B(i));
+      e->def = a; e->edef = a + 2;
+      break;
+    }
+    case OP_SETTABUP: {
+      if (!GETARG_k(i))
+        setreg(e->use, GETARG_C(i));
+      break;
+    }
+    case OP_SETTABLE: {
+      setreg(e->use, GETARG_B(i));
+    }  /* FALLTHROUGH */
+    case OP_SETI: case OP_SETFIELD: {
+      setreg(e->use, a);
+      if (!GETARG_k(i))
+        setreg(e->use, GETARG_C(i));
+      break;
+    }
+    case OP_MMBIN: case OP_EQ: case OP_LT: case OP_LE: {
+      setreg(e->use, a);
+      setreg(e->use, GETARG_B(i));
+      break;
+    }
+    case OP_SETUPVAL: case OP_MMBINI: case OP_MMBINK: case OP_TBC:
+    case OP_EQK: case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI:
+    case OP_GEI: case OP_TEST: case OP_RETURN1: {
+      setreg(e->use, a);
+      break;
+    }
+    case OP_TESTSET: {  /* writes 'a' only if the test fails */
+      setreg(e->use, a);
+      setreg(e->use, GETARG_B(i));
+      e->clob = a; e->eclob = a + 1;
+      break;
+    }
+    case OP_CONCAT: {
+      userange(os, e, a, a + GETARG_B(i));
+      e->def = a; e->edef = a + 1;
+      e->clob = a; e->eclob = a + GETARG_B(i);
+      break;
+    }
+    case OP_CLOSE: {
+      userange(os, e, a, top);
+      break;
+    }
+    case OP_CALL: {
+      int b = GETARG_B(i);
+      int c = GETARG_C(i);
+      userange(os, e, a, (b != 0) ? a + b : top);
+      e->def = a; e->edef = (c != 0) ? a + c - 1 : a;
+      e->clob = a; e->eclob = top;
+      break;
+    }
+    case OP_TAILCALL: {
+      int b = GETARG_B(i);
+      userange(os, e, a, (b != 0) ? a + b : top);
+      break;
+    }
+    case OP_RETURN: {
+      int b = GETARG_B(i);
+      userange(os, e, a, (b != 0) ? a + b - 1 : top);
+      break;
+    }
+    case OP_FORPREP: case OP_FORLOOP: {
+      userange(os, e, a, a + 3);
+      e->clob = a; e->eclob = a + 3;
+      break;
+    }
+    case OP_TFORPREP: {  /* swaps control and closing variables */
+      userange(os, e, a, a + 4);
+      e->clob = a + 2; e->eclob = a + 4;
+      break;
+    }
+    case OP_TFORCALL: {  /* the call uses the stack from 'a + 3' */
+      userange(os, e, a, a + 4);
+      e->def = a + 3; e->edef = a + 3 + GETARG_C(i);
+      e->clob = a + 2; e->eclob = top;  /* 'a + 2' may keep a cursor */
+      break;
+    }
+    case OP_TFORLOOP: {
+      setreg(e->use, a + 3);
+      break;
+    }
+    case OP_SETLIST: {
+      int b = GETARG_vB(i);
+      userange(os, e, a, (b != 0) ? a + b + 1 : top);
+      break;
+    }
+    case OP_VARARG: {
+      int c = GETARG_C(i);
+      e->def = a; e->edef = (c != 0) ? a + c - 1 : a;
+      e->clob = a; e->eclob = top;
+      break;
+    }
+    case OP_JMP: case OP_RETURN0: case OP_VARARGPREP: case OP_EXTRAARG:
+      break;
+    default: {  /* not generated by the parser; assume the worst */
+      userange(os, e, 0, top);
+      e->clob = 0; e->eclob = top;
+      break;
+    }
+  }
+  if (e->eclob == 0) {  /* no extra writes? */
+    e->clob = e->def; e->eclob = e->edef;
+  }
+  if (e->edef > top) e->edef = top;
+  if (e->eclob > top) e->eclob = top;
+}
+
+
+/*
+** Fill 's' with the possible successors of instruction 'pc' and
+** return their number. Some structural successors are included even
+** when they cannot really follow 'pc' (the end of a numeric loop, the
+** instruction after OP_LFALSESKIP) so that they are never separated
+** from their companions.
+*/
+static int successors (OptState *os, int pc, int *s) {
+  Instruction i = os->code[pc];
+  int ns = 0;
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: {
+      s[ns++] = pc + 1 + GETARG_sJ(i);
+      break;
+    }
+    case OP_RETURN: case OP_RETURN0: case OP_RETURN1:
+      break;
+    case OP_FORPREP: {  /* loop body, its OP_FORLOOP, or after the loop */
+      s[ns++] = pc + 1;
+      s[ns++] = pc + GETARG_Bx(i) + 1;
+      s[ns++] = pc + GETARG_Bx(i) + 2;
+      break;
+    }
+    case OP_FORLOOP: case OP_TFORLOOP: {
+      s[ns++] = pc + 1;
+      s[ns++] = pc + 1 - GETARG_Bx(i);
+      break;
+    }
+    case OP_TFORPREP: {  /* goes to its OP_TFORCALL */
+      s[ns++] = pc + 1 + GETARG_Bx(i);
+      break;
+    }
+    default: {
+      s[ns++] = pc + 1;
+      if (testTMode(GET_OPCODE(i)) || GET_OPCODE(i) == OP_LFALSESKIP)
+        s[ns++] = pc + 2;
+      break;
+    }
+  }
+  return ns;
+}
+
+
+/*
+** Instruction 'pc' cannot be removed or replaced if it follows an
+** instruction that may skip it.
+*/
+static int pinned (OptState *os, int pc) {
+  OpCode op;
+  if (pc == 0)
+    return 0;
+  op = GET_OPCODE(os->code[pc - 1]);
+  return (testTMode(op) || op == OP_LFALSESKIP);
+}
+
+
+/*
+** Correct the offset of jump 'i', from position 'pc', for the code
+** moved to the positions in 'newpc'.
+*/
+static void movejump (Instruction *i, int pc, const int *newpc) {
+  switch (GET_OPCODE(*i)) {
+    case OP_JMP: {
+      int target = pc + 1 + GETARG_sJ(*i);
+      SETARG_sJ(*i, newpc[target] - newpc[pc] - 1);
+      break;
+    }
+    case OP_FORPREP: case OP_TFORPREP: {
+      int target = pc + 1 + GETARG_Bx(*i);
+      SETARG_Bx(*i, newpc[target] - newpc[pc] - 1);
+      break;
+    }
+    case OP_FORLOOP: case OP_TFORLOOP: {
+      int target = pc + 1 - GETARG_Bx(*i);
+      SETARG_Bx(*i, newpc[pc] + 1 - newpc[target]);
+      break;
+    }
+    default: break;
+  }
+}
+
+
+/* correct the ranges of the 'nvars' variables and of inlined calls */
+static void moveranges (Proto *f, int nvars, const int *newpc) {
+  int v;
+  for (v = 0; v < nvars; v++) {
+    f->locvars[v].startpc = newpc[f->locvars[v].startpc];
+    f->locvars[v].endpc = newpc[f->locvars[v].endpc];
+  }
+  for (v = 0; v < f->sizeinlines; v++) {
+    f->inlines[v].startpc = newpc[f->inlines[v].startpc];
+    f->inlines[v].endpc = newpc[f->inlines[v].endpc];
+  }
+}
+
+
+/*
+** Remove all instructions marked REMOVE, correcting jumps, ranges of
+** local variables and of inlined calls, and line information. Returns
+** whether it removed something.
+*/
+static int compact (OptState *os) {
+  FuncState *fs = os->fs;
+  int *newpc = os->aux;
+  int pc;
+  int n = 0;
+  for (pc = 0; pc < os->n; pc++) {
+    newpc[pc] = n;
+    if (!(os->flag[pc] & REMOVE))
+      n++;
+  }
+  newpc[os->n] = n;
+  if (n == os->n)  /* nothing to remove? */
+    return 0;
+  for (pc = 0; pc < os->n; pc++) {
+    Instruction *i = &os->code[pc];
+    if (os->flag[pc] & REMOVE)
+      continue;
+    movejump(i, pc, newpc);
+    os->code[newpc[pc]] = *i;
+    os->line[newpc[pc]] = os->line[pc];
+  }
+  moveranges(fs->f, fs->ndebugvars, newpc);
+  os->n = n;
+  memset(os->flag, 0, cast_sizet(n));
+  return 1;
+}
+
+
+/*
+** {======================================================
+** Jumps and reachability
+** =======================================================
+*/
+
+/* final target of jump 'pc' (skipping jumps to jumps) */
+static int threadjump (OptState *os, int pc) {
+  int count;
+  for (count = 0; count < 100; count++) {  /* avoid infinite loops */
+    Instruction i = os->code[pc];
+    if (GET_OPCODE(i) != OP_JMP)
+      break;
+    pc += GETARG_sJ(i) + 1;
+  }
+  return pc;
+}
+
+
+static int jumps (OptState *os) {
+  int pc;
+  int changed = 0;
+  for (pc = 0; pc < os->n; pc++) {
+    Instruction *i = &os->code[pc];
+    if (GET_OPCODE(*i) == OP_JMP) {
+      int target = threadjump(os, pc);
+      OpCode op = GET_OPCODE(os->code[target]);
+      if (target != pc + 1 + GETARG_sJ(*i)) {
+        SETARG_sJ(*i, target - pc - 1);
+        changed = 1;
+      }
+      if (pinned(os, pc))
+        continue;  /* conditional jump */
+      if (op == OP_RETURN0 || op == OP_RETURN1) {
+        *i = os->code[target];  /* do the return here */
+        changed = 1;
+      }
+      else if (target == pc + 1)
+        os->flag[pc] |= REMOVE;
+    }
+  }
+  return compact(os) || changed;
+}
+
+
+static int reachable (OptState *os) {
+  int *work = os->aux;
+  int nw = 0;
+  int pc;
+  memset(os->flag, 0, cast_sizet(os->n));
+  os->flag[0] = REACHED;
+  work[nw++] = 0;
+  while (nw > 0) {
+    int s[3];
+    int ns = successors(os, work[--nw], s);
+    while (ns-- > 0) {
+      if (s[ns] < os->n && !(os->flag[s[ns]] & REACHED)) {
+        os->flag[s[ns]] |= REACHED;
+        work[nw++] = s[ns];
+      }
+    }
+  }
+  for (pc = 0; pc < os->n; pc++) {
+    if (!(os->flag[pc] & REACHED))
+      os->flag[pc] |= REMOVE;
+  }
+  return compact(os);
+}
+
+
+static void buildblocks (OptState *os) {
+  int pc;
+  int nb = 0;
+  memset(os->flag, 0, cast_sizet(os->n));
+  os->flag[0] = LEADER;
+  for (pc = 0; pc < os->n; pc++) {
+    int s[3];
+    int ns = successors(os, pc, s);
+    if (ns != 1 || s[0] != pc + 1) {  /* not a plain instruction? */
+      while (ns-- > 0) {
+        if (s[ns] < os->n)
+          os->flag[s[ns]] |= LEADER;
+      }
+      if (pc + 1 < os->n)
+        os->flag[pc + 1] |= LEADER;
+    }
+  }
+  for (pc = 0; pc < os->n; pc++) {
+    if (os->flag[pc] & LEADER)
+      os->block[nb++] = pc;
+    os->bid[pc] = nb - 1;
+  }
+  os->block[nb] = os->n;
+  os->nblocks = nb;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Constant propagation
+** =======================================================
+*/
+
+/* return 'i' as a load into register 0, if it loads a constant */
+static Instruction constload (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_LOADI: case OP_LOADF: case OP_LOADK:
+    case OP_LOADFALSE: case OP_LOADTRUE: {
+      SETARG_A(i, 0);
+      return i;
+    }
+    default: return NOTCONST;
+  }
+}
+
+
+static int istrue (Proto *f, Instruction v) {
+  switch (GET_OPCODE(v)) {
+    case OP_LOADFALSE: case OP_LOADNIL: return 0;
+    case OP_LOADK: return !l_isfalse(&f->k[GETARG_Bx(v)]);
+    default: return 1;
+  }
+}
+
+
+/* update constants in 'kst' after instruction 'i' */
+static void transfer (OptState *os, Instruction i, Instruction *kst) {
+  Effects e;
+  Instruction v = (GET_OPCODE(i) == OP_MOVE) ? kst[GETARG_B(i)]
+                                             : constload(i);
+  int r;
+  effects(os, i, &e);
+  for (r = e.clob; r < e.eclob; r++)
+    kst[r] = NOTCONST;
+  if (GET_OPCODE(i) == OP_LOADNIL) {
+    for (r = e.def; r < e.edef; r++) {
+      if (!testreg(os->captured, r))
+        kst[r] = CREATE_ABCk(OP_LOADNIL, 0, 0, 0, 0);
+    }
+  }
+  else if (v != NOTCONST && !testreg(os->captured, GETARG_A(i)))
+    kst[GETARG_A(i)] = v;
+}
+
+
+/*
+** Check whether a constant 'v' can be the key of OP_GETI/OP_SETI
+** (returns 1) or OP_GETFIELD/OP_SETFIELD (returns 2); its argument
+** goes to '*arg'.
+*/
+static int constkey (Proto *f, Instruction v, int *arg) {
+  if (v == NOTCONST)
+    return 0;
+  else if (GET_OPCODE(v) == OP_LOADI) {
+    int n = GETARG_sBx(v);
+    if (0 <= n && n <= MAXARG_C) {
+      *arg = n;
+      return 1;
+    }
+  }
+  else if (GET_OPCODE(v) == OP_LOADK) {
+    int k = GETARG_Bx(v);
+    if (k <= MAXARG_B && ttisshrstring(&f->k[k])) {
+      *arg = k;
+      return 2;
+    }
+  }
+  return 0;
+}
+
+
+/* use a constant from 'k' as the value stored by 'i', if possible */
+static int constvalue (Instruction *i, const Instruction *kst) {
+  Instruction v = kst[GETARG_C(*i)];
+  if (!GETARG_k(*i) && v != NOTCONST && GET_OPCODE(v) == OP_LOADK &&
+      GETARG_Bx(v) <= MAXINDEXRK) {
+    SETARG_C(*i, GETARG_Bx(v));
+    SETARG_k(*i, 1);
+    return 1;
+  }
+  return 0;
+}
+
+
+static Instruction jumpinstr (int offset) {
+  Instruction i = CREATE_sJ(OP_JMP, OFFSET_sJ, 0);
+  SETARG_sJ(i, offset);
+  return i;
+}
+
+
+/* rewrite instruction 'pc' given the constants in 'kst' */
+static int rewrite (OptState *os, int pc, const Instruction *kst) {
+  Proto *f = os->fs->f;
+  Instruction *i = &os->code[pc];
+  Instruction v;
+  int arg;
+  switch (GET_OPCODE(*i)) {
+    case OP_MOVE: {
+      v = kst[GETARG_B(*i)];
+      if (v == NOTCONST)
+        return 0;
+      SETARG_A(v, GETARG_A(*i));
+      *i = v;
+      return 1;
+    }
+    case OP_TEST: {  /* skip next jump or go to it */
+      v = kst[GETARG_A(*i)];
+      if (v == NOTCONST)
+        return 0;
+      *i = jumpinstr(istrue(f, v) != GETARG_k(*i));
+      return 1;
+    }
+    case OP_TESTSET: {
+      v = kst[GETARG_B(*i)];
+      if (v == NOTCONST)
+        return 0;
+      if (istrue(f, v) != GETARG_k(*i))  /* value is false? */
+        *i = jumpinstr(1);  /* skip next jump */
+      else {  /* do the assignment; next jump is always taken */
+        SETARG_A(v, GETARG_A(*i));
+        *i = v;
+      }
+      return 1;
+    }
+    case OP_GETTABLE: {
+      switch (constkey(f, kst[GETARG_C(*i)], &arg)) {
+        case 1: SET_OPCODE(*i, OP_GETI); break;
+        case 2: SET_OPCODE(*i, OP_GETFIELD); break;
+        default: return 0;
+      }
+      SETARG_C(*i, arg);
+      return 1;
+    }
+    case OP_SETTABLE: {
+      int changed = constvalue(i, kst);
+      switch (constkey(f, kst[GETARG_B(*i)], &arg)) {
+        case 1: SET_OPCODE(*i, OP_SETI); break;
+        case 2: SET_OPCODE(*i, OP_SETFIELD); break;
+        default: return changed;
+      }
+      SETARG_B(*i, arg);
+      return 1;
+    }
+    case OP_SETTABUP: case OP_SETI: case OP_SETFIELD:
+      return constvalue(i, kst);
+    default:
+      return 0;
+  }
+}
+
+
+/*
+** Forward data flow over the basic blocks: a register holds a constant
+** at the entry of a block if it holds that same constant at the end of
+** all its predecessors seen so far. Then, a second pass rewrites the
+** code with that information.
+*/
+static int constprop (OptState *os) {
+  Instruction cur[MAX_FSTACK];
+  size_t regsize = cast_sizet(os->nregs) * sizeof(Instruction);
+  int b, pc;
+  int changed;
+  for (pc = 0; pc < os->nregs; pc++)
+    os->kst[pc] = NOTCONST;  /* nothing known at the entry */
+  os->flag[0] |= VISITED;
+  do {
+    changed = 0;
+    for (b = 0; b < os->nblocks; b++) {
+      int s[3];
+      int ns;
+      if (!(os->flag[os->block[b]] & VISITED))
+        continue;
+      memcpy(cur, os->kst + b * os->nregs, regsize);
+      for (pc = os->block[b]; pc < os->block[b + 1]; pc++)
+        transfer(os, os->code[pc], cur);
+      ns = successors(os, os->block[b + 1] - 1, s);
+      while (ns-- > 0) {
+        int sb;
+        Instruction *in;
+        if (s[ns] >= os->n)
+          continue;
+        sb = os->bid[s[ns]];
+        in = os->kst + sb * os->nregs;
+        if (!(os->flag[os->block[sb]] & VISITED)) {
+          os->flag[os->block[sb]] |= VISITED;
+          memcpy(in, cur, regsize);
+          changed = 1;
+        }
+        else {
+          int r;
+          for (r = 0; r < os->nregs; r++) {
+            if (in[r] != cur[r] && in[r] != NOTCONST) {
+              in[r] = NOTCONST;
+              changed = 1;
+            }
+          }
+        }
+      }
+    }
+  } while (changed);
+  for (b = 0; b < os->nblocks; b++) {
+    if (!(os->flag[os->block[b]] & VISITED))
+      continue;
+    memcpy(cur, os->kst + b * os->nregs, regsize);
+    for (pc = os->block[b]; pc < os->block[b + 1]; pc++) {
+      changed |= rewrite(os, pc, cur);
+      transfer(os, os->code[pc], cur);
+    }
+  }
+  return changed;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Copy propagation
+** =======================================================
+*/
+
+#define usecopy(i,get,set,copy) \
+  { int r_ = get(*(i)); if (copy[r_] >= 0) { set(*(i), copy[r_]); ch = 1; } }
+
+
+/* make instruction 'i' read original registers instead of copies */
+static int readcopies (Instruction *i, const short *copy) {
+  int ch = 0;
+  switch (GET_OPCODE(*i)) {
+    case OP_SETTABLE:
+      usecopy(i, GETARG_B, SETARG_B, copy);
+      /* FALLTHROUGH */
+    case OP_SETI: case OP_SETFIELD:
+      usecopy(i, GETARG_A, SETARG_A, copy);
+      /* FALLTHROUGH */
+    case OP_SETTABUP: {
+      if (!GETARG_k(*i))
+        usecopy(i, GETARG_C, SETARG_C, copy);
+      break;
+    }
+    case OP_GETTABLE:
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR:
+      usecopy(i, GETARG_C, SETARG_C, copy);
+      /* FALLTHROUGH */
+    case OP_MOVE: case OP_GETI: case OP_GETFIELD: case OP_SELF:
+    case OP_ADDI: case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK:
+    case OP_POWK: case OP_DIVK: case OP_IDIVK: case OP_BANDK:
+    case OP_BORK: case OP_BXORK: case OP_SHRI: case OP_SHLI:
+    case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN: case OP_TESTSET: {
+      usecopy(i, GETARG_B, SETARG_B, copy);
+      break;
+    }
+    case OP_MMBIN: case OP_EQ: case OP_LT: case OP_LE:
+      usecopy(i, GETARG_B, SETARG_B, copy);
+      /* FALLTHROUGH */
+    case OP_SETUPVAL: case OP_MMBINI: case OP_MMBINK:
+    case OP_EQK: case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI:
+    case OP_GEI: case OP_TEST: case OP_RETURN1: {
+      usecopy(i, GETARG_A, SETARG_A, copy);
+      break;
+    }
+    default: break;
+  }
+  return ch;
+}
+
+
+static int copyprop (OptState *os) {
+  short copy[MAX_FSTACK];  /* register copied into each one (or -1) */
+  int b, pc, r;
+  int changed = 0;
+  for (b = 0; b < os->nblocks; b++) {
+    for (r = 0; r < os->nregs; r++)
+      copy[r] = -1;
+    for (pc = os->block[b]; pc < os->block[b + 1]; pc++) {
+      Instruction *i = &os->code[pc];
+      Effects e;
+      changed |= readcopies(i, copy);
+      effects(os, *i, &e);
+      for (r = 0; r < os->nregs; r++) {  /* forget changed registers */
+        if ((e.clob <= r && r < e.eclob) ||
+            (e.clob <= copy[r] && copy[r] < e.eclob))
+          copy[r] = -1;
+      }
+      if (GET_OPCODE(*i) == OP_MOVE) {
+        int a = GETARG_A(*i);
+        int src = GETARG_B(*i);
+        if (a != src && !testreg(os->captured, a) &&
+                        !testreg(os->captured, src))
+          copy[a] = cast(short, src);
+      }
+    }
+  }
+  return changed;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Dead code
+** =======================================================
+*/
+
+/* registers live at the end of block 'b' */
+static void liveout (OptState *os, int b, RegSet live) {
+  int s[3];
+  int ns = successors(os, os->block[b + 1] - 1, s);
+  memset(live, 0, sizeof(RegSet));
+  while (ns-- > 0) {
+    if (s[ns] < os->n) {
+      int w;
+      for (w = 0; w < NREGWORDS; w++)
+        live[w] |= os->live[os->bid[s[ns]]][w];
+    }
+  }
+}
+
+
+/* registers live before an instruction with effects 'e' */
+static void livebefore (const Effects *e, RegSet live) {
+  int r, w;
+  for (r = e->def; r < e->edef; r++)
+    live[r >> 5] &= ~(cast(l_uint32, 1) << (r & 31));
+  for (w = 0; w < NREGWORDS; w++)
+    live[w] |= e->use[w];
+}
+
+
+/*
+** Check whether register 'r' holds, at instruction 'pc', a local
+** variable declared before it. (Active variables occupy the first
+** registers, in the order of 'locvars'.) Internal variables, whose
+** names start with '(', do not count.
+*/
+static int isvarreg (OptState *os, int pc, int r) {
+  Proto *f = os->fs->f;
+  int v;
+  int reg = 0;
+  for (v = 0; v < os->fs->ndebugvars && f->locvars[v].startpc <= pc; v++) {
+    if (pc < f->locvars[v].endpc) {  /* is variable active? */
+      if (reg == r)
+        return (getstr(f->locvars[v].varname)[0] != '(');
+      reg++;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Check whether instruction 'pc' is useless. An assignment to a
+** variable is kept even if the new value is never read, as removing it
+** would keep alive the old value.
+*/
+static int useless (OptState *os, int pc, const Effects *e,
+                                          const RegSet live) {
+  Instruction i = os->code[pc];
+  int r;
+  if (pinned(os, pc))
+    return 0;
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: {
+      if (GETARG_A(i) == GETARG_B(i))
+        return 1;  /* a no-op */
+      break;
+    }
+    case OP_LOADI: case OP_LOADF: case OP_LOADK: case OP_LOADFALSE:
+    case OP_LOADTRUE: case OP_GETUPVAL:
+      break;
+    default:  /* may have other effects (OP_LOADNIL releases values) */
+      return 0;
+  }
+  if (isvarreg(os, pc, GETARG_A(i)))
+    return 0;
+  for (r = e->def; r < e->edef; r++) {
+    if (testreg(live, r) || testreg(os->captured, r))
+      return 0;
+  }
+  return 1;
+}
+
+
+static int deadcode (OptState *os) {
+  RegSet live;
+  int b, pc, w;
+  int changed;
+  memset(os->live, 0, cast_sizet(os->nblocks) * sizeof(RegSet));
+  do {  /* backward data flow for live registers */
+    changed = 0;
+    for (b = os->nblocks - 1; b >= 0; b--) {
+      liveout(os, b, live);
+      for (pc = os->block[b + 1] - 1; pc >= os->block[b]; pc--) {
+        Effects e;
+        effects(os, os->code[pc], &e);
+        livebefore(&e, live);
+      }
+      for (w = 0; w < NREGWORDS; w++) {
+        if (live[w] & ~os->live[b][w]) {
+          os->live[b][w] |= live[w];
+          changed = 1;
+        }
+      }
+    }
+  } while (changed);
+  for (b = 0; b < os->nblocks; b++) {
+    liveout(os, b, live);
+    for (pc = os->block[b + 1] - 1; pc >= os->block[b]; pc--) {
+      Effects e;
+      effects(os, os->code[pc], &e);
+      if (useless(os, pc, &e, live))
+        os->flag[pc] |= REMOVE;
+      else
+        livebefore(&e, live);
+    }
+  }
+  return compact(os);
+}
+
+/* }====================================================== */
+
+
+/* get the line of each instruction of the fn being optimized */
+static void getlines (FuncState *fs, int *lines) {
+  Proto *f = fs->f;
+  int line = f->linedefined;
+  int nabs = 0;
+  int pc;
+  for (pc = 0; pc < fs->pc; pc++) {
+    if (f->lineinfo[pc] != ABSLINEINFO)
+      line += f->lineinfo[pc];
+    else {
+      vmk_assert(nabs < fs->nabslineinfo && f->abslineinfo[nabs].pc == pc);
+      line = f->abslineinfo[nabs++].line;
+    }
+    lines[pc] = line;
+  }
+}
+
+
+static void getcaptured (OptState *os) {
+  Proto *f = os->fs->f;
+  int pc, u;
+  memset(os->captured, 0, sizeof(RegSet));
+  for (pc = 0; pc < os->n; pc++) {
+    if (GET_OPCODE(os->code[pc]) == OP_CLOSURE) {
+      Proto *p = f->p[GETARG_Bx(os->code[pc])];
+      for (u = 0; u < p->sizeupvalues; u++) {
+        if (p->upvalues[u].instack)
+          setreg(os->captured, p->upvalues[u].idx);
+      }
+    }
+  }
+}
+
+
+/*
+** {======================================================
+** Inlining
+** =======================================================
+*/
+
+/*
+** A call to a 'lck fn' that is never assigned, while the fn is still
+** in its variable's register 'r', is a sequence "OP_MOVE A r; <code
+** for the arguments>; OP_CALL A B C" inside a basic block. When the fn
+** is small, that call is replaced by a copy of its code: its registers
+** move up to start at the first argument, its upvalues become the
+** caller's registers or upvalues they come from, its constants are
+** added to the caller's ones, and each return moves the results to the
+** registers of the call and jumps to the end of the copy. Functions that
+** are vararg, define other functions, use to-be-closed variables, or
+** access their own variable (recursive ones) are not inlined. The copy
+** keeps the lines and the variables of the inlined fn, and the range of
+** each copy is kept in the caller ('inlines') so that 'vmk_getinfo' and
+** tracebacks can still name it.
+*/
+
+
+/* the code may grow to this many times its size (plus a small copy) */
+#define MAXGROWTH	4
+
+
+typedef struct Splice {
+  FuncState *fs;
+  Proto *p;  /* fn being inlined */
+  int *kmap;  /* index in the caller of each constant of 'p' (or -1) */
+  int a;  /* register of the call */
+  int nres;  /* number of results wanted by the call */
+  Instruction *out;  /* the copy (NULL when only computing its size) */
+  int *line;  /* line of each instruction in the copy */
+  int n;  /* size of the copy */
+  int nexit;  /* number of jumps to the end of the copy */
+  int exit[VMKI_MAXINLINE];  /* positions of these jumps */
+  int pos[VMKI_MAXINLINE + 1];  /* position in the copy of each instruction */
+} Splice;
+
+
+static void emit (Splice *sp, Instruction i, int line) {
+  if (sp->out != NULL) {
+    sp->out[sp->n] = i;
+    sp->line[sp->n] = line;
+  }
+  sp->n++;
+}
+
+
+/* index in the caller of constant 'k' (-1 if it is above 'limit') */
+static int kindex (Splice *sp, int k, int limit) {
+  if (sp->kmap[k] < 0)
+    sp->kmap[k] = vmkK_constant(sp->fs, &sp->p->k[k]);
+  return (sp->kmap[k] <= limit) ? sp->kmap[k] : -1;
+}
+
+
+/* correct an RK operand in 'C' */
+static int rkvalue (Splice *sp, Instruction *i, int base) {
+  if (GETARG_k(*i)) {
+    int k = kindex(sp, GETARG_C(*i), MAXINDEXRK);
+    if (k < 0)
+      return 0;
+    SETARG_C(*i, k);
+  }
+  else
+    SETARG_C(*i, GETARG_C(*i) + base);
+  return 1;
+}
+
+
+/* return the 'nret' values in 'R[r]...' and leave the copy */
+static void leave (Splice *sp, int r, int nret, int line) {
+  int i;
+  for (i = 0; i < sp->nres && i < nret; i++)  /* 'a + i' < 'r + i' */
+    emit(sp, CREATE_ABCk(OP_MOVE, sp->a + i, r + i, 0, 0), line);
+  if (i < sp->nres)  /* missing results are nil */
+    emit(sp, CREATE_ABCk(OP_LOADNIL, sp->a + i, sp->nres - i - 1, 0, 0),
+             line);
+  sp->exit[sp->nexit++] = sp->n;
+  emit(sp, jumpinstr(0), line);  /* offset set by 'splice' */
+}
+
+
+/*
+** Copy instruction 'pc' of the inlined fn. Returns 0 if that is not
+** possible.
+*/
+static int copyinstr (Splice *sp, int pc) {
+  Proto *p = sp->p;
+  Instruction i = vmkP_unquicken(p->code[pc]);
+  OpCode op = GET_OPCODE(i);
+  int base = sp->a + 1;
+  int line = vmkG_getfuncline(p, pc);
+  int k;
+  if (op != OP_SETTABUP && op != OP_JMP && op != OP_EXTRAARG)
+    SETARG_A(i, GETARG_A(i) + base);  /* 'A' is a register */
+  switch (op) {
+    case OP_LOADI: case OP_LOADF: case OP_LOADKX: case OP_LOADFALSE:
+    case OP_LFALSESKIP: case OP_LOADTRUE: case OP_LOADNIL: case OP_NEWTABLE:
+    case OP_CONCAT: case OP_TEST: case OP_EQI: case OP_LTI: case OP_LEI:
+    case OP_GTI: case OP_GEI: case OP_MMBINI: case OP_SETLIST: case OP_CALL:
+    case OP_FORPREP: case OP_FORLOOP: case OP_JMP:
+      break;  /* jumps are corrected by 'splice' */
+    case OP_MOVE: case OP_GETI: case OP_ADDI: case OP_SHRI: case OP_SHLI:
+    case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN: case OP_TESTSET:
+    case OP_MMBIN: case OP_EQ: case OP_LT: case OP_LE: {
+      SETARG_B(i, GETARG_B(i) + base);
+      break;
+    }
+    case OP_GETTABLE:
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: {
+      SETARG_B(i, GETARG_B(i) + base);
+      SETARG_C(i, GETARG_C(i) + base);
+      break;
+    }
+    case OP_GETFIELD: case OP_SELF:
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK: case OP_POWK:
+    case OP_DIVK: case OP_IDIVK: case OP_BANDK: case OP_BORK: case OP_BXORK: {
+      SETARG_B(i, GETARG_B(i) + base);
+      if ((k = kindex(sp, GETARG_C(i), MAXARG_C)) < 0)
+        return 0;
+      SETARG_C(i, k);
+      break;
+    }
+    case OP_LOADK: {
+      if ((k = kindex(sp, GETARG_Bx(i), MAXARG_Bx)) < 0)
+        return 0;
+      SETARG_Bx(i, k);
+      break;
+    }
+    case OP_EXTRAARG: {
+      if (GET_OPCODE(p->code[pc - 1]) == OP_LOADKX) {
+        if ((k = kindex(sp, GETARG_Ax(i), MAXARG_Ax)) < 0)
+          return 0;
+        SETARG_Ax(i, k);
+      }
+      break;
+    }
+    case OP_MMBINK: case OP_EQK: {
+      if ((k = kindex(sp, GETARG_B(i), MAXARG_B)) < 0)
+        return 0;
+      SETARG_B(i, k);
+      break;
+    }
+    case OP_SETTABLE: {
+      SETARG_B(i, GETARG_B(i) + base);
+      if (!rkvalue(sp, &i, base))
+        return 0;
+      break;
+    }
+    case OP_SETI: {
+      if (!rkvalue(sp, &i, base))
+        return 0;
+      break;
+    }
+    case OP_SETFIELD: {
+      if ((k = kindex(sp, GETARG_B(i), MAXARG_B)) < 0 ||
+          !rkvalue(sp, &i, base))
+        return 0;
+      SETARG_B(i, k);
+      break;
+    }
+    case OP_GETUPVAL: {
+      Upvaldesc *up = &p->upvalues[GETARG_B(i)];
+      if (up->instack)  /* a register of the caller? */
+        i = CREATE_ABCk(OP_MOVE, GETARG_A(i), up->idx, 0, 0);
+      else
+        SETARG_B(i, up->idx);
+      break;
+    }
+    case OP_SETUPVAL: {
+      Upvaldesc *up = &p->upvalues[GETARG_B(i)];
+      if (up->instack)
+        i = CREATE_ABCk(OP_MOVE, up->idx, GETARG_A(i), 0, 0);
+      else
+        SETARG_B(i, up->idx);
+      break;
+    }
+    case OP_GETTABUP: {
+      Upvaldesc *up = &p->upvalues[GETARG_B(i)];
+      if ((k = kindex(sp, GETARG_C(i), MAXARG_C)) < 0)
+        return 0;
+      if (up->instack)
+        i = CREATE_ABCk(OP_GETFIELD, GETARG_A(i), up->idx, k, 0);
+      else {
+        SETARG_B(i, up->idx);
+        SETARG_C(i, k);
+      }
+      break;
+    }
+    case OP_SETTABUP: {
+      Upvaldesc *up = &p->upvalues[GETARG_A(i)];
+      if ((k = kindex(sp, GETARG_B(i), MAXARG_B)) < 0 ||
+          !rkvalue(sp, &i, base))
+        return 0;
+      SETARG_B(i, k);
+      SETARG_A(i, up->idx);
+      if (up->instack)
+        SET_OPCODE(i, OP_SETFIELD);
+      break;
+    }
+    case OP_TAILCALL: {  /* becomes a call followed by a return */
+      if (GETARG_k(i))
+        return 0;
+      emit(sp, CREATE_ABCk(OP_CALL, GETARG_A(i), GETARG_B(i),
+                                    sp->nres + 1, 0), line);
+      leave(sp, GETARG_A(i), sp->nres, line);
+      return 1;
+    }
+    case OP_RETURN: {
+      if (GETARG_k(i))
+        return 0;
+      else if (GETARG_B(i) == 0)  /* can only follow an OP_TAILCALL */
+        return (pc > 0 && GET_OPCODE(p->code[pc - 1]) == OP_TAILCALL);
+      leave(sp, GETARG_A(i), GETARG_B(i) - 1, line);
+      return 1;
+    }
+    case OP_RETURN0: {
+      leave(sp, 0, 0, line);
+      return 1;
+    }
+    case OP_RETURN1: {
+      leave(sp, GETARG_A(i), 1, line);
+      return 1;
+    }
+    default:  /* closures, varargs, to-be-closed variables, etc. */
+      return 0;
+  }
+  emit(sp, i, line);
+  return 1;
+}
+
+
+/*
+** Generate the copy of the inlined fn for a call with 'nargs'
+** arguments at line 'line'. Returns its size, or -1 if the fn cannot
+** be inlined.
+*/
+static int splice (Splice *sp, int nargs, int line) {
+  Proto *p = sp->p;
+  int *pos = sp->pos;
+  int pc, e;
+  sp->n = sp->nexit = 0;
+  if (sp->a + 1 + p->maxstacksize > MAX_FSTACK)
+    return -1;  /* not enough registers */
+  if (nargs < p->numparams)  /* missing arguments are nil */
+    emit(sp, CREATE_ABCk(OP_LOADNIL, sp->a + 1 + nargs,
+                         p->numparams - nargs - 1, 0, 0), line);
+  for (pc = 0; pc < p->sizecode; pc++) {
+    pos[pc] = sp->n;
+    if (!copyinstr(sp, pc))
+      return -1;
+  }
+  pos[p->sizecode] = sp->n;
+  if (sp->out != NULL) {
+    for (pc = 0; pc < p->sizecode; pc++) {
+      switch (GET_OPCODE(p->code[pc])) {
+        case OP_JMP: case OP_FORPREP: case OP_FORLOOP:
+          movejump(&sp->out[pos[pc]], pc, pos);
+          break;
+        default: break;
+      }
+    }
+    for (e = 0; e < sp->nexit; e++)
+      SETARG_sJ(sp->out[sp->exit[e]], sp->n - sp->exit[e] - 1);
+  }
+  return sp->n;
+}
+
+
+/*
+** Add to 'vars' (with 'nv' variables) names for the registers of the
+** copy in [start, end): "(temporary)" from the first register after
+** the active variables up to the register of the call, followed by the
+** variables of the inlined fn. So, 'locvars' still gives the names of
+** the registers in order. Returns the new number of variables.
+*/
+static int inlinevars (Splice *sp, LocVar *vars, int nv, int start,
+                       int end, TString *tmp) {
+  Proto *p = sp->p;
+  int nact = 0;
+  int v;
+  for (v = 0; v < nv; v++) {  /* count variables active at the call */
+    if (start < vars[v].endpc)
+      nact++;
+  }
+  for (; nact <= sp->a; nact++, nv++) {
+    vars[nv].varname = tmp;
+    vars[nv].startpc = start;
+    vars[nv].endpc = end;
+  }
+  for (v = 0; v < p->sizelocvars; v++, nv++) {
+    vars[nv].varname = p->locvars[v].varname;
+    vars[nv].startpc = start + sp->pos[p->locvars[v].startpc];
+    vars[nv].endpc = start + sp->pos[p->locvars[v].endpc];
+  }
+  return nv;
+}
+
+
+/* check whether candidate 'c' may be inlined at all */
+static int inlinable (FuncState *fs, const Inlinedesc *c) {
+  Proto *p = fs->f->p[c->kproto];
+  int u;
+  if (c->assigned || p->sizep > 0 || (p->flag & PF_ISVARARG) ||
+      p->sizecode > VMKI_MAXINLINE)
+    return 0;
+  for (u = 0; u < p->sizeupvalues; u++) {
+    if (p->upvalues[u].instack && p->upvalues[u].idx == c->ridx)
+      return 0;  /* a recursive fn */
+  }
+  return 1;
+}
+
+
+/*
+** Check whether instruction 'pc' calls a candidate for inlining (see
+** the comment at the start of this section), returning its index or -1.
+** 'target' marks the instructions that do not follow only their
+** previous one.
+*/
+static int calledcand (OptState *os, const Inlinedesc *cand, int ncand,
+                       const lu_byte *ok, const lu_byte *target, int pc) {
+  Proto *f = os->fs->f;
+  Instruction call = os->code[pc];
+  int a = GETARG_A(call);
+  int m, c, r;
+  if (GET_OPCODE(call) != OP_CALL || GETARG_B(call) == 0 ||
+      GETARG_C(call) == 0)
+    return -1;
+  for (m = pc - 1; ; m--) {  /* look for the move of the fn */
+    Instruction i;
+    Effects e;
+    int s[3];
+    if (m < 0 || target[m + 1])
+      return -1;
+    i = os->code[m];
+    if (GET_OPCODE(i) == OP_MOVE && GETARG_A(i) == a)
+      break;
+    effects(os, i, &e);
+    if (successors(os, m, s) != 1 || s[0] != m + 1 ||
+        (e.clob <= a && a < e.eclob))
+      return -1;
+  }
+  r = GETARG_B(os->code[m]);
+  for (c = 0; c < ncand; c++) {
+    LocVar *var = &f->locvars[cand[c].pidx];
+    if (ok[c] && cand[c].ridx == r && var->startpc <= m && m < var->endpc)
+      return c;
+  }
+  return -1;
+}
+
+
+/*
+** Inline the calls to candidates of fn 'fs'. Calls are only looked
+** for in the original code, so copies are not inlined again.
+*/
+static void inlinecalls (FuncState *fs) {
+  vmk_State *L = fs->ls->L;
+  Proto *f = fs->f;
+  Inlinedesc *cand = fs->ls->dyd->inl.arr + fs->firstinl;
+  int ncand = fs->ls->dyd->inl.n - fs->firstinl;
+  int n = fs->pc;
+  int limit = MAXGROWTH * (n + VMKI_MAXINLINE);
+  OptState os;
+  Splice sp;
+  int *line, *size, *site, *newpc, *kstart;
+  lu_byte *target, *ok;
+  int c, pc, nk, newn, nsites;
+  char *mem;
+  Udata *u;
+  if (ncand == 0)
+    return;
+  u = vmkS_newudata(L, cast_sizet(ncand) * (sizeof(int) + 1), 0);
+  setuvalue(L, s2v(L->top.p), u);  /* anchor it */
+  vmkD_inctop(L);
+  kstart = cast(int *, getudatamem(u));
+  ok = cast(lu_byte *, kstart + ncand);
+  for (c = nk = 0; c < ncand; c++) {
+    ok[c] = cast_byte(inlinable(fs, &cand[c]));
+    kstart[c] = nk;
+    if (ok[c])
+      nk += f->p[cand[c].kproto]->sizek;
+  }
+  u = vmkS_newudata(L, cast_sizet(n) * (4 * sizeof(int) + 1) +
+                       cast_sizet(nk) * sizeof(int) + sizeof(int) + 1, 0);
+  setuvalue(L, s2v(L->top.p), u);
+  vmkD_inctop(L);
+  mem = cast_charp(getudatamem(u));
+  line = cast(int *, mem); mem += cast_sizet(n) * sizeof(int);
+  size = cast(int *, mem); mem += cast_sizet(n) * sizeof(int);
+  site = cast(int *, mem); mem += cast_sizet(n) * sizeof(int);
+  newpc = cast(int *, mem); mem += cast_sizet(n + 1) * sizeof(int);
+  sp.kmap = cast(int *, mem); mem += cast_sizet(nk) * sizeof(int);
+  target = cast(lu_byte *, mem);
+  for (c = 0; c < nk; c++)
+    sp.kmap[c] = -1;  /* no constant copied yet */
+  memset(target, 0, cast_sizet(n) + 1);
+  os.fs = fs;
+  os.code = f->code;
+  os.n = n;
+  os.nregs = f->maxstacksize;
+  getlines(fs, line);
+  for (pc = 0; pc < n; pc++) {  /* mark targets of jumps */
+    int s[3];
+    int ns = successors(&os, pc, s);
+    if (ns != 1 || s[0] != pc + 1) {  /* not a plain instruction? */
+      while (ns-- > 0) {
+        if (s[ns] <= n)
+          target[s[ns]] = 1;
+      }
+      target[pc + 1] = 1;
+    }
+  }
+  sp.fs = fs;
+  sp.out = NULL;
+  newn = n;
+  nsites = 0;
+  for (pc = 0; pc < n; pc++) {  /* find calls to inline and their sizes */
+    size[pc] = 0;
+    c = calledcand(&os, cand, ncand, ok, target, pc);
+    if (c >= 0) {
+      int sz;
+      sp.p = f->p[cand[c].kproto];
+      sp.kmap += kstart[c];
+      sp.a = GETARG_A(f->code[pc]);
+      sp.nres = GETARG_C(f->code[pc]) - 1;
+      sz = splice(&sp, GETARG_B(f->code[pc]) - 1, line[pc]);
+      sp.kmap -= kstart[c];
+      if (sz >= 0 && newn + sz - 1 <= limit) {
+        size[pc] = sz;
+        site[pc] = c;
+        newn += sz - 1;
+        nsites++;
+      }
+    }
+  }
+  if (nsites > 0) {
+    Instruction *code;
+    int *newline;
+    LocVar *vars;
+    TString *tmp = vmkX_newstring(fs->ls, "(temporary)", 11);
+    int nvars = fs->ndebugvars;  /* maximum number of variables */
+    int nv = 0;
+    int v = 0;
+    int i = 0;
+    for (pc = 0; pc < n; pc++) {
+      if (size[pc] > 0)
+        nvars += GETARG_A(f->code[pc]) + 1 +
+                 f->p[cand[site[pc]].kproto]->sizelocvars;
+    }
+    if (nvars > SHRT_MAX)  /* too many variables? */
+      nvars = 0;  /* do not name the registers of the copies */
+    u = vmkS_newudata(L, cast_sizet(newn) * (sizeof(Instruction) +
+                                             sizeof(int)) +
+                         cast_sizet(nvars) * sizeof(LocVar), 0);
+    setuvalue(L, s2v(L->top.p), u);
+    vmkD_inctop(L);
+    vars = cast(LocVar *, getudatamem(u));
+    code = cast(Instruction *, vars + nvars);
+    newline = cast(int *, code + newn);
+    for (pc = 0; pc < n; pc++) {
+      newpc[pc] = i;
+      i += (size[pc] > 0) ? size[pc] : 1;
+    }
+    newpc[n] = i;
+    moveranges(f, fs->ndebugvars, newpc);
+    for (pc = 0; pc < n; pc++) {
+      if (size[pc] > 0) {  /* copy the inlined fn */
+        Inlinedesc *cd = &cand[site[pc]];
+        sp.p = f->p[cd->kproto];
+        sp.kmap += kstart[site[pc]];
+        sp.a = GETARG_A(f->code[pc]);
+        sp.nres = GETARG_C(f->code[pc]) - 1;
+        sp.out = code + newpc[pc];
+        sp.line = newline + newpc[pc];
+        splice(&sp, GETARG_B(f->code[pc]) - 1, line[pc]);
+        sp.kmap -= kstart[site[pc]];
+        if (sp.a + 1 + sp.p->maxstacksize > f->maxstacksize)
+          f->maxstacksize = cast_byte(sp.a + 1 + sp.p->maxstacksize);
+        if (nvars > 0) {
+          for (; v < fs->ndebugvars && f->locvars[v].startpc <= newpc[pc];
+                 v++)
+            vars[nv++] = f->locvars[v];
+          nv = inlinevars(&sp, vars, nv, newpc[pc], newpc[pc + 1], tmp);
+        }
+      }
+      else {
+        code[newpc[pc]] = f->code[pc];
+        movejump(&code[newpc[pc]], pc, newpc);
+        newline[newpc[pc]] = line[pc];
+      }
+    }
+    f->code = vmkM_reallocvector(L, f->code, f->sizecode, newn, Instruction);
+    f->sizecode = newn;
+    memcpy(f->code, code, cast_sizet(newn) * sizeof(Instruction));
+    fs->pc = newn;
+    vmkK_relines(fs, newline);
+    f->inlines = vmkM_newvector(L, cast_sizet(nsites), InlineInfo);
+    for (pc = i = 0; pc < n; pc++) {
+      if (size[pc] > 0) {
+        InlineInfo *ii = &f->inlines[i++];
+        ii->name = f->locvars[cand[site[pc]].pidx].varname;
+        ii->startpc = newpc[pc];
+        ii->endpc = newpc[pc + 1];
+        ii->line = line[pc];
+      }
+    }
+    f->sizeinlines = nsites;
+    if (nvars > 0) {  /* replace the variables */
+      for (; v < fs->ndebugvars; v++)
+        vars[nv++] = f->locvars[v];
+      f->locvars = vmkM_reallocvector(L, f->locvars, f->sizelocvars, nv,
+                                      LocVar);
+      f->sizelocvars = nv;
+      memcpy(f->locvars, vars, cast_sizet(nv) * sizeof(LocVar));
+      fs->ndebugvars = cast(short, nv);
+    }
+    L->top.p--;  /* remove new code */
+  }
+  L->top.p -= 2;  /* remove work memory */
+}
+
+/* }====================================================== */
+
+
+void vmkB_optimize (FuncState *fs) {
+  vmk_State *L = fs->ls->L;
+  Proto *f = fs->f;
+  OptState os;
+  size_t n = cast_sizet(fs->pc);
+  size_t nregs = cast_sizet(f->maxstacksize);
+  char *mem;
+  Udata *u;
+  int round;
+  inlinecalls(fs);
+  n = cast_sizet(fs->pc);
+  nregs = cast_sizet(f->maxstacksize);
+  if (n == 0 || n * nregs > VMKI_MAXOPTSIZE)
+    return;
+  /* all work memory goes in one userdata, anchored in the stack */
+  u = vmkS_newudata(L, n * (sizeof(RegSet) + nregs * sizeof(Instruction) +
+                            4 * sizeof(int) + sizeof(lu_byte)) +
+                       2 * sizeof(int), 0);
+  setuvalue(L, s2v(L->top.p), u);
+  vmkD_inctop(L);
+  mem = cast_charp(getudatamem(u));
+  os.live = cast(RegSet *, mem); mem += n * sizeof(RegSet);
+  os.kst = cast(Instruction *, mem); mem += n * nregs * sizeof(Instruction);
+  os.line = cast(int *, mem); mem += n * sizeof(int);
+  os.aux = cast(int *, mem); mem += (n + 1) * sizeof(int);
+  os.bid = cast(int *, mem); mem += n * sizeof(int);
+  os.block = cast(int *, mem); mem += (n + 1) * sizeof(int);
+  os.flag = cast(lu_byte *, mem);
+  memset(os.flag, 0, n);
+  os.fs = fs;
+  os.code = f->code;
+  os.n = fs->pc;
+  os.nregs = f->maxstacksize;
+  getlines(fs, os.line);
+  getcaptured(&os);
+  for (round = 0; round < MAXROUNDS; round++) {
+    int changed = jumps(&os);
+    changed |= reachable(&os);
+    buildblocks(&os);
+    changed |= constprop(&os);
+    buildblocks(&os);
+    changed |= copyprop(&os);
+    buildblocks(&os);
+    changed |= deadcode(&os);
+    if (!changed)
+      break;
+  }
+  if (os.n < fs->pc) {  /* removed some code? */
+    fs->pc = os.n;
+    vmkK_relines(fs, os.line);
+  }
+  L->top.p--;  /* remove work memory */
+}
@@ -0,0 +1,32 @@
+/*
+** $Id: lopt.h $
+** Bytecode optimizer
+** See Copyright Notice in vmk.h
+*/
+
+#ifndef lopt_h
+#define lopt_h
+
+
+#include "lparser.h"
+
+
+/*
+** Largest fn (number of instructions times number of registers)
+** that the optimizer handles; larger ones are left as generated.
+*/
+#if !defined(VMKI_MAXOPTSIZE)
+#define VMKI_MAXOPTSIZE		(1 << 18)
+#endif
+
+
+/* largest fn (number of instructions) that the optimizer inlines */
+#if !defined(VMKI_MAXINLINE)
+#define VMKI_MAXINLINE		32
+#endif
+
+
+VMKI_FUNC void vmkB_optimize (FuncState *fs);
+
+
+#endif
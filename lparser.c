@@ -23,6 +23,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
+#include "lopt.h"
 #include "lparser.h"
 #include "lstate.h"
 #include "lstring.h"
@@ -280,6 +281,37 @@ static void init_var (FuncState *fs, expdesc *e, int vidx) {
 }
 
 
+/*
+** Variable described by 'e' is being assigned, so it cannot be inlined.
+** (A candidate is only known by its register; any candidate in that
+** register of that fn is discarded.)
+*/
+static void noinline (LexState *ls, expdesc *e) {
+  FuncState *fs = ls->fs;
+  Dyndata *dyd = ls->dyd;
+  int reg, i;
+  if (e->k == VLOCAL)
+    reg = e->u.var.ridx;
+  else if (e->k == VUPVAL) {  /* find the fn that owns the variable */
+    Upvaldesc *up = &fs->f->upvalues[e->u.info];
+    while (!up->instack) {
+      fs = fs->prev;
+      up = &fs->f->upvalues[up->idx];
+    }
+    fs = fs->prev;
+    if (fs == NULL)  /* upvalue of the main chunk ('_ENV')? */
+      return;
+    reg = up->idx;
+  }
+  else
+    return;
+  for (i = fs->firstinl; i < dyd->inl.n; i++) {
+    if (dyd->inl.arr[i].ridx == reg)
+      dyd->inl.arr[i].assigned = 1;
+  }
+}
+
+
 /*
 ** Raises an error if variable described by 'e' is read only
 */
@@ -311,6 +343,8 @@ static void check_readonly (LexState *ls, expdesc *e) {
        "attempt to assign to const variable '%s'", getstr(varname));
     vmkK_semerror(ls, msg);  /* error */
   }
+  if (ls->optimize)
+    noinline(ls, e);
 }
 
 
@@ -759,6 +793,7 @@ static void open_func (LexState *ls, FuncState *fs, BlockCnt *bl) {
   fs->needclose = 0;
   fs->firstlocal = ls->dyd->actvar.n;
   fs->firstlabel = ls->dyd->label.n;
+  fs->firstinl = ls->dyd->inl.n;
   fs->bl = NULL;
   f->source = ls->source;
   vmkC_objbarrier(L, f, f->source);
@@ -777,8 +812,12 @@ static void close_func (LexState *ls) {
   vmkK_ret(fs, vmkY_nvarstack(fs), 0);  /* final return */
   leaveblock(fs);
   vmk_assert(fs->bl == NULL);
+  if (ls->optimize)
+    vmkB_optimize(fs);
+  ls->dyd->inl.n = fs->firstinl;  /* remove its candidates for inlining */
   vmkK_finish(fs);
   vmkM_shrinkvector(L, f->code, f->sizecode, fs->pc, Instruction);
+  vmkF_newicache(L, f);
   vmkM_shrinkvector(L, f->lineinfo, f->sizelineinfo, fs->pc, ls_byte);
   vmkM_shrinkvector(L, f->abslineinfo, f->sizeabslineinfo,
                        fs->nabslineinfo, AbsLineInfo);
@@ -1704,6 +1743,18 @@ static void localfunc (LexState *ls) {
   body(ls, &b, 0, ls->linenumber);  /* fn created in next register */
   /* debug information will only see the variable after this point! */
   localdebuginfo(fs, fvar)->startpc = fs->pc;
+  if (ls->optimize) {  /* register it as a candidate for inlining */
+    Dyndata *dyd = ls->dyd;
+    Vardesc *vd = getlocalvardesc(fs, fvar);
+    Inlinedesc *c;
+    vmkM_growvector(ls->L, dyd->inl.arr, dyd->inl.n + 1, dyd->inl.size,
+                    Inlinedesc, SHRT_MAX, "inlined functions");
+    c = &dyd->inl.arr[dyd->inl.n++];
+    c->kproto = fs->np - 1;
+    c->pidx = vd->vd.pidx;
+    c->ridx = vd->vd.ridx;
+    c->assigned = 0;
+  }
 }
 
 
@@ -1952,7 +2003,8 @@ static void mainfunc (LexState *ls, FuncState *fs) {
 
 
 LClosure *vmkY_parser (vmk_State *L, ZIO *z, Mbuffer *buff,
-                       Dyndata *dyd, const char *name, int firstchar) {
+                       Dyndata *dyd, const char *name, int firstchar,
+                       int optimize) {
   LexState lexstate;
   FuncState funcstate;
   LClosure *cl = vmkF_newLclosure(L, 1);  /* create main closure */
@@ -1967,12 +2019,14 @@ LClosure *vmkY_parser (vmk_State *L, ZIO *z, Mbuffer *buff,
   vmkC_objbarrier(L, funcstate.f, funcstate.f->source);
   lexstate.buff = buff;
   lexstate.dyd = dyd;
-  dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
+  lexstate.optimize = cast_byte(optimize);
+  dyd->actvar.n = dyd->gt.n = dyd->label.n = dyd->inl.n = 0;
   vmkX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
   mainfunc(&lexstate, &funcstate);
   vmk_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
   /* all scopes should be correctly finished */
-  vmk_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->label.n == 0);
+  vmk_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->label.n == 0 &&
+             dyd->inl.n == 0);
   L->top.p--;  /* remove scanner's table */
   return cl;  /* closure is on the stack, too */
 }
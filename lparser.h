@@ -124,6 +124,15 @@ typedef struct Labellist {
 } Labellist;
 
 
+/* description of a 'lck fn' that the optimizer may inline */
+typedef struct Inlinedesc {
+  int kproto;  /* index of its prototype in 'f->p' */
+  short pidx;  /* index of the variable in the Proto's 'locvars' array */
+  lu_byte ridx;  /* register holding the variable */
+  lu_byte assigned;  /* true if the variable is ever assigned */
+} Inlinedesc;
+
+
 /* dynamic structures used by the parser */
 typedef struct Dyndata {
   struct {  /* list of all active lck variables */
@@ -133,6 +142,11 @@ typedef struct Dyndata {
   } actvar;
   Labellist gt;  /* list of pending gotos */
   Labellist label;   /* list of active labels */
+  struct {  /* list of candidates for inlining */
+    Inlinedesc *arr;
+    int n;
+    int size;
+  } inl;
 } Dyndata;
 
 
@@ -155,6 +169,7 @@ typedef struct FuncState {
   int nabslineinfo;  /* number of elements in 'abslineinfo' */
   int firstlocal;  /* index of first lck var (in Dyndata array) */
   int firstlabel;  /* index of first label (in 'dyd->label->arr') */
+  int firstinl;  /* index of first candidate for inlining (in 'dyd->inl') */
   short ndebugvars;  /* number of elements in 'f->locvars' */
   lu_byte nactvar;  /* number of active lck variables */
   lu_byte nups;  /* number of upvalues */
@@ -168,7 +183,8 @@ VMKI_FUNC lu_byte vmkY_nvarstack (FuncState *fs);
 VMKI_FUNC void vmkY_checklimit (FuncState *fs, int v, int l,
                                 const char *what);
 VMKI_FUNC LClosure *vmkY_parser (vmk_State *L, ZIO *z, Mbuffer *buff,
-                                 Dyndata *dyd, const char *name, int firstchar);
+                                 Dyndata *dyd, const char *name, int firstchar,
+                                 int optimize);
 
 
 #endif
@@ -0,0 +1,336 @@
+/*
+** $Id: lproflib.c $
+** Sampling profiler
+** See Copyright Notice in vmk.h
+*/
+
+#define lproflib_c
+#define VMK_LIB
+
+#include "lprefix.h"
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vmk.h"
+
+#include "lauxlib.h"
+#include "vmklib.h"
+#include "llimits.h"
+
+
+/*
+** An interval timer sends a signal that only asks the state for a
+** sample (see 'vmk_requestsample'). The sample is taken by 'sample'
+** before the next Vmk instruction, and kept as a folded stack (frames
+** from the outermost to the innermost, separated by semicolons) in a
+** ring of fixed-size slots allocated when the profiler starts. When the
+** ring is full, new samples replace the oldest ones.
+*/
+
+
+/* size of a slot in the ring (maximum length of a folded stack) */
+#if !defined(VMK_PROFSTACKSIZE)
+#define VMK_PROFSTACKSIZE	512
+#endif
+
+/* maximum length of one frame in a folded stack */
+#define MAXFRAME	200
+
+/* default sampling frequency and number of slots */
+#define DEFHZ		1000
+#define DEFNSAMPLES	4096
+
+/* key, in the registry, for the profiler of a state */
+#define PROFKEY		"_PROFILER"
+
+/* name of the metatable of profilers */
+#define PROFMT		"PROFILER*"
+
+
+typedef struct Profiler {
+  size_t nslots;  /* number of slots in the ring */
+  size_t nsamples;  /* samples taken since last dump */
+  char ring[1];  /* variable part: 'nslots' slots */
+} Profiler;
+
+
+#define getslot(p,n)	((p)->ring + ((n) % (p)->nslots) * VMK_PROFSTACKSIZE)
+
+
+/* profiler being fed by the timer, if any */
+static Profiler *active = NULL;
+
+
+
+/*
+** {======================================================
+** Interval timer. Signals are shared by the whole process, so only
+** one state at a time can be profiled.
+** =======================================================
+*/
+
+#if !defined(l_starttimer)		/* { */
+
+#if defined(VMK_USE_POSIX)		/* { */
+
+#include <signal.h>
+#include <sys/time.h>
+
+static vmk_State *volatile profL = NULL;  /* state being profiled */
+static struct sigaction oldaction;
+
+
+static void profhandler (int sig) {
+  vmk_State *L = profL;
+  UNUSED(sig);
+  if (L != NULL)
+    vmk_requestsample(L);
+}
+
+
+static int l_starttimer (vmk_State *L, int hz) {
+  struct sigaction sa;
+  struct itimerval it;
+  long usec = 1000000L / hz;
+  profL = L;
+  sa.sa_handler = profhandler;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;  /* do not interrupt system calls */
+  if (sigaction(SIGPROF, &sa, &oldaction) != 0) {
+    profL = NULL;
+    return 0;
+  }
+  it.it_interval.tv_sec = usec / 1000000L;
+  it.it_interval.tv_usec = usec % 1000000L;
+  it.it_value = it.it_interval;
+  if (setitimer(ITIMER_PROF, &it, NULL) != 0) {
+    sigaction(SIGPROF, &oldaction, NULL);
+    profL = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+
+static void l_stoptimer (void) {
+  struct itimerval it;
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_PROF, &it, NULL);
+  sigaction(SIGPROF, &oldaction, NULL);
+  profL = NULL;
+}
+
+#else				/* }{ */
+
+/* ISO C definitions */
+#define l_starttimer(L,hz)	((void)L, (void)hz, 0)
+#define l_stoptimer()		((void)0)
+
+#endif				/* } */
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
+/*
+** Copy 's' to 'b', up to 'e'. Semicolons separate frames in a folded
+** stack, so they are replaced in names.
+*/
+static char *addname (char *b, const char *e, const char *s) {
+  for (; b < e && *s != '\0'; s++)
+    *(b++) = (*s == ';') ? ':' : *s;
+  return b;
+}
+
+
+/* write frame 'ar' into 'buff' as "name (source:line)" */
+static size_t framename (char *buff, const vmk_Debug *ar) {
+  const char *e = buff + MAXFRAME;
+  char *b;
+  if (*ar->what == 'm')
+    b = addname(buff, e, "main chunk");
+  else
+    b = addname(buff, e, (ar->name != NULL) ? ar->name : "?");
+  if (*ar->what == 'C')
+    b = addname(b, e, " [C]");
+  else {
+    char line[VMK_IDSIZE];
+    l_sprintf(line, sizeof(line), ":%d)", ar->linedefined);
+    b = addname(b, e, " (");
+    b = addname(b, e, ar->short_src);
+    b = addname(b, e, line);
+  }
+  return cast_sizet(b - buff);
+}
+
+
+/*
+** The sampler. The folded stack is built backwards from the end of its
+** slot, so that, when the stack does not fit, the outermost frames are
+** the ones replaced by an ellipsis.
+*/
+static void sample (vmk_State *L, void *ud) {
+  Profiler *p = (Profiler *)ud;
+  char *slot = getslot(p, p->nsamples);
+  char *start = slot + VMK_PROFSTACKSIZE - 1;
+  vmk_Debug ar;
+  int level;
+  *start = '\0';
+  for (level = 0; vmk_getstack(L, level, &ar); level++) {
+    char frame[MAXFRAME];
+    size_t l;
+    vmk_getinfo(L, "Sn", &ar);
+    l = framename(frame, &ar);
+    if (l + 1 + 4 > cast_sizet(start - slot)) {  /* no room (with "...;")? */
+      start -= 4;
+      memcpy(start, "...;", 4);
+      break;
+    }
+    if (level > 0)
+      *(--start) = ';';
+    start -= l;
+    memcpy(start, frame, l);
+  }
+  memmove(slot, start, strlen(start) + 1);
+  p->nsamples++;
+}
+
+
+static Profiler *getprofiler (vmk_State *L) {
+  Profiler *p;
+  vmk_getfield(L, VMK_REGISTRYINDEX, PROFKEY);
+  p = (Profiler *)vmk_touserdata(L, -1);
+  vmk_pop(L, 1);
+  return p;
+}
+
+
+static void stopprofiler (vmk_State *L) {
+  l_stoptimer();
+  vmk_setsampler(L, NULL, NULL);
+  active = NULL;
+}
+
+
+/* a profiler being collected must not be running */
+static int prof_gc (vmk_State *L) {
+  if (active == (Profiler *)vmk_touserdata(L, 1))
+    stopprofiler(L);
+  return 0;
+}
+
+
+static int prof_start (vmk_State *L) {
+  vmk_Integer hz = vmkL_optinteger(L, 1, DEFHZ);
+  vmk_Integer n = vmkL_optinteger(L, 2, DEFNSAMPLES);
+  Profiler *p;
+  vmkL_argcheck(L, 0 < hz && hz <= 1000000, 1, "out of range");
+  vmkL_argcheck(L, 0 < n && cast_sizet(n) <= (MAX_SIZET - sizeof(Profiler))
+                                           / VMK_PROFSTACKSIZE, 2,
+                   "out of range");
+  if (active != NULL)
+    return vmkL_error(L, "profiler already running");
+  p = (Profiler *)vmk_newuserdatauv(L, sizeof(Profiler) +
+                                 cast_sizet(n) * VMK_PROFSTACKSIZE, 0);
+  p->nslots = cast_sizet(n);
+  p->nsamples = 0;
+  vmkL_setmetatable(L, PROFMT);
+  vmk_setfield(L, VMK_REGISTRYINDEX, PROFKEY);  /* replaces old samples */
+  vmk_setsampler(L, sample, p);
+  vmk_rawgeti(L, VMK_REGISTRYINDEX, VMK_RIDX_MAINTHREAD);
+  if (!l_starttimer(vmk_tothread(L, -1), cast_int(hz))) {
+    vmk_setsampler(L, NULL, NULL);
+    return vmkL_error(L, "cannot start profiler timer");
+  }
+  active = p;
+  return 0;
+}
+
+
+static int prof_stop (vmk_State *L) {
+  Profiler *p = getprofiler(L);
+  if (p != NULL && active == p)
+    stopprofiler(L);
+  vmk_pushinteger(L, (p == NULL) ? 0 : l_castU2S(p->nsamples));
+  return 1;
+}
+
+
+/*
+** Write the samples taken since the last dump in folded-stack format,
+** one line for each different stack followed by its count, and forget
+** them. Returns the number of samples written.
+*/
+static int prof_dump (vmk_State *L) {
+  Profiler *p = getprofiler(L);
+  size_t first, last, i;
+  FILE *f;
+  int toclose = 0;
+  if (vmk_isnoneornil(L, 1))
+    f = stdout;
+  else if (vmk_type(L, 1) == VMK_TSTRING) {
+    const char *fname = vmk_tostring(L, 1);
+    f = fopen(fname, "w");
+    if (f == NULL)
+      return vmkL_fileresult(L, 0, fname);
+    toclose = 1;
+  }
+  else {
+    vmkL_Stream *s = (vmkL_Stream *)vmkL_checkudata(L, 1, VMK_FILEHANDLE);
+    if (s->closef == NULL)
+      return vmkL_error(L, "attempt to use a closed file");
+    f = s->f;
+  }
+  if (p == NULL)  /* profiler never started? */
+    first = last = 0;
+  else {
+    last = p->nsamples;
+    first = (last > p->nslots) ? last - p->nslots : 0;
+  }
+  vmk_newtable(L);  /* counts of each folded stack */
+  for (i = first; i < last; i++) {
+    vmk_pushstring(L, getslot(p, i));
+    vmk_pushvalue(L, -1);
+    vmk_rawget(L, -3);
+    vmk_pushinteger(L, vmk_tointeger(L, -1) + 1);
+    vmk_replace(L, -2);
+    vmk_rawset(L, -3);
+  }
+  vmk_pushnil(L);
+  while (vmk_next(L, -2)) {
+    fprintf(f, "%s " VMK_INTEGER_FMT "\n", vmk_tostring(L, -2),
+               (VMKI_UACINT)vmk_tointeger(L, -1));
+    vmk_pop(L, 1);
+  }
+  if (p != NULL)
+    p->nsamples = 0;
+  if (toclose)
+    fclose(f);
+  else
+    fflush(f);
+  vmk_pushinteger(L, l_castU2S(last - first));
+  return 1;
+}
+
+
+static const vmkL_Reg proflib[] = {
+  {"start", prof_start},
+  {"stop", prof_stop},
+  {"dump", prof_dump},
+  {NULL, NULL}
+};
+
+
+VMKMOD_API int vmkopen_profiler (vmk_State *L) {
+  if (vmkL_newmetatable(L, PROFMT)) {
+    vmk_pushcfunction(L, prof_gc);
+    vmk_setfield(L, -2, "__gc");
+  }
+  vmk_pop(L, 1);
+  vmkL_newlib(L, proflib);
+  return 1;
+}
+
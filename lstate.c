@@ -20,12 +20,14 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "llex.h"
 #include "lmem.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lvm.h"
 
 
 
@@ -227,6 +229,12 @@ static void f_vmkopen (vmk_State *L, void *ud) {
   vmkS_init(L);
   vmkT_init(L);
   vmkX_init(L);
+#if defined(VMKI_OPPAIRS)
+  vmkV_initpairs(L);
+#endif
+#if defined(VMK_USE_OPSTATS)
+  vmkV_initopstats(L);
+#endif
   g->gcstp = 0;  /* allow gc */
   setnilvalue(&g->nilvalue);  /* now state is complete */
   vmki_userstateopen(L);
@@ -276,7 +284,17 @@ static void close_state (vmk_State *L) {
     vmkC_freeallobjects(L);  /* collect all objects */
     vmki_userstateclose(L);
   }
+#if defined(VMK_USE_JIT)
+  vmkJ_close(L);  /* free a recording left behind */
+#endif
+#if defined(VMKI_OPPAIRS)
+  vmkV_closepairs(L);
+#endif
+#if defined(VMK_USE_OPSTATS)
+  vmkV_closeopstats(L);
+#endif
   vmkM_freearray(L, G(L)->strt.hash, cast_sizet(G(L)->strt.size));
+  vmkM_freearray(L, G(L)->shapes.hash, cast_sizet(G(L)->shapes.size));
   freestack(L);
   vmk_assert(gettotalbytes(g) == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
@@ -368,17 +386,36 @@ VMK_API vmk_State *vmk_newstate (vmk_Alloc f, void *ud, unsigned seed) {
   g->ud = ud;
   g->warnf = NULL;
   g->ud_warn = NULL;
+  g->sampler = NULL;
+  g->ud_sampler = NULL;
+  g->samplereq = 0;
+  g->running = L;
+#if defined(VMK_USE_JIT)
+  g->jitrec = NULL;
+#endif
+#if defined(VMKI_OPPAIRS)
+  g->oppairs = NULL;
+#endif
+#if defined(VMK_USE_OPSTATS)
+  g->opstats = NULL;
+#endif
   g->mainthread = L;
   g->seed = seed;
   g->gcstp = GCSTPGC;  /* no GC while building state */
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
+  g->shapes.size = g->shapes.nuse = 0;
+  g->shapes.hash = NULL;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
+  g->tforiter[0] = g->tforiter[1] = NULL;
   g->gcstate = GCSpause;
   g->gckind = KGC_INC;
   g->gcstopem = 0;
   g->gcemergency = 0;
+  g->gcfull = 0;
+  g->sweeper = NULL;
+  g->nursery = NULL;
   g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
   g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
@@ -396,6 +433,7 @@ VMK_API vmk_State *vmk_newstate (vmk_Alloc f, void *ud, unsigned seed) {
   setgcparam(g, MINORMUL, VMKI_GENMINORMUL);
   setgcparam(g, MINORMAJOR, VMKI_MINORMAJOR);
   setgcparam(g, MAJORMINOR, VMKI_MAJORMINOR);
+  setgcparam(g, MARKTHREADS, VMKI_MARKTHREADS);
   for (i=0; i < VMK_NUMTYPES; i++) g->mt[i] = NULL;
   if (vmkD_rawrunprotected(L, f_vmkopen, NULL) != VMK_OK) {
     /* memory allocation error: free partial state */
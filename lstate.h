@@ -171,6 +171,13 @@ typedef struct stringtable {
 } stringtable;
 
 
+typedef struct shapetable {
+  struct Shape **hash;  /* array of buckets (linked lists of shapes) */
+  int nuse;  /* number of elements */
+  int size;  /* number of buckets */
+} shapetable;
+
+
 /*
 ** Information about a call.
 ** About union 'u':
@@ -294,6 +301,7 @@ typedef struct global_State {
   l_mem GCmarked;  /* number of objects marked in a GC cycle */
   l_mem GCmajorminor;  /* auxiliary counter to control major-minor shifts */
   stringtable strt;  /* hash table for strings */
+  shapetable shapes;  /* cache of table shapes (see ltable.c) */
   TValue l_registry;
   TValue nilvalue;  /* a nil value */
   unsigned int seed;  /* randomized seed for hashes */
@@ -304,6 +312,9 @@ typedef struct global_State {
   lu_byte gcstopem;  /* stops emergency collections */
   lu_byte gcstp;  /* control whether GC is running */
   lu_byte gcemergency;  /* true if this is an emergency collection */
+  lu_byte gcfull;  /* true if this is a full (non-emergency) collection */
+  struct Sweeper *sweeper;  /* background sweeper, if any (see lgc.c) */
+  struct Nursery *nursery;  /* region for young objects, if any */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -324,6 +335,7 @@ typedef struct global_State {
   GCObject *finobjrold;  /* list of really old objects with finalizers */
   struct vmk_State *twups;  /* list of threads with open upvalues */
   vmk_CFunction panic;  /* to be called in unprotected errors */
+  vmk_CFunction tforiter[2];  /* see 'vmk_setiterators' */
   struct vmk_State *mainthread;
   TString *memerrmsg;  /* message for memory-allocation errors */
   TString *tmname[TM_N];  /* array with tag-method names */
@@ -331,6 +343,20 @@ typedef struct global_State {
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
   vmk_WarnFunction warnf;  /* warning fn */
   void *ud_warn;         /* auxiliary data to 'warnf' */
+  vmk_Sampler sampler;  /* sampling fn (see 'vmk_requestsample') */
+  void *ud_sampler;  /* auxiliary data to 'sampler' */
+  volatile l_signalT samplereq;  /* sample requested? */
+  struct vmk_State *running;  /* thread running Vmk code */
+#if defined(VMK_USE_JIT)
+  struct JitRecorder *jitrec;  /* trace being recorded (see ljit.c) */
+#endif
+#if defined(VMKI_OPPAIRS)
+  lu_mem *oppairs;  /* counts of pairs of opcodes (see 'vmkV_initpairs') */
+  int lastop;  /* last opcode dispatched */
+#endif
+#if defined(VMK_USE_OPSTATS)
+  struct OpStats *opstats;  /* counters of the opcode profiler */
+#endif
 } global_State;
 
 
@@ -21,6 +21,10 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** Tables with only a few keys, all of them short strings (records),
+** keep their values in a dense vector of slots instead of a hash part;
+** their keys are kept in a shape, shared by all tables that got the
+** same keys in the same order (see section 'Shapes').
 */
 
 #include <math.h>
@@ -99,6 +103,14 @@ typedef union {
 #define MAXHSIZE	vmkM_limitN(1 << MAXHBITS, Node)
 
 
+/*
+** Minimum size of an array part kept in typed form (see 'isarrtyped').
+*/
+#if !defined(VMKI_MINTYPED)
+#define VMKI_MINTYPED	16
+#endif
+
+
 /*
 ** When the original hash value is good, hashing by a power of 2
 ** avoids the cost of '%'.
@@ -293,6 +305,21 @@ static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
 }
 
 
+/*
+** Search fn for the slots of a table with a shape. (Shapes are small,
+** and its keys are compared by identity, so a linear search is fine.)
+*/
+static const TValue *getslot (Table *t, TString *key) {
+  unsigned n = nslots(t);
+  unsigned i;
+  for (i = 0; i < n; i++) {
+    if (getshape(t)->keys[i] == key)
+      return &t->slots[i];
+  }
+  return &absentkey;
+}
+
+
 /*
 ** Return the index 'k' (converted to an unsigned) if it is inside
 ** the range [1, limit].
@@ -328,19 +355,29 @@ static unsigned keyinarray (Table *t, const TValue *key) {
 /*
 ** returns the index of a 'key' for table traversals. First goes all
 ** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signaled by 0.
+** beginning of a traversal is signaled by 0; a key not present in the
+** table gives NOINDEX.
 */
-static unsigned findindex (vmk_State *L, Table *t, TValue *key,
-                               unsigned asize) {
+#define NOINDEX		(~0u)
+
+static unsigned keyindex (Table *t, const TValue *key, unsigned asize) {
   unsigned int i;
   if (ttisnil(key)) return 0;  /* first iteration */
   i = keyinarray(t, key);
   if (i != 0)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
+  else if (hasslots(t)) {  /* table has a shape? */
+    const TValue *n = (ttisshrstring(key)) ? getslot(t, tsvalue(key))
+                                           : &absentkey;
+    if (isabstkey(n))
+      return NOINDEX;  /* key not found */
+    /* fields are numbered after array elements */
+    return cast_uint(n - t->slots) + 1 + asize;
+  }
   else {
     const TValue *n = getgeneric(t, key, 1);
-    if (l_unlikely(isabstkey(n)))
-      vmkG_runerror(L, "invalid key to 'next'");  /* key not found */
+    if (isabstkey(n))
+      return NOINDEX;  /* key not found */
     i = cast_uint(nodefromval(n) - gnode(t, 0));  /* key index in hash table */
     /* hash elements are numbered after array ones */
     return (i + 1) + asize;
@@ -348,29 +385,97 @@ static unsigned findindex (vmk_State *L, Table *t, TValue *key,
 }
 
 
-int vmkH_next (vmk_State *L, Table *t, StkId key) {
+static unsigned findindex (vmk_State *L, Table *t, TValue *key,
+                               unsigned asize) {
+  unsigned i = keyindex(t, key, asize);
+  if (l_unlikely(i == NOINDEX))
+    vmkG_runerror(L, "invalid key to 'next'");  /* key not found */
+  return i;
+}
+
+
+/*
+** Check whether 'i' is still the index of 'key' in table 't', so that
+** a traversal can go on from it without searching for 'key'.
+*/
+static int isindex (Table *t, const TValue *key, unsigned i,
+                                                 unsigned asize) {
+  if (i <= asize)
+    return (ttisinteger(key) && l_castS2U(ivalue(key)) == i);
+  i -= asize + 1;
+  if (hasslots(t))
+    return (i < nslots(t) && ttisshrstring(key) &&
+            getshape(t)->keys[i] == tsvalue(key));
+  else
+    return (i < sizenode(t) && equalkey(key, gnode(t, i), 1));
+}
+
+
+/*
+** Puts in 'key' and 'key + 1' the first non-empty entry at or after
+** index 'i' (counting from 0). Returns the index of that entry plus
+** one (which is its traversal index), or 0 if there are no more
+** elements.
+*/
+static unsigned nextfrom (vmk_State *L, Table *t, StkId key, unsigned i) {
   unsigned int asize = t->asize;
-  unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
   for (; i < asize; i++) {  /* try first array part */
-    lu_byte tag = *getArrTag(t, i);
+    lu_byte tag = arrtag(t, i);
     if (!tagisempty(tag)) {  /* a non-empty entry? */
       setivalue(s2v(key), cast_int(i) + 1);
       farr2val(t, i, tag, s2v(key + 1));
-      return 1;
+      return i + 1;
     }
   }
+  if (hasslots(t)) {  /* fields of a table with a shape? */
+    for (i -= asize; i < nslots(t); i++) {
+      if (!isempty(&t->slots[i])) {  /* a non-empty entry? */
+        setsvalue2s(L, key, getshape(t)->keys[i]);
+        setobj2s(L, key + 1, &t->slots[i]);
+        return i + 1 + asize;
+      }
+    }
+    return 0;  /* no more elements */
+  }
   for (i -= asize; i < sizenode(t); i++) {  /* hash part */
     if (!isempty(gval(gnode(t, i)))) {  /* a non-empty entry? */
       Node *n = gnode(t, i);
       getnodekey(L, s2v(key), n);
       setobj2s(L, key + 1, gval(n));
-      return 1;
+      return i + 1 + asize;
     }
   }
   return 0;  /* no more elements */
 }
 
 
+int vmkH_next (vmk_State *L, Table *t, StkId key) {
+  unsigned int i = findindex(L, t, s2v(key), t->asize);
+  return (nextfrom(L, t, key, i) != 0);
+}
+
+
+/*
+** Variant of 'vmkH_next' for traversals that keep a cursor: '*cursor'
+** is the traversal index of 'key' given by the previous call (0 if
+** unknown). The traversal goes on from there while that index still
+** holds 'key', so that the key does not have to be searched at each
+** step. Returns -1 if 'key' is not in the table, without raising an
+** error.
+*/
+int vmkH_nextcursor (vmk_State *L, Table *t, StkId key, unsigned *cursor) {
+  unsigned asize = t->asize;
+  unsigned i = *cursor;
+  if (i == 0 || !isindex(t, s2v(key), i, asize)) {
+    i = keyindex(t, s2v(key), asize);
+    if (i == NOINDEX)
+      return -1;
+  }
+  *cursor = nextfrom(L, t, key, i);
+  return (*cursor != 0);
+}
+
+
 /* Extra space in Node array if it has a lastfree entry */
 #define extraLastfree(t)	(haslastfree(t) ? sizeof(Limbox) : 0)
 
@@ -396,7 +501,8 @@ static void freehash (vmk_State *L, Table *t) {
 */
 
 static int insertkey (Table *t, const TValue *key, TValue *value);
-static void newcheckedkey (Table *t, const TValue *key, TValue *value);
+static void newcheckedkey (vmk_State *L, Table *t, const TValue *key,
+                                         TValue *value);
 
 
 /*
@@ -467,7 +573,7 @@ static void countint (vmk_Integer key, Counters *ct) {
 
 
 l_sinline int arraykeyisempty (const Table *t, unsigned key) {
-  int tag = *getArrTag(t, key - 1);
+  int tag = arrtag(t, key - 1);
   return tagisempty(tag);
 }
 
@@ -529,22 +635,82 @@ static void numusehash (const Table *t, Counters *ct) {
 
 /*
 ** Convert an "abstract size" (number of slots in an array) to
-** "concrete size" (number of bytes in the array).
+** "concrete size" (number of bytes in the array). A typed array has
+** no tags.
 */
-static size_t concretesize (unsigned int size) {
+static size_t concretesize (unsigned int size, int typed) {
   if (size == 0)
     return 0;
-  else  /* space for the two arrays plus an unsigned in between */
-    return size * (sizeof(Value) + 1) + sizeof(unsigned);
+  else  /* space for the two arrays plus two unsigneds in between */
+    return size * (sizeof(Value) + (typed ? 0 : 1)) + 2 * sizeof(unsigned);
+}
+
+/* concrete size of the array part of 't' */
+#define arraysizeb(t)	concretesize((t)->asize, hastypedarray(t))
+
+
+/*
+** {=============================================================
+** Inline area
+** A part of a table goes to its inline area (see 'Tabext') when it fits
+** there, besides the other part that may be there, and it is not there
+** already (a part moving inside the area could overwrite itself). Blocks
+** in the inline area are never freed. Only equalities of addresses tell
+** whether a part is in the inline area.
+** ==============================================================
+*/
+
+#define inlinearea(t)	cast(lu_byte *, tabext(t) + 1)
+#define inlinesize(t)	(hasext(t) ? cast_sizet(tabext(t)->isize) : 0)
+
+
+/* true iff the array part of 't' is at the start of its inline area */
+static int inlinearray (const Table *t) {
+  return (t->asize > 0 && hasext(t) &&
+          cast(lu_byte *, t->array - t->asize) == inlinearea(t));
 }
 
 
+/* true iff the slots of 't' are at the end of its inline area */
+static int inlineslots (const Table *t) {
+  return (hasslots(t) && hasext(t) &&
+          cast(lu_byte *, slotbox(t)) + sizeslotsb(sizeslots(t)) ==
+          inlinearea(t) + tabext(t)->isize);
+}
+
+
+/* space that the array part (the slots) of 't' takes in its inline area */
+#define inlinearrayb(t)	(inlinearray(t) ? arraysizeb(t) : 0)
+#define inlineslotsb(t)	(inlineslots(t) ? sizeslotsb(sizeslots(t)) : 0)
+
+
 /*
-** Resize the array part of a table. If new size is equal to the old,
-** do nothing. Else, if new size is zero, free the old array. (It must
-** be present, as the sizes are different.) Otherwise, allocate a new
-** array, move the common elements to new proper position, and then
-** frees the old array.
+** Size of the inline area for a table with 'nasize' array elements and
+** 'nhsize' fields in slots (zero if it would be too large).
+*/
+static unsigned inlinesizefor (unsigned nasize, unsigned nhsize) {
+  size_t size;
+  if (nasize > VMKI_INLINESIZE || nhsize > VMKI_INLINESIZE)
+    return 0;  /* (also avoids overflows) */
+  size = concretesize(nasize, 0);
+  size = (size + sizeof(TValue) - 1) / sizeof(TValue) * sizeof(TValue);
+  if (nhsize > 0)
+    size += sizeslotsb(nhsize);
+  return (size <= VMKI_INLINESIZE) ? cast_uint(size) : 0;
+}
+
+/* }============================================================= */
+
+
+/*
+** Resize the array part of a table, making it typed with tag 'atype'
+** (or generic if 'atype' is zero). If new size and form are equal to
+** the old ones, do nothing. Else, if new size is zero, free the old
+** array. (It must be present, as the sizes are different.) Otherwise,
+** allocate a new array, move the common elements (and the two unsigneds
+** in between, which the caller must then correct) to new proper
+** position, and then frees the old array. Tags for a generic array made
+** from a typed one come from its border.
 ** We could reallocate the array, but we still would need to move the
 ** elements to their new position, so the copy implicit in realloc is a
 ** waste. Moreover, most allocators will move the array anyway when the
@@ -552,30 +718,46 @@ static size_t concretesize (unsigned int size) {
 */
 static Value *resizearray (vmk_State *L , Table *t,
                                unsigned oldasize,
-                               unsigned newasize) {
-  if (oldasize == newasize)
+                               unsigned newasize, lu_byte atype) {
+  int oldtyped = (oldasize > 0 && isarrtyped(t));
+  if (oldasize == newasize && oldtyped == (atype != 0))
     return t->array;  /* nothing to be done */
   else if (newasize == 0) {  /* erasing array? */
     Value *op = t->array - oldasize;  /* original array's real address */
-    vmkM_freemem(L, op, concretesize(oldasize));  /* free it */
+    if (!inlinearray(t))
+      vmkM_freemem(L, op, concretesize(oldasize, oldtyped));  /* free it */
     return NULL;
   }
   else {
-    size_t newasizeb = concretesize(newasize);
-    Value *np = cast(Value *,
-                  vmkM_reallocvector(L, NULL, 0, newasizeb, lu_byte));
-    if (np == NULL)  /* allocation error? */
-      return NULL;
+    size_t newasizeb = concretesize(newasize, atype != 0);
+    Value *np;
+    if (!inlinearray(t) &&
+        newasizeb + inlineslotsb(t) <= inlinesize(t))  /* fits inline? */
+      np = cast(Value *, inlinearea(t));
+    else {
+      np = cast(Value *, vmkM_reallocvector(L, NULL, 0, newasizeb, lu_byte));
+      if (np == NULL)  /* allocation error? */
+        return NULL;
+    }
     np += newasize;  /* shift pointer to the end of value segment */
     if (oldasize > 0) {
       /* move common elements to new position */
-      size_t oldasizeb = concretesize(oldasize);
       Value *op = t->array;  /* original array */
       unsigned tomove = (oldasize < newasize) ? oldasize : newasize;
-      size_t tomoveb = (oldasize < newasize) ? oldasizeb : newasizeb;
-      vmk_assert(tomoveb > 0);
-      memcpy(np - tomove, op - tomove, tomoveb);
-      vmkM_freemem(L, op - oldasize, oldasizeb);  /* free old block */
+      if (!oldtyped && atype == 0)  /* both generic? */
+        memcpy(np - tomove, op - tomove, concretesize(tomove, 0));
+      else {  /* move values and unsigneds; tags, if any, are rebuilt */
+        memcpy(np - tomove, op - tomove, concretesize(tomove, 1));
+        if (atype == 0) {  /* typed to generic? */
+          lu_byte *tags = cast(lu_byte *, np) + 2 * sizeof(unsigned);
+          unsigned border = *lenborder(t);
+          unsigned i;
+          for (i = 0; i < tomove; i++)
+            tags[i] = (i < border) ? arrtypetag(t) : VMK_VEMPTY;
+        }
+      }
+      if (!inlinearray(t))
+        vmkM_freemem(L, op - oldasize, concretesize(oldasize, oldtyped));
     }
     return np;
   }
@@ -634,7 +816,7 @@ static void reinserthash (vmk_State *L, Table *ot, Table *t) {
          already present in the table */
       TValue k;
       getnodekey(L, &k, old);
-      newcheckedkey(t, &k, gval(old));
+      newcheckedkey(L, t, &k, gval(old));
     }
   }
 }
@@ -667,7 +849,7 @@ static void reinsertOldSlice (Table *t, unsigned oldasize,
                                         unsigned newasize) {
   unsigned i;
   for (i = newasize; i < oldasize; i++) {  /* traverse vanishing slice */
-    lu_byte tag = *getArrTag(t, i);
+    lu_byte tag = arrtag(t, i);
     if (!tagisempty(tag)) {  /* a non-empty entry? */
       TValue key, aux;
       setivalue(&key, l_castU2S(i) + 1);  /* make the key */
@@ -688,25 +870,106 @@ static void clearNewSlice (Table *t, unsigned oldasize, unsigned newasize) {
 
 
 /*
-** Resize table 't' for the new given sizes. Both allocations (for
-** the hash part and for the array part) can fail, which creates some
-** subtleties. If the first allocation, for the hash part, fails, an
-** error is raised and that is it. Otherwise, it copies the elements from
-** the shrinking part of the array (if it is shrinking) into the new
-** hash. Then it reallocates the array part.  If that fails, the table
-** is in its original state; the fn frees the new hash part and then
-** raises the allocation error. Otherwise, it sets the new hash part
-** into the table, initializes the new part of the array (if any) with
-** nils and reinserts the elements of the old hash back into the new
-** parts of the table.
+** Compute the border of the array part of 't' if that part is a proper
+** sequence; otherwise, return NOBORDER.
+*/
+static unsigned findborder (const Table *t) {
+  unsigned asize = t->asize;
+  unsigned i, border;
+  for (i = 0; i < asize && !tagisempty(*getArrTag(t, i)); i++) ;
+  border = i;
+  for (; i < asize; i++) {
+    if (!tagisempty(*getArrTag(t, i)))
+      return NOBORDER;  /* there is a hole before 'i' */
+  }
+  return border;
+}
+
+
+/*
+** Tag shared by all entries of the array part of 't' if that part is a
+** (non-empty) sequence of integers or of floats; otherwise, zero.
+*/
+static lu_byte seqtag (const Table *t) {
+  unsigned border = *lenborder(t);
+  unsigned i;
+  lu_byte tag;
+  if (border == NOBORDER || border == 0)
+    return 0;
+  tag = *getArrTag(t, 0);
+  if (tag != VMK_VNUMINT && tag != VMK_VNUMFLT)
+    return 0;
+  for (i = 1; i < border; i++) {
+    if (*getArrTag(t, i) != tag)
+      return 0;
+  }
+  return tag;
+}
+
+
+/*
+** Check whether the hash part of 't' has integer keys in [1, n], which
+** would go to an array part of size 'n'.
+*/
+static int hasarraykeys (const Table *t, unsigned n) {
+  unsigned i;
+  for (i = 0; i < allocsizenode(t); i++) {
+    const Node *nd = gnode(t, i);
+    if (keyisinteger(nd) && !isempty(gval(nd)) &&
+        l_castS2U(keyival(nd)) - 1u < n)
+      return 1;
+  }
+  return 0;
+}
+
+
+/*
+** Tag for a typed array part of size 'newasize' for table 't', or zero
+** for a generic one. Small parts are always generic. A typed part stays
+** typed, and a generic part that grows becomes typed when it is a
+** sequence of numbers with the same tag. 'atype' is the tag wanted for
+** a part created from nothing. In all cases, no key from the hash part
+** can move to a typed part.
+*/
+static lu_byte newarraytype (const Table *t, unsigned newasize,
+                                             lu_byte atype) {
+  unsigned oldasize = t->asize;
+  if (newasize < VMKI_MINTYPED)
+    return 0;
+  else if (oldasize > 0)
+    atype = isarrtyped(t) ? arrtypetag(t)
+          : (newasize > oldasize) ? seqtag(t) : 0;
+  if (atype != 0 && hasarraykeys(t, newasize))
+    return 0;
+  return atype;
+}
+
+
+/*
+** Resize table 't' for the new given sizes, with a typed array part
+** with tag 'atype' if that part is created (see 'newarraytype'). Both
+** allocations (for the hash part and for the array part) can fail,
+** which creates some subtleties. If the first allocation, for the hash
+** part, fails, an error is raised and that is it. Otherwise, it copies
+** the elements from the shrinking part of the array (if it is
+** shrinking) into the new hash. Then it reallocates the array part.
+** If that fails, the table is in its original state; the fn frees the
+** new hash part and then raises the allocation error. Otherwise, it
+** sets the new hash part into the table, initializes the new part of
+** the array (if any) with nils and reinserts the elements of the old
+** hash back into the new parts of the table. Finally, it computes the
+** border of a new generic array part, as the reinsertions come in no
+** particular order. (A typed part keeps its border, as nothing is
+** reinserted into it.)
 ** Note that if the new size for the array part ('newasize') is equal to
-** the old one ('oldasize'), this fn will do nothing with that
-** part.
+** the old one ('oldasize'), and its form does not change, this fn will
+** do nothing with that part.
 */
-void vmkH_resize (vmk_State *L, Table *t, unsigned newasize,
-                                          unsigned nhsize) {
+static void resizetable (vmk_State *L, Table *t, unsigned newasize,
+                                      unsigned nhsize, lu_byte atype) {
   Table newt;  /* to keep the new hash part */
   unsigned oldasize = t->asize;
+  int oldtyped = hastypedarray(t);
   Value *newarray;
   if (newasize > MAXASIZE)
     vmkG_runerror(L, "table overflow");
@@ -720,7 +983,8 @@ void vmkH_resize (vmk_State *L, Table *t, unsigned newasize,
     exchangehashpart(t, &newt);  /* restore old hash (in case of errors) */
   }
   /* allocate new array */
-  newarray = resizearray(L, t, oldasize, newasize);
+  atype = newarraytype(t, newasize, atype);
+  newarray = resizearray(L, t, oldasize, newasize, atype);
   if (l_unlikely(newarray == NULL && newasize > 0)) {  /* allocation failed? */
     freehash(L, &newt);  /* release new hash part */
     vmkM_error(L);  /* raise error (with array unchanged) */
@@ -729,12 +993,43 @@ void vmkH_resize (vmk_State *L, Table *t, unsigned newasize,
   exchangehashpart(t, &newt);  /* 't' has the new hash ('newt' has the old) */
   t->array = newarray;  /* set new array part */
   t->asize = newasize;
-  if (newarray != NULL)
-    *lenhint(t) = newasize / 2u;  /* set an initial hint */
-  clearNewSlice(t, oldasize, newasize);
+  if (atype != 0) {  /* typed array part? (it is never empty) */
+    unsigned border = (oldasize > 0) ? *lenborder(t) : 0;
+    *lenhint(t) = typedhint(atype);
+    *lenborder(t) = (border < newasize) ? border : newasize;
+  }
+  else {
+    if (newarray != NULL) {
+      *lenhint(t) = newasize / 2u;  /* set an initial hint */
+      if (newasize != oldasize || oldtyped)
+        *lenborder(t) = NOBORDER;  /* computed after the reinsertions */
+    }
+    clearNewSlice(t, oldasize, newasize);
+  }
   /* re-insert elements from old hash part into new parts */
   reinserthash(L, &newt, t);  /* 'newt' now has the old hash */
   freehash(L, &newt);  /* free old hash part */
+  if (newarray != NULL && atype == 0 && (newasize != oldasize || oldtyped))
+    *lenborder(t) = findborder(t);
+}
+
+
+void vmkH_resize (vmk_State *L, Table *t, unsigned newasize,
+                                          unsigned nhsize) {
+  resizetable(L, t, newasize, nhsize, 0);
+}
+
+
+/*
+** Convert the typed array part of 't' to the generic form, for a store
+** that the typed form cannot keep.
+*/
+void vmkH_untype (vmk_State *L, Table *t) {
+  Value *newarray = resizearray(L, t, t->asize, t->asize, 0);
+  if (l_unlikely(newarray == NULL))
+    vmkM_error(L);
+  t->array = newarray;
+  *lenhint(t) = *lenborder(t);  /* a good hint */
 }
 
 
@@ -754,6 +1049,7 @@ static void rehash (vmk_State *L, Table *t, const TValue *ek) {
   Counters ct;
   unsigned i;
   unsigned nsize;  /* size for the hash part */
+  vmk_assert(!hasslots(t));
   /* reset counts */
   for (i = 0; i <= MAXABITS; i++) ct.nums[i] = 0;
   ct.na = 0;
@@ -779,6 +1075,8 @@ static void rehash (vmk_State *L, Table *t, const TValue *ek) {
   }
   /* resize the table to new computed sizes */
   vmkH_resize(L, t, asize, nsize);
+  if (getsite(t) != NULL)
+    vmkH_sample(t, 0);
 }
 
 /*
@@ -786,22 +1084,483 @@ static void rehash (vmk_State *L, Table *t, const TValue *ek) {
 */
 
 
-Table *vmkH_new (vmk_State *L) {
-  GCObject *o = vmkC_newobj(L, VMK_VTABLE, sizeof(Table));
+/*
+** {=============================================================
+** Shapes
+** A table whose keys are all short strings, up to VMKI_MAXSHAPE of
+** them, keeps their values in 'slots', in the order the keys were
+** inserted. The keys themselves are kept in a shape, shared by all
+** tables that got the same keys in the same order (e.g., all tables
+** created by a given constructor). Each shape is a child of the shape
+** with one key less, and a cache maps a parent plus a new key to the
+** child, so that tables adding the same keys reach the same shapes.
+** Shapes are reference counted (by tables and by their children); the
+** collector frees the ones not used at the end of each cycle (see
+** 'vmkH_freeshapes'), so that the cost of freeing a table does not
+** depend on its shape.
+** A table with a shape has no hash part. Any key that cannot go to
+** its slots (a key that is not a short string, a key beyond the limit
+** of VMKI_MAXSHAPE, or a new key in a table with removed fields, which
+** is probably being used as a dictionary) converts the table back to
+** a regular hash part.
+** ==============================================================
+*/
+
+/* minimum size for the cache of shapes */
+#define MINSHAPETB	32
+
+#define sizeshape(n)	(offsetof(Shape, keys) + cast_sizet(n) * sizeof(TString *))
+
+#define shapehash(p,k)	((k)->hash ^ point2uint(p))
+
+
+static void growshapes (vmk_State *L, shapetable *tb) {
+  int osize = tb->size;
+  int size = (osize == 0) ? MINSHAPETB : osize * 2;
+  Shape **hash;
+  int i;
+  if (l_unlikely(osize > INT_MAX / 2))  /* cannot grow? */
+    return;  /* keep using longer chains */
+  hash = vmkM_newvector(L, cast_sizet(size), Shape *);
+  for (i = 0; i < size; i++)
+    hash[i] = NULL;
+  for (i = 0; i < tb->size; i++) {  /* rehash old buckets */
+    Shape *s = tb->hash[i];
+    while (s) {
+      Shape *next = s->hnext;
+      unsigned int h = lmod(s->hash, size);
+      s->hnext = hash[h];
+      hash[h] = s;
+      s = next;
+    }
+  }
+  vmkM_freearray(L, tb->hash, cast_sizet(tb->size));
+  tb->hash = hash;
+  tb->size = size;
+}
+
+
+/*
+** Get the shape with the keys of 'parent' (NULL for no keys) plus
+** 'key', creating it if needed. The caller gets a new reference to
+** the result.
+*/
+static Shape *getchild (vmk_State *L, Shape *parent, TString *key) {
+  shapetable *tb = &G(L)->shapes;
+  unsigned int h = shapehash(parent, key);
+  int n = (parent == NULL) ? 0 : parent->nkeys;
+  Shape **list;
+  Shape *s;
+  if (tb->size > 0) {
+    for (s = tb->hash[lmod(h, tb->size)]; s != NULL; s = s->hnext) {
+      if (s->parent == parent && s->keys[n] == key) {  /* found? */
+        s->nref++;
+        return s;
+      }
+    }
+  }
+  /* else must create a new shape */
+  if (tb->nuse >= tb->size)  /* need to grow cache? */
+    growshapes(L, tb);
+  s = cast(Shape *, vmkM_newblock(L, sizeshape(n + 1)));
+  s->parent = parent;
+  s->nref = 1;
+  s->hash = h;
+  s->nkeys = cast_byte(n + 1);
+  if (parent != NULL) {
+    memcpy(s->keys, parent->keys, cast_sizet(n) * sizeof(TString *));
+    parent->nref++;
+  }
+  s->keys[n] = key;
+  list = &tb->hash[lmod(h, tb->size)];
+  s->hnext = *list;
+  *list = s;
+  tb->nuse++;
+  return s;
+}
+
+
+/* release a reference to shape 's' (which may be NULL) */
+#define unrefshape(s)  \
+	{ Shape *s_ = (s); if (s_) { vmk_assert(s_->nref > 0); s_->nref--; } }
+
+
+/*
+** Free shape 's', which is not used, and then its ancestors that are
+** used only by it. A shape being freed may have dead keys (from tables
+** already collected), but it does not need to access them.
+*/
+static void freeshape (vmk_State *L, Shape *s) {
+  shapetable *tb = &G(L)->shapes;
+  do {
+    Shape *parent = s->parent;
+    Shape **p = &tb->hash[lmod(s->hash, tb->size)];
+    vmk_assert(s->nref == 0);
+    while (*p != s)  /* find previous element */
+      p = &(*p)->hnext;
+    *p = s->hnext;  /* remove element from its list */
+    tb->nuse--;
+    vmkM_freemem(L, s, sizeshape(s->nkeys));
+    s = parent;
+  } while (s != NULL && --s->nref == 0);
+}
+
+
+/*
+** Free all shapes not used by any table. (Meanwhile, they stay in the
+** cache, where they can be reused.)
+*/
+void vmkH_freeshapes (vmk_State *L) {
+  shapetable *tb = &G(L)->shapes;
+  int i;
+  for (i = 0; i < tb->size; i++) {
+    Shape **p = &tb->hash[i];
+    while (*p != NULL) {
+      if ((*p)->nref > 0)
+        p = &(*p)->hnext;
+      else {
+        freeshape(L, *p);
+        p = &tb->hash[i];  /* list may have changed; restart it */
+      }
+    }
+  }
+}
+
+
+/*
+** (Re)allocate the slots of table 't' with the given size, which must
+** be enough for its current fields.
+*/
+static void resizeslots (vmk_State *L, Table *t, unsigned size) {
+  size_t sizeb = sizeslotsb(size);
+  Slotbox *box;
+  TValue *slots;
+  unsigned i = 0;
+  if (!inlineslots(t) &&
+      inlinearrayb(t) + sizeb <= inlinesize(t))  /* fits inline? */
+    box = cast(Slotbox *, inlinearea(t) + tabext(t)->isize - sizeb);
+  else
+    box = cast(Slotbox *, vmkM_newblock(L, sizeb));
+  slots = cast(TValue *, box + 1);
+  box->h.size = size;
+  if (!hasslots(t)) {
+    box->h.shape = NULL;
+    box->h.n = 0;
+  }
+  else {
+    vmk_assert(nslots(t) <= size);
+    box->h = slotbox(t)->h;  /* keep shape and number of fields */
+    box->h.size = size;
+    for (; i < nslots(t); i++)  /* (a field may have become empty) */
+      slots[i] = t->slots[i];  /* raw copy: keeps empty entries */
+    if (!inlineslots(t))
+      vmkM_freemem(L, slotbox(t), sizeslotsb(sizeslots(t)));
+  }
+  for (; i < size; i++)
+    setempty(&slots[i]);
+  t->slots = slots;
+}
+
+
+static void freeslots (vmk_State *L, Table *t) {
+  if (hasslots(t)) {
+    Shape *s = getshape(t);
+    if (!inlineslots(t))
+      vmkM_freemem(L, slotbox(t), sizeslotsb(sizeslots(t)));
+    t->slots = NULL;
+    unrefshape(s);
+  }
+}
+
+
+/*
+** Move the fields of a table with a shape into a new hash part.
+*/
+static void unshape (vmk_State *L, Table *t) {
+  Table newt;  /* to keep the new hash part */
+  unsigned n = nslots(t);
+  unsigned size = 0;
+  unsigned i;
+  for (i = 0; i < n; i++) {  /* count non-empty fields */
+    if (!isempty(&t->slots[i]))
+      size++;
+  }
+  newt.flags = 0;
+  setnodevector(L, &newt, size);
+  exchangehashpart(t, &newt);  /* 't' gets the new (empty) hash part */
+  for (i = 0; i < n; i++) {
+    if (!isempty(&t->slots[i])) {
+      TValue k;
+      setsvalue(L, &k, getshape(t)->keys[i]);
+      newcheckedkey(L, t, &k, &t->slots[i]);
+    }
+  }
+  freeslots(L, t);
+}
+
+
+/*
+** Try to add a new field to the slots of table 't'. A table with no
+** hash part gets slots for its first field with a short-string key.
+** Return 1 if the field was added; otherwise, 't' is left without
+** slots.
+*/
+static int hasremoved (Table *t) {
+  unsigned n = nslots(t);
+  unsigned i;
+  for (i = 0; i < n; i++) {
+    if (isempty(&t->slots[i]))
+      return 1;
+  }
+  return 0;
+}
+
+
+static int newslot (vmk_State *L, Table *t, const TValue *key,
+                                   TValue *value) {
+  Shape *old;
+  unsigned n;
+  int grown = 1;  /* were slots (re)allocated? */
+  if (!hasslots(t)) {
+    if (!isdummy(t) || !ttisshrstring(key))
+      return 0;  /* use the hash part */
+    resizeslots(L, t, 1);
+  }
+  else {
+    n = nslots(t);
+    if (!ttisshrstring(key) || n == VMKI_MAXSHAPE || hasremoved(t)) {
+      unshape(L, t);
+      return 0;
+    }
+    if (n == sizeslots(t)) {  /* no free slot? (grow like a hash part) */
+      resizeslots(L, t, (2 * n < VMKI_MAXSHAPE) ? 2 * n : VMKI_MAXSHAPE);
+      /* the allocation may have run a collection that cleared weak
+         values of this table */
+      if (hasremoved(t)) {
+        unshape(L, t);
+        return 0;
+      }
+    }
+    else
+      grown = 0;
+  }
+  n = nslots(t);
+  old = getshape(t);
+  getshape(t) = getchild(L, old, tsvalue(key));
+  slotbox(t)->h.n = n + 1;
+  setobj2t(L, &t->slots[n], value);
+  unrefshape(old);  /* (it is still used by the new shape) */
+  if (grown && getsite(t) != NULL)
+    vmkH_sample(t, 0);
+  return 1;
+}
+
+
+/*
+** Sizes for a new table with size feedback 'site' (possibly NULL) that
+** will have 'nasize' array elements and 'nhsize' other fields. A few
+** fields go to slots, as they are probably the fields of a record
+** (e.g., the table was created by a constructor like '{x = 1, y = 2}');
+** the table converts to a hash part if they are not. A table created
+** by an OP_NEWTABLE gets at least the sizes reached by the last table
+** measured from that instruction; the fields go to a hash part if that
+** table did not keep them in slots, and the array part is typed like
+** the array part of that table. Returns the tag for that array part
+** (see 'resizetable'), and the number of slots in '*nssize'.
+*/
+static lu_byte presizes (const unsigned int *site, unsigned *nasize,
+                         unsigned *nhsize, unsigned *nssize) {
+  int record = 1;  /* can fields go to slots? */
+  lu_byte atype = 0;  /* tag for a typed array part */
+  if (site != NULL) {
+    unsigned fb = *site;
+    if (fbsize(fbarray(fb)) > *nasize)
+      *nasize = fbsize(fbarray(fb));
+    if (fbsize(fbhash(fb)) > *nhsize)
+      *nhsize = fbsize(fbhash(fb));
+    if (fbhash(fb) > 0 && !fbslots(fb))
+      record = 0;
+    if (fbtyped(fb) != 0)
+      atype = (fbtyped(fb) == 1) ? VMK_VNUMINT : VMK_VNUMFLT;
+  }
+  *nssize = 0;
+  if (record && 0 < *nhsize && *nhsize <= VMKI_MAXSHAPE) {
+    *nssize = *nhsize;
+    *nhsize = 0;
+  }
+  return atype;
+}
+
+
+/*
+** Presize a new table (see 'presizes') for 'nasize' array elements and
+** 'nhsize' other fields.
+*/
+void vmkH_presize (vmk_State *L, Table *t, unsigned nasize,
+                                           unsigned nhsize) {
+  unsigned nssize;
+  lu_byte atype = presizes(getsite(t), &nasize, &nhsize, &nssize);
+  vmk_assert(isdummy(t) && !hasslots(t));
+  if (nssize > 0)
+    resizeslots(L, t, nssize);
+  if (nasize > 0 || nhsize > 0)
+    resizetable(L, t, nasize, nhsize, atype);
+}
+
+/*
+** }=============================================================
+*/
+
+
+/*
+** {=============================================================
+** Size feedback
+** Each OP_NEWTABLE keeps, in its inline cache, the sizes reached by
+** the last table measured among those it created, so that its next
+** tables can be presized (see 'vmkH_presize') instead of growing
+** through several rehashes. A table is measured at each rehash (or
+** growth of its slots) and, for the last time, when the collector
+** first traverses it. The prototype with the instruction cannot be
+** freed while its tables are still to be measured: it was alive when
+** they were created, and any collection that frees it traverses all
+** tables still alive.
+** ==============================================================
+*/
+
+/* size of the 'Table' structure (plus its extension, if any) */
+#define sizetable(t)  \
+	(hasext(t) ? sizeof(Table) + sizeof(Tabext) + inlinesize(t) \
+	           : sizeof(Table))
+
+/* 'ceil(log2(x)) + 1', or zero for an empty part */
+#define fblog(x)	((x) == 0 ? 0u : cast_uint(vmkO_ceillog2(x)) + 1u)
+
+/* kind of the array part of 't' (see 'fbtyped') */
+#define typedfb(t)  \
+	(!hastypedarray(t) ? 0u : (arrtypetag(t) == VMK_VNUMINT) ? 1u : 2u)
+
+
+/*
+** Record the current sizes of table 't' in its site. When 'last' is
+** true, this is the last measure of 't'.
+*/
+void vmkH_sample (Table *t, int last) {
+  unsigned int *site = getsite(t);
+  unsigned nh = (hasslots(t)) ? sizeslots(t) : allocsizenode(t);
+  unsigned samples;
+  vmk_assert(site != NULL);
+  samples = fbsamples(*site);
+  if (samples < 0xFFFFu)
+    samples++;
+  *site = fblog(t->asize) | (fblog(nh) << 6) |
+          ((hasslots(t) ? 1u : 0u) << 12) | (typedfb(t) << 13) |
+          (samples << 16);
+  if (last)
+    tabext(t)->site = NULL;
+}
+
+/*
+** }=============================================================
+*/
+
+
+static Table *newtable (vmk_State *L, size_t size) {
+  GCObject *o = vmkC_newobj(L, VMK_VTABLE, size);
   Table *t = gco2t(o);
   t->metatable = NULL;
   t->flags = maskflags;  /* table has no metamethod fields */
   t->array = NULL;
   t->asize = 0;
+  t->slots = NULL;
   setnodevector(L, t, 0);
   return t;
 }
 
 
+Table *vmkH_new (vmk_State *L) {
+  return newtable(L, sizeof(Table));
+}
+
+
+/*
+** Creates a table that will be presized (see 'vmkH_presize') for
+** 'nasize' array elements and 'nhsize' other fields, for the
+** OP_NEWTABLE with size feedback 'site' (NULL if none). When its array
+** part and slots are small enough, the table gets an inline area for
+** them.
+*/
+Table *vmkH_newsized (vmk_State *L, unsigned int *site,
+                                    unsigned nasize, unsigned nhsize) {
+  unsigned nssize;
+  unsigned isize;
+  Table *t;
+  presizes(site, &nasize, &nhsize, &nssize);
+  isize = inlinesizefor(nasize, nssize);
+  if (site == NULL && isize == 0)
+    return vmkH_new(L);
+  t = newtable(L, sizeof(Table) + sizeof(Tabext) + isize);
+  t->flags |= BITEXT;
+  tabext(t)->site = site;
+  tabext(t)->isize = isize;
+  return t;
+}
+
+
+/*
+** Copy all entries of table 't' into table 'nt', which must be a new
+** table created by 'vmkH_newsized' for the array size of 't' and the
+** number of its slots (zero if it has none). Each part of 'nt' gets
+** the same layout as the part of 't' (including its sizes, its form,
+** and the positions of its keys), so that it is a plain copy of that
+** part, without reinsertions. 'nt' is left valid after each allocation,
+** as an emergency collection may traverse it.
+*/
+void vmkH_copy (vmk_State *L, Table *nt, Table *t) {
+  unsigned asize = t->asize;
+  vmk_assert(nt->asize == 0 && isdummy(nt) && !hasslots(nt));
+  invalidateTMcache(nt);  /* 'nt' may get metamethod fields */
+  if (asize > 0) {  /* copy array part */
+    lu_byte atype = isarrtyped(t) ? arrtypetag(t) : 0;
+    Value *np = resizearray(L, nt, 0, asize, atype);
+    if (l_unlikely(np == NULL))
+      vmkM_error(L);
+    memcpy(np - asize, t->array - asize, arraysizeb(t));
+    nt->array = np;
+    nt->asize = asize;
+  }
+  if (!isdummy(t)) {  /* copy hash part */
+    size_t extra = extraLastfree(t);
+    size_t bsize = sizehash(t);
+    char *node = cast_charp(vmkM_newblock(L, bsize));
+    memcpy(node, cast_charp(t->node) - extra, bsize);
+    nt->node = cast(Node *, node + extra);
+    nt->lsizenode = t->lsizenode;
+    setnodummy(nt);
+    if (haslastfree(nt))  /* 'lastfree' must point into the new nodes */
+      getlastfree(nt) = gnode(nt, getlastfree(t) - t->node);
+  }
+  if (hasslots(t)) {  /* copy slots */
+    unsigned n = nslots(t);
+    unsigned i;
+    resizeslots(L, nt, sizeslots(t));
+    getshape(nt) = getshape(t);
+    if (getshape(nt) != NULL)
+      getshape(nt)->nref++;
+    slotbox(nt)->h.n = n;
+    for (i = 0; i < n; i++)
+      setobj(L, &nt->slots[i], &t->slots[i]);
+  }
+  if (isblack(nt))  /* 'nt' survived a collection while being filled? */
+    vmkC_barrierback_(L, obj2gco(nt));
+}
+
+
 lu_mem vmkH_size (Table *t) {
-  lu_mem sz = cast(lu_mem, sizeof(Table)) + concretesize(t->asize);
+  lu_mem sz = cast(lu_mem, sizetable(t)) + arraysizeb(t) - inlinearrayb(t);
   if (!isdummy(t))
     sz += sizehash(t);
+  if (hasslots(t))
+    sz += sizeslotsb(sizeslots(t)) - inlineslotsb(t);
   return sz;
 }
 
@@ -811,8 +1570,9 @@ lu_mem vmkH_size (Table *t) {
 */
 void vmkH_free (vmk_State *L, Table *t) {
   freehash(L, t);
-  resizearray(L, t, t->asize, 0);
-  vmkM_free(L, t);
+  freeslots(L, t);
+  resizearray(L, t, t->asize, 0, 0);
+  vmkC_freeobject(L, t, sizetable(t));
 }
 
 
@@ -885,14 +1645,68 @@ static int insertkey (Table *t, const TValue *key, TValue *value) {
 }
 
 
+/*
+** Try to set entry with C-index 'u' in the typed array part of 't' to
+** 'val', keeping that form: a value with the tag of the part can
+** replace an entry or be appended to the sequence, and the last entry
+** can be removed. Returns whether it could.
+*/
+static int settyped (Table *t, unsigned u, const TValue *val) {
+  unsigned *border = lenborder(t);
+  if (rawtt(val) == arrtypetag(t)) {
+    if (u > *border)
+      return 0;  /* would make a hole */
+    else if (u == *border)
+      (*border)++;  /* append */
+    *getArrVal(t, u) = val->value_;
+    return 1;
+  }
+  else if (isempty(val)) {
+    if (u + 1 == *border)
+      (*border)--;  /* remove last entry */
+    return (u + 1 >= *border);  /* (entries after the border are empty) */
+  }
+  else
+    return 0;  /* value of another type */
+}
+
+
+/*
+** 'pset' for a typed array part, for the cases 'vmkH_fastseti' does not
+** handle itself. An entry after the border is empty, so there may be a
+** metamethod to call.
+*/
+int vmkH_psettyped (Table *t, unsigned u, TValue *val) {
+  if (u >= *lenborder(t) && !checknoTM(t->metatable, TM_NEWINDEX))
+    return ~cast_int(u);
+  return settyped(t, u, val) ? HOK : HUNTYPE;
+}
+
+
+/*
+** Set entry with C-index 'u' in the array part of 't' to 'val'. (The
+** entry may be absent, so the caller must have checked metamethods.)
+*/
+void vmkH_setarray (vmk_State *L, Table *t, unsigned u, TValue *val) {
+  if (isarrtyped(t)) {
+    if (settyped(t, u, val))
+      return;  /* done */
+    vmkH_untype(L, t);  /* else the array part must become generic */
+  }
+  obj2arr(t, u, val);
+  vmkH_setborder(t, u, val);
+}
+
+
 /*
 ** Insert a key in a table where there is space for that key, the
 ** key is valid, and the value is not nil.
 */
-static void newcheckedkey (Table *t, const TValue *key, TValue *value) {
+static void newcheckedkey (vmk_State *L, Table *t, const TValue *key,
+                                         TValue *value) {
   unsigned i = keyinarray(t, key);
   if (i > 0)  /* is key in the array part? */
-    obj2arr(t, i - 1, value);  /* set value in the array */
+    vmkH_setarray(L, t, i - 1, value);  /* set value in the array */
   else {
     int done = insertkey(t, key, value);  /* insert key in the hash part */
     vmk_assert(done);  /* it cannot fail */
@@ -904,10 +1718,12 @@ static void newcheckedkey (Table *t, const TValue *key, TValue *value) {
 static void vmkH_newkey (vmk_State *L, Table *t, const TValue *key,
                                                  TValue *value) {
   if (!ttisnil(value)) {  /* do not insert nil values */
-    int done = insertkey(t, key, value);
-    if (!done) {  /* could not find a free place? */
-      rehash(L, t, key);  /* grow table */
-      newcheckedkey(t, key, value);  /* insert key in grown table */
+    if (!newslot(L, t, key, value)) {  /* not a field in a shape? */
+      int done = insertkey(t, key, value);
+      if (!done) {  /* could not find a free place? */
+        rehash(L, t, key);  /* grow table */
+        newcheckedkey(L, t, key, value);  /* insert key in grown table */
+      }
     }
     vmkC_barrierback(L, obj2gco(t), key);
     /* for debugging only: any new key may force an emergency collection */
@@ -949,7 +1765,7 @@ static lu_byte finishnodeget (const TValue *val, TValue *res) {
 lu_byte vmkH_getint (Table *t, vmk_Integer key, TValue *res) {
   unsigned k = ikeyinarray(t, key);
   if (k > 0) {
-    lu_byte tag = *getArrTag(t, k - 1);
+    lu_byte tag = arrtag(t, k - 1);
     if (!tagisempty(tag))
       farr2val(t, k - 1, tag, res);
     return tag;
@@ -970,8 +1786,8 @@ const TValue *vmkH_Hgetshortstr (Table *t, TString *key) {
       return gval(n);  /* that's it */
     else {
       int nx = gnext(n);
-      if (nx == 0)
-        return &absentkey;  /* not found */
+      if (nx == 0)  /* not found? (always the case with slots) */
+        return (hasslots(t)) ? getslot(t, key) : &absentkey;
       n += nx;
     }
   }
@@ -983,6 +1799,28 @@ lu_byte vmkH_getshortstr (Table *t, TString *key, TValue *res) {
 }
 
 
+/*
+** Index of the node (or the slot, in a table with a shape) holding a
+** value, which cannot be the absent key.
+*/
+#define slotindex(t,slot)  \
+	(hasslots(t) ? cast_uint((slot) - (t)->slots)  \
+	             : cast_uint(nodefromval(slot) - gnode(t, 0)))
+
+
+/*
+** Slow path of 'vmkH_fastgetshortstr': do a regular search and, if
+** the key is in the table, update the inline cache 'ic'.
+*/
+lu_byte vmkH_getshortstrIC (Table *t, TString *key, TValue *res,
+                                      unsigned *ic) {
+  const TValue *slot = vmkH_Hgetshortstr(t, key);
+  if (!isabstkey(slot))
+    *ic = slotindex(t, slot);
+  return finishnodeget(slot, res);
+}
+
+
 static const TValue *Hgetlongstr (Table *t, TString *key) {
   TValue ko;
   vmk_assert(!strisshr(key));
@@ -1039,8 +1877,8 @@ lu_byte vmkH_get (Table *t, const TValue *key, TValue *res) {
 static int retpsetcode (Table *t, const TValue *slot) {
   if (isabstkey(slot))
     return HNOTFOUND;  /* no slot with that key */
-  else  /* return node encoded */
-    return cast_int((cast(Node*, slot) - t->node)) + HFIRSTNODE;
+  else  /* return node (or slot) encoded */
+    return cast_int(slotindex(t, slot)) + HFIRSTNODE;
 }
 
 
@@ -1079,14 +1917,14 @@ static int psetint (Table *t, vmk_Integer key, TValue *val) {
 
 /*
 ** This fn could be just this:
-**    return finishnodeset(t, vmkH_Hgetshortstr(t, key), val);
+**    return finishnodeset(t, slot, val);
 ** However, it optimizes the common case created by constructors (e.g.,
 ** {x=1, y=2}), which creates a key in a table that has no metatable,
 ** it is not old/black, and it already has space for the key.
+** ('slot' is the result of 'vmkH_Hgetshortstr(t, key)'.)
 */
-
-int vmkH_psetshortstr (Table *t, TString *key, TValue *val) {
-  const TValue *slot = vmkH_Hgetshortstr(t, key);
+static int psetshortstr (Table *t, TString *key, TValue *val,
+                                   const TValue *slot) {
   if (!ttisnil(slot)) {  /* key already has a value? (all too common) */
     setobj(((vmk_State*)NULL), cast(TValue*, slot), val);  /* update it */
     return HOK;  /* done */
@@ -1111,6 +1949,24 @@ int vmkH_psetshortstr (Table *t, TString *key, TValue *val) {
 }
 
 
+int vmkH_psetshortstr (Table *t, TString *key, TValue *val) {
+  return psetshortstr(t, key, val, vmkH_Hgetshortstr(t, key));
+}
+
+
+/*
+** Slow path of 'vmkH_fastsetshortstr': update the inline cache 'ic'
+** if the key is in the table, then do a regular 'pset'.
+*/
+int vmkH_psetshortstrIC (Table *t, TString *key, TValue *val,
+                                   unsigned *ic) {
+  const TValue *slot = vmkH_Hgetshortstr(t, key);
+  if (!isabstkey(slot))
+    *ic = slotindex(t, slot);
+  return psetshortstr(t, key, val, slot);
+}
+
+
 int vmkH_psetstr (Table *t, TString *key, TValue *val) {
   if (strisshr(key))
     return vmkH_psetshortstr(t, key, val);
@@ -1160,12 +2016,17 @@ void vmkH_finishset (vmk_State *L, Table *t, const TValue *key,
     }
     vmkH_newkey(L, t, key, value);
   }
-  else if (hres > 0) {  /* regular Node? */
-    setobj2t(L, gval(gnode(t, hres - HFIRSTNODE)), value);
+  else if (hres == HUNTYPE) {  /* store that a typed array cannot keep? */
+    vmkH_untype(L, t);
+    vmkH_set(L, t, key, value);
+  }
+  else if (hres > 0) {  /* regular Node (or slot)? */
+    TValue *slot = (hasslots(t)) ? &t->slots[hres - HFIRSTNODE]
+                                 : gval(gnode(t, hres - HFIRSTNODE));
+    setobj2t(L, slot, value);
   }
   else {  /* array entry */
-    hres = ~hres;  /* real index */
-    obj2arr(t, cast_uint(hres), value);
+    vmkH_setarray(L, t, cast_uint(~hres), value);
   }
 }
 
@@ -1188,7 +2049,7 @@ void vmkH_set (vmk_State *L, Table *t, const TValue *key, TValue *value) {
 void vmkH_setint (vmk_State *L, Table *t, vmk_Integer key, TValue *value) {
   unsigned ik = ikeyinarray(t, key);
   if (ik > 0)
-    obj2arr(t, ik - 1, value);
+    vmkH_setarray(L, t, ik - 1, value);
   else {
     int ok = rawfinishnodeset(getintfromhash(t, key), value);
     if (!ok) {
@@ -1261,7 +2122,8 @@ static vmk_Unsigned newhint (Table *t, unsigned hint) {
 ** Try to find a border in table 't'. (A 'border' is an integer index
 ** such that t[i] is present and t[i+1] is absent, or 0 if t[1] is absent,
 ** or 'maxinteger' if t[maxinteger] is present.)
-** If there is an array part, try to find a border there. First try
+** If the array part is a proper sequence, its border is known. Otherwise,
+** if there is an array part, try to find a border there. First try
 ** to find it in the vicinity of the previous result (hint), to handle
 ** cases like 't[#t + 1] = val' or 't[#t] = nil', that move the border
 ** by one entry. Otherwise, do a binary search to find the border.
@@ -1270,7 +2132,9 @@ static vmk_Unsigned newhint (Table *t, unsigned hint) {
 */
 vmk_Unsigned vmkH_getn (Table *t) {
   unsigned asize = t->asize;
-  if (asize > 0) {  /* is there an array part? */
+  if (asize > 0 && *lenborder(t) < asize)  /* border known to be there? */
+    return *lenborder(t);
+  else if (asize > 0 && *lenborder(t) == NOBORDER) {  /* holes? */
     const unsigned maxvicinity = 4;
     unsigned limit = *lenhint(t);  /* start with the hint */
     if (limit == 0)
@@ -36,6 +36,49 @@
 #define setdummy(t)		((t)->flags |= BITDUMMY)
 
 
+/*
+** Bit BITEXT set in 'flags' means the 'Table' structure is followed by
+** a 'Tabext'. Its 'site' points to the size feedback (the inline cache
+** of the instruction) of the OP_NEWTABLE ("site") that created the
+** table, if any; it becomes NULL when the table has been measured for
+** the last time (see 'vmkH_sample'). The 'Tabext' is followed by an
+** inline area of 'isize' bytes, where a small table keeps its array
+** part (at the start) and its slots (at the end), so that it needs no
+** other blocks (see 'vmkH_newsized').
+*/
+typedef struct Tabext {
+  unsigned int *site;  /* size feedback of its site, or NULL */
+  unsigned int isize;  /* size of the inline area */
+} Tabext;
+
+#define BITEXT			(1 << 7)
+#define hasext(t)		((t)->flags & BITEXT)
+#define tabext(t)		cast(Tabext *, cast(Table *, t) + 1)
+#define getsite(t)		(hasext(t) ? tabext(t)->site : NULL)
+
+/* maximum size of the inline area of a table */
+#if !defined(VMKI_INLINESIZE)
+#define VMKI_INLINESIZE		128
+#endif
+
+
+/*
+** Size feedback of a site: the sizes reached by the last table
+** measured from that site, as 'ceil(log2(size)) + 1' (zero for an
+** empty part), whether its hash part was kept in slots, the kind of
+** its array part (0 generic, 1 typed with integers, 2 typed with
+** floats), and the number of tables measured.
+*/
+#define fbarray(fb)		((fb) & 0x3Fu)
+#define fbhash(fb)		(((fb) >> 6) & 0x3Fu)
+#define fbslots(fb)		(((fb) >> 12) & 1u)
+#define fbtyped(fb)		(((fb) >> 13) & 3u)
+#define fbsamples(fb)		((fb) >> 16)
+
+/* size given by a 'fbarray' or 'fbhash' */
+#define fbsize(l)		((l) == 0 ? 0u : 1u << ((l) - 1))
+
+
 
 /* allocated size for hash nodes */
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
@@ -45,11 +88,48 @@
 #define nodefromval(v)	cast(Node *, (v))
 
 
+/* maximum number of fields kept in the slots of a table with a shape */
+#if !defined(VMKI_MAXSHAPE)
+#define VMKI_MAXSHAPE		16
+#endif
+
+
+/*
+** The slots of a table with a shape are preceded, in the same block,
+** by a 'Slotbox' with the shape (NULL while there are no fields yet),
+** the number of fields, and the number of allocated slots. A table
+** with slots has no hash part (it uses the dummy node).
+*/
+typedef union {
+  struct {
+    Shape *shape;
+    unsigned int n;  /* number of fields (keys in 'shape') */
+    unsigned int size;  /* number of allocated slots */
+  } h;
+  TValue dummy;  /* ensures that the slots are properly aligned */
+} Slotbox;
+
+#define hasslots(t)	((t)->slots != NULL)
+#define slotbox(t)	(cast(Slotbox *, (t)->slots) - 1)
+#define getshape(t)	(slotbox(t)->h.shape)
+#define sizeslots(t)	(slotbox(t)->h.size)
+
+/* size of a block with 'n' slots */
+#define sizeslotsb(n)	(sizeof(Slotbox) + cast_sizet(n) * sizeof(TValue))
+
+/* number of fields in the slots of a table (zero if it has no slots) */
+#define nslots(t)	(hasslots(t) ? slotbox(t)->h.n : 0u)
+
+/* true iff the inline cache 'ic' has the slot of key 'k' in table 't' */
+#define slotIC(t,k,ic)  \
+	(*(ic) < nslots(t) && getshape(t)->keys[*(ic)] == (k))
+
+
 
 #define vmkH_fastgeti(t,k,res,tag) \
   { Table *h = t; vmk_Unsigned u = l_castS2U(k) - 1u; \
     if ((u < h->asize)) { \
-      tag = *getArrTag(h, u); \
+      tag = arrtag(h, u); \
       if (!tagisempty(tag)) { farr2val(h, u, tag, res); }} \
     else { tag = vmkH_getint(h, (k), res); }}
 
@@ -57,18 +137,55 @@
 #define vmkH_fastseti(t,k,val,hres) \
   { Table *h = t; vmk_Unsigned u = l_castS2U(k) - 1u; \
     if ((u < h->asize)) { \
-      lu_byte *tag = getArrTag(h, u); \
-      if (checknoTM(h->metatable, TM_NEWINDEX) || !tagisempty(*tag)) \
-        { fval2arr(h, u, tag, val); hres = HOK; } \
-      else hres = ~cast_int(u); } \
+      if (!isarrtyped(h)) { \
+        lu_byte *tag = getArrTag(h, u); \
+        if (checknoTM(h->metatable, TM_NEWINDEX) || !tagisempty(*tag)) \
+          { fval2arr(h, u, tag, val); vmkH_setborder(h, u, val); \
+            hres = HOK; } \
+        else hres = ~cast_int(u); } \
+      else if (rawtt(val) == arrtypetag(h) && u < *lenborder(h)) \
+        { *getArrVal(h, u) = (val)->value_; hres = HOK; } \
+      else hres = vmkH_psettyped(h, cast_uint(u), val); } \
     else { hres = vmkH_psetint(h, k, val); }}
 
 
+/*
+** Fast track for 't[k]', with 'k' a short string, using the inline
+** cache 'ic' (see 'vmkH_getshortstrIC'). The cache keeps the index of
+** the node (or slot) where the key was found; that index is validated
+** by the key itself, so the cache never needs invalidation (e.g.,
+** after a rehash): a stale index just misses.
+*/
+#define vmkH_fastgetshortstr(t,k,res,tag,ic) \
+  { Table *h = t; Node *n = gnode(h, *(ic) & (sizenode(h) - 1u)); \
+    if (keyisshrstr(n) && keystrval(n) == (k)) { \
+      tag = ttypetag(gval(n)); \
+      if (!tagisempty(tag)) { setobj(cast(vmk_State *, NULL), res, gval(n)); }} \
+    else if (slotIC(h, k, ic)) { \
+      const TValue *s = &h->slots[*(ic)]; tag = ttypetag(s); \
+      if (!tagisempty(tag)) { setobj(cast(vmk_State *, NULL), res, s); }} \
+    else { tag = vmkH_getshortstrIC(h, k, res, ic); }}
+
+
+/*
+** Fast track for 't[k] = val', with 'k' a short string already present
+** in the table, using the inline cache 'ic'.
+*/
+#define vmkH_fastsetshortstr(t,k,val,hres,ic) \
+  { Table *h = t; Node *n = gnode(h, *(ic) & (sizenode(h) - 1u)); \
+    if (keyisshrstr(n) && keystrval(n) == (k) && !ttisnil(gval(n))) { \
+      setobj(cast(vmk_State *, NULL), gval(n), val); hres = HOK; } \
+    else if (slotIC(h, k, ic) && !ttisnil(&h->slots[*(ic)])) { \
+      setobj(cast(vmk_State *, NULL), &h->slots[*(ic)], val); hres = HOK; } \
+    else { hres = vmkH_psetshortstrIC(h, k, val, ic); }}
+
+
 /* results from pset */
 #define HOK		0
 #define HNOTFOUND	1
 #define HNOTATABLE	2
-#define HFIRSTNODE	3
+#define HUNTYPE		3
+#define HFIRSTNODE	4
 
 /*
 ** 'vmkH_get*' operations set 'res', unless the value is absent, and
@@ -79,10 +196,15 @@
 ** slot with that key but with no value, 'vmkH_pset*' return an encoding
 ** of where the key is (usually called 'hres'). (pset cannot set that
 ** value because there might be a metamethod.) If the slot is in the
-** hash part, the encoding is (HFIRSTNODE + hash index); if the slot is
-** in the array part, the encoding is (~array index), a negative value.
+** hash part (or in the slots of a table with a shape), the encoding is
+** (HFIRSTNODE + hash index); if the slot is in the array part, the
+** encoding is (~array index), a negative value.
 ** The value HNOTATABLE is used by the fast macros to signal that the
-** value being indexed is not a table.
+** value being indexed is not a table. The value HUNTYPE signals that
+** the key is in a typed array part that cannot keep the new value;
+** that part must be converted with 'vmkH_untype' before the value
+** can be set. (The key may be present, so any metamethod must be
+** ignored.)
 ** (The size for the array part is limited by the maximum power of two
 ** that fits in an unsigned integer; that is INT_MAX+1. So, the C-index
 ** ranges from 0, which encodes to -1, to INT_MAX, which encodes to
@@ -95,14 +217,15 @@
 /*
 ** The array part of a table is represented by an inverted array of
 ** values followed by an array of tags, to avoid wasting space with
-** padding. In between them there is an unsigned int, explained later.
-** The 'array' pointer points between the two arrays, so that values are
-** indexed with negative indices and tags with non-negative indices.
-
-             Values                              Tags
-  --------------------------------------------------------
-  ...  |   Value 1     |   Value 0     |unsigned|0|1|...
-  --------------------------------------------------------
+** padding. In between them there are two unsigned ints, explained
+** later. The 'array' pointer points between the two arrays, so that
+** values are indexed with negative indices and tags with non-negative
+** indices.
+
+             Values                                       Tags
+  -----------------------------------------------------------------
+  ...  |   Value 1     |   Value 0     |unsigned|unsigned|0|1|...
+  -----------------------------------------------------------------
                                        ^ t->array
 
 ** All accesses to 't->array' should be through the macros 'getArrTag'
@@ -110,7 +233,8 @@
 */
 
 /* Computes the address of the tag for the abstract C-index 'k' */
-#define getArrTag(t,k)	(cast(lu_byte*, (t)->array) + sizeof(unsigned) + (k))
+#define getArrTag(t,k)  \
+	(cast(lu_byte*, (t)->array) + 2 * sizeof(unsigned) + (k))
 
 /* Computes the address of the value for the abstract C-index 'k' */
 #define getArrVal(t,k)	((t)->array - 1 - (k))
@@ -124,11 +248,59 @@
 #define lenhint(t)	cast(unsigned*, (t)->array)
 
 
+/*
+** The second unsigned is the exact border of the array part when that
+** part is a proper sequence (all entries up to the border present and
+** all entries after it empty), or NOBORDER when that is not known.
+** Every store into the array part must keep it (see 'vmkH_setborder'),
+** so that vmkH_getn only searches for a border when the array part
+** may have holes.
+*/
+#define lenborder(t)	(cast(unsigned*, (t)->array) + 1)
+
+#define NOBORDER	(~0u)
+
+
+/*
+** Update the border of 't' after entry with C-index 'u' in its array
+** part was set to 'val': appending or removing the last entry moves
+** the border by one; any other change of an entry from or to empty
+** makes a hole (or may fill one).
+*/
+#define vmkH_setborder(t,u,val) \
+  { unsigned *b_ = lenborder(t); unsigned u_ = cast_uint(u); \
+    if (!isempty(val)) { \
+      if (u_ >= *b_) *b_ = (u_ == *b_) ? u_ + 1 : NOBORDER; } \
+    else if (u_ < *b_) *b_ = (u_ + 1 == *b_) ? u_ : NOBORDER; }
+
+
+/*
+** A "typed" array part has no tags: all its entries before the border
+** are numbers with the same variant tag, and all entries after the
+** border are empty. Its first unsigned, as it needs no hint, holds that
+** tag, as 'typedhint(tag)' (larger than any hint). The collector does
+** not traverse typed array parts. A store that does not keep that form
+** makes the array part generic again (see 'vmkH_untype').
+*/
+#define typedhint(tag)		(0xFFFFFF00u | cast_uint(tag))
+#define isarrtyped(t)		(*lenhint(t) >= 0xFFFFFF00u)
+#define arrtypetag(t)		cast_byte(*lenhint(t) & 0xFFu)
+
+/* true iff 't' has a typed array part */
+#define hastypedarray(t)	((t)->asize > 0 && isarrtyped(t))
+
+/* tag of entry with C-index 'k' in the array part of 't' */
+#define arrtag(t,k)  \
+	(isarrtyped(t) \
+	  ? ((k) < *lenborder(t) ? arrtypetag(t) : cast_byte(VMK_VEMPTY)) \
+	  : *getArrTag(t,k))
+
+
 /*
 ** Move TValues to/from arrays, using C indices
 */
 #define arr2obj(h,k,val)  \
-  ((val)->tt_ = *getArrTag(h,(k)), (val)->value_ = *getArrVal(h,(k)))
+  ((val)->tt_ = arrtag(h,(k)), (val)->value_ = *getArrVal(h,(k)))
 
 #define obj2arr(h,k,val)  \
   (*getArrTag(h,(k)) = (val)->tt_, *getArrVal(h,(k)) = (val)->value_)
@@ -148,6 +320,8 @@
 
 VMKI_FUNC lu_byte vmkH_get (Table *t, const TValue *key, TValue *res);
 VMKI_FUNC lu_byte vmkH_getshortstr (Table *t, TString *key, TValue *res);
+VMKI_FUNC lu_byte vmkH_getshortstrIC (Table *t, TString *key, TValue *res,
+                                                unsigned *ic);
 VMKI_FUNC lu_byte vmkH_getstr (Table *t, TString *key, TValue *res);
 VMKI_FUNC lu_byte vmkH_getint (Table *t, vmk_Integer key, TValue *res);
 
@@ -156,8 +330,13 @@ VMKI_FUNC const TValue *vmkH_Hgetshortstr (Table *t, TString *key);
 
 VMKI_FUNC int vmkH_psetint (Table *t, vmk_Integer key, TValue *val);
 VMKI_FUNC int vmkH_psetshortstr (Table *t, TString *key, TValue *val);
+VMKI_FUNC int vmkH_psetshortstrIC (Table *t, TString *key, TValue *val,
+                                             unsigned *ic);
 VMKI_FUNC int vmkH_psetstr (Table *t, TString *key, TValue *val);
 VMKI_FUNC int vmkH_pset (Table *t, const TValue *key, TValue *val);
+VMKI_FUNC int vmkH_psettyped (Table *t, unsigned u, TValue *val);
+VMKI_FUNC void vmkH_setarray (vmk_State *L, Table *t, unsigned u,
+                                                TValue *val);
 
 VMKI_FUNC void vmkH_setint (vmk_State *L, Table *t, vmk_Integer key,
                                                     TValue *value);
@@ -167,12 +346,22 @@ VMKI_FUNC void vmkH_set (vmk_State *L, Table *t, const TValue *key,
 VMKI_FUNC void vmkH_finishset (vmk_State *L, Table *t, const TValue *key,
                                               TValue *value, int hres);
 VMKI_FUNC Table *vmkH_new (vmk_State *L);
+VMKI_FUNC Table *vmkH_newsized (vmk_State *L, unsigned int *site,
+                                 unsigned nasize, unsigned nhsize);
 VMKI_FUNC void vmkH_resize (vmk_State *L, Table *t, unsigned nasize,
                                                     unsigned nhsize);
 VMKI_FUNC void vmkH_resizearray (vmk_State *L, Table *t, unsigned nasize);
+VMKI_FUNC void vmkH_untype (vmk_State *L, Table *t);
+VMKI_FUNC void vmkH_presize (vmk_State *L, Table *t, unsigned nasize,
+                                                     unsigned nhsize);
+VMKI_FUNC void vmkH_sample (Table *t, int last);
+VMKI_FUNC void vmkH_copy (vmk_State *L, Table *nt, Table *t);
 VMKI_FUNC lu_mem vmkH_size (Table *t);
 VMKI_FUNC void vmkH_free (vmk_State *L, Table *t);
+VMKI_FUNC void vmkH_freeshapes (vmk_State *L);
 VMKI_FUNC int vmkH_next (vmk_State *L, Table *t, StkId key);
+VMKI_FUNC int vmkH_nextcursor (vmk_State *L, Table *t, StkId key,
+                                                  unsigned *cursor);
 VMKI_FUNC vmk_Unsigned vmkH_getn (Table *t);
 
 
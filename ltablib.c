@@ -69,6 +69,15 @@ static int tcreate (vmk_State *L) {
 }
 
 
+static int tclone (vmk_State *L) {
+  vmkL_checktype(L, 1, VMK_TTABLE);
+  vmk_clonetable(L, 1);
+  if (vmk_getmetatable(L, 1))  /* original has a metatable? */
+    vmk_setmetatable(L, -2);  /* clone gets the same one */
+  return 1;
+}
+
+
 static int tinsert (vmk_State *L) {
   vmk_Integer pos;  /* where to insert new element */
   vmk_Integer e = aux_getn(L, 1, TAB_RW);
@@ -407,6 +416,7 @@ static int sort (vmk_State *L) {
 
 
 static const vmkL_Reg tab_funcs[] = {
+  {"clone", tclone},
   {"concat", tconcat},
   {"create", tcreate},
   {"insert", tinsert},
@@ -0,0 +1,114 @@
+/*
+** $Id: ltailtab.h $
+** List of opcode functions for the tail-call Vmk interpreter
+** See Copyright Notice in vmk.h
+*/
+
+/*
+** 'lvm.c' includes this list twice, with different definitions for
+** 'vmop': once to declare the functions and once to build the table.
+*/
+
+#if 0
+** you can update the following list with this command:
+**
+**  sed -n '/^OP_/\!d; s/OP_/vmop(OP_/ ; s/[ ,\/].*// ; s/$/)/ ; p'  lopcodes.h
+**
+#endif
+
+vmop(OP_MOVE)
+vmop(OP_LOADI)
+vmop(OP_LOADF)
+vmop(OP_LOADK)
+vmop(OP_LOADKX)
+vmop(OP_LOADFALSE)
+vmop(OP_LFALSESKIP)
+vmop(OP_LOADTRUE)
+vmop(OP_LOADNIL)
+vmop(OP_GETUPVAL)
+vmop(OP_SETUPVAL)
+vmop(OP_GETTABUP)
+vmop(OP_GETTABLE)
+vmop(OP_GETI)
+vmop(OP_GETFIELD)
+vmop(OP_SETTABUP)
+vmop(OP_SETTABLE)
+vmop(OP_SETI)
+vmop(OP_SETFIELD)
+vmop(OP_NEWTABLE)
+vmop(OP_SELF)
+vmop(OP_ADDI)
+vmop(OP_ADDK)
+vmop(OP_SUBK)
+vmop(OP_MULK)
+vmop(OP_MODK)
+vmop(OP_POWK)
+vmop(OP_DIVK)
+vmop(OP_IDIVK)
+vmop(OP_BANDK)
+vmop(OP_BORK)
+vmop(OP_BXORK)
+vmop(OP_SHRI)
+vmop(OP_SHLI)
+vmop(OP_ADD)
+vmop(OP_SUB)
+vmop(OP_MUL)
+vmop(OP_MOD)
+vmop(OP_POW)
+vmop(OP_DIV)
+vmop(OP_IDIV)
+vmop(OP_BAND)
+vmop(OP_BOR)
+vmop(OP_BXOR)
+vmop(OP_SHL)
+vmop(OP_SHR)
+vmop(OP_MMBIN)
+vmop(OP_MMBINI)
+vmop(OP_MMBINK)
+vmop(OP_UNM)
+vmop(OP_BNOT)
+vmop(OP_NOT)
+vmop(OP_LEN)
+vmop(OP_CONCAT)
+vmop(OP_CLOSE)
+vmop(OP_TBC)
+vmop(OP_JMP)
+vmop(OP_EQ)
+vmop(OP_LT)
+vmop(OP_LE)
+vmop(OP_EQK)
+vmop(OP_EQI)
+vmop(OP_LTI)
+vmop(OP_LEI)
+vmop(OP_GTI)
+vmop(OP_GEI)
+vmop(OP_TEST)
+vmop(OP_TESTSET)
+vmop(OP_CALL)
+vmop(OP_TAILCALL)
+vmop(OP_RETURN)
+vmop(OP_RETURN0)
+vmop(OP_RETURN1)
+vmop(OP_FORLOOP)
+vmop(OP_FORPREP)
+vmop(OP_TFORPREP)
+vmop(OP_TFORCALL)
+vmop(OP_TFORLOOP)
+vmop(OP_SETLIST)
+vmop(OP_CLOSURE)
+vmop(OP_VARARG)
+vmop(OP_VARARGPREP)
+vmop(OP_EXTRAARG)
+vmop(OP_ADDINT)
+vmop(OP_ADDFLT)
+vmop(OP_SUBINT)
+vmop(OP_SUBFLT)
+vmop(OP_MULINT)
+vmop(OP_MULFLT)
+vmop(OP_LTINT)
+vmop(OP_LTFLT)
+vmop(OP_LEINT)
+vmop(OP_LEFLT)
+vmop(OP_GETTABUPF)
+vmop(OP_SELFCALL)
+vmop(OP_MOVECALL)
@@ -404,6 +404,20 @@ static void checktable (global_State *g, Table *h) {
     TValue aux;
     arr2obj(h, i, &aux);
     checkvalref(g, hgc, &aux);
+    if (*lenborder(h) != NOBORDER)  /* known border? */
+      assert(isempty(&aux) == (i >= *lenborder(h)));
+  }
+  if (hastypedarray(h)) {
+    assert(arrtypetag(h) == VMK_VNUMINT || arrtypetag(h) == VMK_VNUMFLT);
+    assert(*lenborder(h) <= asize);
+  }
+  if (hasslots(h)) {
+    assert(isdummy(h) && nslots(h) <= sizeslots(h));
+    assert(nslots(h) == 0 || getshape(h)->nkeys == nslots(h));
+    for (i = 0; i < nslots(h); i++) {
+      checkobjref(g, hgc, obj2gco(getshape(h)->keys[i]));
+      checkvalref(g, hgc, &h->slots[i]);
+    }
   }
   for (n = gnode(h, 0); n < limit; n++) {
     if (!isempty(gval(n))) {
@@ -440,6 +454,8 @@ static void checkproto (global_State *g, Proto *f) {
     checkobjrefN(g, fgc, f->p[i]);
   for (i=0; i<f->sizelocvars; i++)
     checkobjrefN(g, fgc, f->locvars[i].varname);
+  for (i=0; i<f->sizeinlines; i++)
+    checkobjrefN(g, fgc, f->inlines[i].name);
 }
 
 
@@ -1073,21 +1089,35 @@ static int table_query (vmk_State *L) {
   vmkL_checktype(L, 1, VMK_TTABLE);
   t = hvalue(obj_at(L, 1));
   asize = t->asize;
-  if (i == -1) {
+  if (i == -1) {  /* (slots are counted as the hash part) */
     vmk_pushinteger(L, cast(vmk_Integer, asize));
-    vmk_pushinteger(L, cast(vmk_Integer, allocsizenode(t)));
+    vmk_pushinteger(L, cast(vmk_Integer, hasslots(t) ? sizeslots(t)
+                                                     : allocsizenode(t)));
+    if (hastypedarray(t)) {  /* push its border and its type */
+      vmk_pushinteger(L, cast(vmk_Integer, *lenborder(t)));
+      vmk_pushstring(L, (arrtypetag(t) == VMK_VNUMINT) ? "integer" : "float");
+      return 4;
+    }
     vmk_pushinteger(L, cast(vmk_Integer, asize > 0 ? *lenhint(t) : 0));
     return 3;
   }
   else if (cast_uint(i) < asize) {
     vmk_pushinteger(L, i);
-    if (!tagisempty(*getArrTag(t, i)))
+    if (!tagisempty(arrtag(t, cast_uint(i))))
       arr2obj(t, cast_uint(i), s2v(L->top.p));
     else
       setnilvalue(s2v(L->top.p));
     api_incr_top(L);
     vmk_pushnil(L);
   }
+  else if (hasslots(t)) {
+    if (cast_uint(i -= cast_int(asize)) < nslots(t)) {
+      setsvalue2s(L, L->top.p, getshape(t)->keys[i]);
+      api_incr_top(L);
+      pushobject(L, &t->slots[i]);
+      vmk_pushinteger(L, 0);
+    }
+  }
   else if (cast_uint(i -= cast_int(asize)) < sizenode(t)) {
     TValue k;
     getnodekey(L, &k, gnode(t, i));
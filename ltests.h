@@ -62,6 +62,12 @@ VMK_API Memcontrol l_memcontrol;
 VMKI_FUNC void vmki_tracegctest (vmk_State *L, int first);
 
 
+/* keep objects out of the nursery while tests make allocations fail */
+#define vmki_nurseryoff(g)  \
+	(l_memcontrol.failnext || l_memcontrol.countlimit != ~0UL || \
+	 l_memcontrol.memlimit != ULONG_MAX)
+
+
 /*
 ** generic variable for debug tricks
 */
@@ -20,6 +20,7 @@
 #include "lfunc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstring.h"
 #include "ltable.h"
 #include "lundump.h"
@@ -198,6 +199,8 @@ static void loadCode (LoadState *S, Proto *f) {
     f->code = vmkM_newvectorchecked(S->L, n, Instruction);
     f->sizecode = cast_int(n);
     loadVector(S, f->code, n);
+    vmkP_fuse(f->code, f->sizecode);  /* dumps have no superinstructions */
+    vmkF_newicache(S->L, f);  /* (fixed code gets it when called) */
   }
 }
 
@@ -319,6 +322,17 @@ static void loadDebug (LoadState *S, Proto *f) {
     f->locvars[i].endpc = loadInt(S);
   }
   n = loadUint(S);
+  f->inlines = vmkM_newvectorchecked(S->L, n, InlineInfo);
+  f->sizeinlines = cast_int(n);
+  for (i = 0; i < n; i++)
+    f->inlines[i].name = NULL;
+  for (i = 0; i < n; i++) {
+    loadString(S, f, &f->inlines[i].name);
+    f->inlines[i].startpc = loadInt(S);
+    f->inlines[i].endpc = loadInt(S);
+    f->inlines[i].line = loadInt(S);
+  }
+  n = loadUint(S);
   if (n != 0)  /* does it have debug information? */
     n = cast_uint(f->sizeupvalues);  /* must be this many */
   for (i = 0; i < n; i++)
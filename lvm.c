@@ -23,6 +23,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -31,6 +32,16 @@
 #include "ltm.h"
 #include "lvm.h"
 
+#if defined(VMK_USE_OPSTATS)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define readcycles()	cast(lu_mem, __rdtsc())
+#else
+#include <time.h>
+#define readcycles()	cast(lu_mem, clock())  /* poor substitute */
+#endif
+#endif
+
 
 /*
 ** By default, use jump tables in the main interpreter loop on gcc
@@ -45,6 +56,49 @@
 #endif
 
 
+/*
+** Tail-call dispatch (one fn per opcode; see 'vmkV_execute') is
+** off by default. It wants guaranteed tail calls ('musttail', from
+** clang 13 and gcc 15); without them, it depends on the compiler
+** turning the calls into jumps, or else each instruction grows the C
+** stack. So, without 'musttail', builds with no optimizations fall
+** back to the default dispatch, and gcc compiles this file at -O2
+** (-Og and -O1 do not turn all those calls into jumps). Use the
+** script 'bench/dispatch' to compare it with the default dispatch.
+*/
+#if !defined(VMK_USE_TAILCALL)
+#define VMK_USE_TAILCALL	0
+#endif
+
+#if VMK_USE_TAILCALL
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define l_musttail	__attribute__((musttail))
+#endif
+#endif
+#if !defined(l_musttail)
+#if !defined(__OPTIMIZE__)  /* no tail calls at all? */
+#undef VMK_USE_TAILCALL
+#define VMK_USE_TAILCALL	0
+#elif defined(__GNUC__) && !defined(__clang__)
+#define l_musttail	/* empty */
+#pragma GCC optimize ("O2", "optimize-sibling-calls")
+#else
+#define l_musttail	/* empty */
+#endif
+#endif
+#endif
+
+
+/*
+** By default, generic arithmetic and order instructions are quickened
+** into type-specialized opcodes at run time.
+*/
+#if !defined(VMK_USE_QUICKENING)
+#define VMK_USE_QUICKENING	1
+#endif
+
+
 
 /* limit for table tag-method chains (to avoid infinite loops) */
 #define MAXTAGLOOP	2000
@@ -285,6 +339,63 @@ static int floatforloop (StkId ra) {
 }
 
 
+/*
+** Step of a generic for loop whose iterator is 'next' or the iterator
+** of 'ipairs' (as registered with 'vmk_setiterators') over a table,
+** computing the 'nres' results without calling it. A loop over 'next'
+** keeps in its closing variable (nil in these loops) the traversal
+** index of the control variable, so that each step goes on from there
+** instead of searching for the key.
+** Returns false when the iterator must be called; that also leaves
+** to the iterator all metamethods, hooks, and errors.
+*/
+static int tforcall (vmk_State *L, StkId ra, int nres) {
+  global_State *g = G(L);
+  TValue *ctl = s2v(ra + 3);  /* control variable */
+  Table *t;
+  if (!ttislcf(s2v(ra)) || !ttistable(s2v(ra + 1)) ||
+      (L->hookmask & (VMK_MASKCALL | VMK_MASKRET)))
+    return 0;
+  t = hvalue(s2v(ra + 1));
+  if (fvalue(s2v(ra)) == g->tforiter[0]) {  /* 'next'? */
+    TValue *cursor = s2v(ra + 2);
+    unsigned idx;
+    int more;
+    if (ttisnil(cursor))
+      idx = 0;  /* no cursor yet */
+    else if (ttisinteger(cursor))
+      idx = cast_uint(ivalue(cursor));
+    else
+      return 0;  /* loop has a closing value */
+    more = vmkH_nextcursor(L, t, ra + 3, &idx);
+    if (more < 0)
+      return 0;  /* invalid key; let 'next' raise the error */
+    setivalue(cursor, cast(vmk_Integer, idx));
+    if (!more) {
+      setnilvalue(ctl);  /* end of the traversal */
+      return 1;
+    }
+  }
+  else if (fvalue(s2v(ra)) == g->tforiter[1] && ttisinteger(ctl)) {
+    vmk_Integer n = intop(+, ivalue(ctl), 1);
+    lu_byte tag;
+    vmkH_fastgeti(t, n, s2v(ra + 4), tag);
+    if (tagisempty(tag)) {
+      if (fasttm(L, t->metatable, TM_INDEX) != NULL)
+        return 0;  /* let the iterator call '__index' */
+      setnilvalue(ctl);  /* end of the traversal */
+      return 1;
+    }
+    setivalue(ctl, n);
+  }
+  else
+    return 0;
+  for (; nres > 2; nres--)  /* complete missing results */
+    setnilvalue(s2v(ra + 2 + nres));
+  return 1;
+}
+
+
 /*
 ** Finish the table access 'val = t[key]' and return the tag of the result.
 */
@@ -334,7 +445,9 @@ void vmkV_finishset (vmk_State *L, const TValue *t, TValue *key,
     if (hres != HNOTATABLE) {  /* is 't' a table? */
       Table *h = hvalue(t);  /* save 't' table */
       tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
-      if (tm == NULL) {  /* no metamethod? */
+      /* (a store into a typed array part that cannot keep the value
+         is a plain update, or has no metamethod to call) */
+      if (tm == NULL || hres == HUNTYPE) {  /* no metamethod? */
         vmkH_finishset(L, h, key, val, hres);  /* set new value */
         invalidateTMcache(h);
         vmkC_barrierback(L, obj2gco(h), val);
@@ -810,7 +923,8 @@ static void pushclosure (vmk_State *L, Proto *p, UpVal **encup, StkId base,
 void vmkV_finishOp (vmk_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->func.p + 1;
-  Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
+  /* interrupted instruction (maybe quickened after the interruption) */
+  Instruction inst = vmkP_unquicken(*(ci->u.l.savedpc - 1));
   OpCode op = GET_OPCODE(inst);
   switch (op) {  /* finish its execution */
     case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
@@ -874,6 +988,159 @@ void vmkV_finishOp (vmk_State *L) {
 
 
 
+#if defined(VMKI_OPPAIRS)
+/*
+** {==================================================================
+** Counting of opcode pairs (a tool to choose superinstructions;
+** see 'vmk_oppairs')
+** ===================================================================
+*/
+
+void vmkV_initpairs (vmk_State *L) {
+  global_State *g = G(L);
+  size_t n = cast_sizet(NUM_OPCODES) * NUM_OPCODES;
+  g->oppairs = vmkM_newvector(L, n, lu_mem);
+  memset(g->oppairs, 0, n * sizeof(lu_mem));
+  g->lastop = OP_VARARGPREP;  /* a main chunk starts after it */
+}
+
+
+void vmkV_closepairs (vmk_State *L) {
+  global_State *g = G(L);
+  if (g->oppairs != NULL) {  /* state completely built? */
+    vmkM_freearray(L, g->oppairs, cast_sizet(NUM_OPCODES) * NUM_OPCODES);
+    g->oppairs = NULL;
+  }
+}
+
+
+#define countpair(L,op)  \
+  { global_State *g_ = G(L); int op_ = cast_int(op);  \
+    g_->oppairs[g_->lastop * NUM_OPCODES + op_]++; g_->lastop = op_; }
+
+/* }================================================================== */
+
+#else
+
+#define countpair(L,op)	((void)0)
+
+#endif
+
+
+
+#if defined(VMK_USE_OPSTATS)
+/*
+** {==================================================================
+** Opcode profiler (see 'vmk_opstats')
+** ===================================================================
+*/
+
+void vmkV_initopstats (vmk_State *L) {
+  global_State *g = G(L);
+  g->opstats = vmkM_new(L, OpStats);
+  g->opstats->epoch = 0;
+  vmkV_resetopstats(g, 0);
+}
+
+
+void vmkV_closeopstats (vmk_State *L) {
+  global_State *g = G(L);
+  if (g->opstats != NULL) {  /* state completely built? */
+    vmkM_free(L, g->opstats);
+    g->opstats = NULL;
+  }
+}
+
+
+/*
+** Zero all counters. Per-instruction counters are zeroed lazily: those
+** from an older epoch are stale.
+*/
+void vmkV_resetopstats (global_State *g, int perpc) {
+  OpStats *s = g->opstats;
+  memset(s->count, 0, sizeof(s->count));
+  memset(s->samples, 0, sizeof(s->samples));
+  memset(s->cycles, 0, sizeof(s->cycles));
+  s->measured = -1;
+  s->tick = OPSTATS_SAMPLE;
+  s->perpc = perpc;
+  s->epoch++;
+}
+
+
+/*
+** Per-instruction counters of 'p' in the current epoch, or NULL if
+** they do not exist. They are allocated directly, outside the control
+** of the collector, because an instruction fetch can neither raise
+** errors nor run a collection; without memory, nothing is counted.
+*/
+lu_mem *vmkV_opcount (global_State *g, Proto *p) {
+  if (p->opcount != NULL && p->opepoch != g->opstats->epoch) {
+    memset(p->opcount, 0, cast_sizet(p->sizecode) * sizeof(lu_mem));
+    p->opepoch = g->opstats->epoch;
+  }
+  return p->opcount;
+}
+
+
+void vmkV_freeopcount (global_State *g, Proto *p) {
+  if (p->opcount != NULL)
+    (*g->frealloc)(g->ud, p->opcount,
+                   cast_sizet(p->sizecode) * sizeof(lu_mem), 0);
+}
+
+
+static lu_mem *newopcount (global_State *g, Proto *p) {
+  size_t size = cast_sizet(p->sizecode) * sizeof(lu_mem);
+  p->opcount = cast(lu_mem *, (*g->frealloc)(g->ud, NULL, 0, size));
+  if (p->opcount != NULL) {
+    memset(p->opcount, 0, size);
+    p->opepoch = g->opstats->epoch;
+  }
+  return p->opcount;
+}
+
+
+/*
+** Count instruction 'i', just fetched from 'pc - 1'. A measurement
+** lasts until the next fetch, so it includes the dispatch and, for
+** calls to C functions, the time spent in them.
+*/
+static void countop (vmk_State *L, Proto *p, const Instruction *pc,
+                                   Instruction i) {
+  global_State *g = G(L);
+  OpStats *s = g->opstats;
+  int op = cast_int(GET_OPCODE(i));
+  s->count[op]++;
+  if (l_unlikely(s->measured >= 0)) {  /* ends a measurement? */
+    s->cycles[s->measured] += readcycles() - s->start;
+    s->samples[s->measured]++;
+    s->measured = -1;
+  }
+  if (l_unlikely(s->perpc)) {
+    lu_mem *c = (p->opcount != NULL) ? vmkV_opcount(g, p)
+                                     : newopcount(g, p);
+    if (c != NULL)
+      c[pcRel(pc, p)]++;
+  }
+  if (l_unlikely(--s->tick == 0)) {  /* start a measurement? */
+    s->tick = OPSTATS_SAMPLE;
+    s->measured = op;
+    s->start = readcycles();  /* last thing, not to measure the profiler */
+  }
+}
+
+#define opstat(L,p,pc,i)	countop(L, p, pc, i)
+
+/* }================================================================== */
+
+#else
+
+#define opstat(L,p,pc,i)	((void)0)
+
+#endif
+
+
 
 /*
 ** {==================================================================
@@ -1043,6 +1310,146 @@ void vmkV_finishOp (vmk_State *L) {
   }  \
   docondjump(); }
 
+
+/*
+** Rewrite the opcode of the instruction being executed. (Code in fixed
+** memory is never changed.)
+*/
+#define setcurrentop(o)  \
+  { if (!(cl->p->flag & PF_FIXED))  \
+      SET_OPCODE(*cast(Instruction *, pc - 1), o); }
+
+
+/*
+** Quicken the current instruction if both operands are integers
+** (opcode 'opi') or both are floats (opcode 'opf').
+*/
+#if VMK_USE_QUICKENING
+#define quicken(v1,v2,opi,opf)  \
+  { if (ttisinteger(v1) && ttisinteger(v2)) setcurrentop(opi)  \
+    else if (ttisfloat(v1) && ttisfloat(v2)) setcurrentop(opf) }
+#else
+#define quicken(v1,v2,opi,opf)	((void)0)
+#endif
+
+
+/*
+** Quickened arithmetic operations over integers. If the guard fails,
+** the instruction goes back to its generic opcode 'gop'.
+*/
+#define op_arithQI(L,iop,fop,gop) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(ttisinteger(v1) && ttisinteger(v2))) {  \
+    StkId ra = RA(i);  \
+    pc++; setivalue(s2v(ra), iop(L, ivalue(v1), ivalue(v2)));  \
+  }  \
+  else {  \
+    setcurrentop(gop);  \
+    op_arith_aux(L, v1, v2, iop, fop);  \
+  }}
+
+
+/*
+** Quickened arithmetic operations over floats.
+*/
+#define op_arithQF(L,iop,fop,gop) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(ttisfloat(v1) && ttisfloat(v2))) {  \
+    StkId ra = RA(i);  \
+    pc++; setfltvalue(s2v(ra), fop(L, fltvalue(v1), fltvalue(v2)));  \
+  }  \
+  else {  \
+    setcurrentop(gop);  \
+    op_arith_aux(L, v1, v2, iop, fop);  \
+  }}
+
+
+/*
+** Quickened order operations. 'tst' checks the expected variant of
+** both operands and 'cmp' compares their values.
+*/
+#define op_orderQ(L,tst,cmp,opn,other,gop) {  \
+  StkId ra = RA(i); \
+  int cond;  \
+  TValue *rb = vRB(i);  \
+  if (l_likely(tst(s2v(ra)) && tst(rb)))  \
+    cond = cmp;  \
+  else {  \
+    setcurrentop(gop);  \
+    if (ttisnumber(s2v(ra)) && ttisnumber(rb))  \
+      cond = opn(s2v(ra), rb);  \
+    else  \
+      Protect(cond = other(L, s2v(ra), rb));  \
+  }  \
+  docondjump(); }
+
+
+/*
+** Opcodes that start superinstructions (see 'vmkP_fuse'), shared by
+** the generic opcodes and the superinstructions.
+*/
+#define op_move(L) {  \
+  StkId ra = RA(i);  \
+  setobjs2s(L, ra, RB(i)); }
+
+
+/*
+** Global accesses use the inline cache of their instruction like any
+** other field access: it keeps the node of the global in '_ENV', and
+** the key stored there validates it. That check costs no more than
+** comparing a version of the table, and it needs no version to be
+** kept by every store into a table that may be an environment.
+*/
+#define op_gettabup(L) {  \
+  StkId ra = RA(i);  \
+  TValue *upval = cl->upvals[GETARG_B(i)]->v.p;  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a short string */  \
+  lu_byte tag;  \
+  vmkV_fastgetshortstr(upval, key, s2v(ra), tag, getIC());  \
+  if (tagisempty(tag))  \
+    Protect(vmkV_finishget(L, upval, rc, ra, tag)); }
+
+
+/*
+** Methods usually come from a table in the '__index' field of the
+** object's metatable; OP_SELF uses the inline cache with it, too.
+*/
+#define op_self(L) {  \
+  StkId ra = RA(i);  \
+  lu_byte tag;  \
+  TValue *rb = vRB(i);  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a short string */  \
+  unsigned *ic = getIC();  \
+  setobj2s(L, ra + 1, rb);  \
+  vmkV_fastgetshortstr(rb, key, s2v(ra), tag, ic);  \
+  if (tagisempty(tag)) {  \
+    const TValue *tm;  \
+    if (tag != VMK_VNOTABLE &&  \
+        (tm = fasttm(L, hvalue(rb)->metatable, TM_INDEX)) != NULL &&  \
+        ttistable(tm)) {  \
+      rb = cast(TValue *, tm);  \
+      vmkH_fastgetshortstr(hvalue(rb), key, s2v(ra), tag, ic);  \
+    }  \
+    if (tagisempty(tag))  \
+      Protect(vmkV_finishget(L, rb, rc, ra, tag));  \
+  } }
+
+
+/*
+** End a superinstruction: run its second instruction, whose code is at
+** label 'l', without a dispatch. When 'trap' is set (e.g., hooks), the
+** second instruction must go through 'vmfetch' like any other one.
+*/
+#define vmfuse(l)  \
+  { if (l_unlikely(trap)) { vmbreak; }  \
+    i = *(pc++);  \
+    opstat(L, cl->p, pc, i);  \
+    vmgoto(l); }
+
 /* }================================================================== */
 
 
@@ -1066,6 +1473,9 @@ void vmkV_finishOp (vmk_State *L) {
 #define KC(i)	(k+GETARG_C(i))
 #define RKC(i)	((TESTARG_k(i)) ? k + GETARG_C(i) : s2v(base + GETARG_C(i)))
 
+/* inline cache of the instruction being executed */
+#define getIC()	(cl->p->icache + (pc - 1 - cl->p->code))
+
 
 
 #define updatetrap(ci)  (trap = ci->u.l.trap)
@@ -1084,6 +1494,25 @@ void vmkV_finishOp (vmk_State *L) {
 #define dojump(ci,i,e)	{ pc += GETARG_sJ(i) + e; updatetrap(ci); }
 
 
+/*
+** Count a call or a loop iteration of the running fn. Once the fn
+** is hot and compiled, and if nothing (e.g., hooks) needs the
+** interpreter, run its native code from 'pc' until it gives control
+** back.
+*/
+#if defined(VMK_USE_JIT)
+#define jitcheck(ci)  \
+  { Proto *p_ = cl->p;  \
+    if (!trap && (p_->jit != NULL ||  \
+        (p_->jitcount < VMKJ_HOTCOUNT &&  \
+         ++p_->jitcount == VMKJ_HOTCOUNT && vmkJ_compile(p_)))) {  \
+      pc = p_->code + vmkJ_run(L, ci, base, cast_int(pc - p_->code));  \
+      updatetrap(ci); } }
+#else
+#define jitcheck(ci)	((void)0)
+#endif
+
+
 /* for test instructions, execute the jump instruction that follows it */
 #define donextjump(ci)	{ Instruction ni = *pc; dojump(ci, ni, 1); }
 
@@ -1145,13 +1574,19 @@ void vmkV_finishOp (vmk_State *L) {
     updatebase(ci);  /* correct stack */ \
   } \
   i = *(pc++); \
+  countpair(L, GET_OPCODE(i)); \
+  opstat(L, cl->p, pc, i); \
 }
 
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l:
 #define vmbreak		break
+#define vmgoto(l)	goto l
+#define vmlabel(l)	l:
 
 
+#if !VMK_USE_TAILCALL
+
 void vmkV_execute (vmk_State *L, CallInfo *ci) {
   LClosure *cl;
   TValue *k;
@@ -1170,6 +1605,8 @@ void vmkV_execute (vmk_State *L, CallInfo *ci) {
   if (l_unlikely(trap))
     trap = vmkG_tracecall(L);
   base = ci->func.p + 1;
+  if (pc == cl->p->code)  /* starting the fn? */
+    jitcheck(ci);
   /* main loop of interpreter */
   for (;;) {
     Instruction i;  /* instruction being executed */
@@ -1187,730 +1624,112 @@ void vmkV_execute (vmk_State *L, CallInfo *ci) {
     /* for tests, invalidate top for instructions not expecting it */
     vmk_assert(vmkP_isIT(i) || (cast_void(L->top.p = base), 1));
     vmdispatch (GET_OPCODE(i)) {
-      vmcase(OP_MOVE) {
-        StkId ra = RA(i);
-        setobjs2s(L, ra, RB(i));
-        vmbreak;
-      }
-      vmcase(OP_LOADI) {
-        StkId ra = RA(i);
-        vmk_Integer b = GETARG_sBx(i);
-        setivalue(s2v(ra), b);
-        vmbreak;
-      }
-      vmcase(OP_LOADF) {
-        StkId ra = RA(i);
-        int b = GETARG_sBx(i);
-        setfltvalue(s2v(ra), cast_num(b));
-        vmbreak;
-      }
-      vmcase(OP_LOADK) {
-        StkId ra = RA(i);
-        TValue *rb = k + GETARG_Bx(i);
-        setobj2s(L, ra, rb);
-        vmbreak;
-      }
-      vmcase(OP_LOADKX) {
-        StkId ra = RA(i);
-        TValue *rb;
-        rb = k + GETARG_Ax(*pc); pc++;
-        setobj2s(L, ra, rb);
-        vmbreak;
-      }
-      vmcase(OP_LOADFALSE) {
-        StkId ra = RA(i);
-        setbfvalue(s2v(ra));
-        vmbreak;
-      }
-      vmcase(OP_LFALSESKIP) {
-        StkId ra = RA(i);
-        setbfvalue(s2v(ra));
-        pc++;  /* skip next instruction */
-        vmbreak;
-      }
-      vmcase(OP_LOADTRUE) {
-        StkId ra = RA(i);
-        setbtvalue(s2v(ra));
-        vmbreak;
-      }
-      vmcase(OP_LOADNIL) {
-        StkId ra = RA(i);
-        int b = GETARG_B(i);
-        do {
-          setnilvalue(s2v(ra++));
-        } while (b--);
-        vmbreak;
-      }
-      vmcase(OP_GETUPVAL) {
-        StkId ra = RA(i);
-        int b = GETARG_B(i);
-        setobj2s(L, ra, cl->upvals[b]->v.p);
-        vmbreak;
-      }
-      vmcase(OP_SETUPVAL) {
-        StkId ra = RA(i);
-        UpVal *uv = cl->upvals[GETARG_B(i)];
-        setobj(L, uv->v.p, s2v(ra));
-        vmkC_barrier(L, uv, s2v(ra));
-        vmbreak;
-      }
-      vmcase(OP_GETTABUP) {
-        StkId ra = RA(i);
-        TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        lu_byte tag;
-        vmkV_fastget(upval, key, s2v(ra), vmkH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(vmkV_finishget(L, upval, rc, ra, tag));
-        vmbreak;
-      }
-      vmcase(OP_GETTABLE) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        TValue *rc = vRC(i);
-        lu_byte tag;
-        if (ttisinteger(rc)) {  /* fast track for integers? */
-          vmkV_fastgeti(rb, ivalue(rc), s2v(ra), tag);
-        }
-        else
-          vmkV_fastget(rb, rc, s2v(ra), vmkH_get, tag);
-        if (tagisempty(tag))
-          Protect(vmkV_finishget(L, rb, rc, ra, tag));
-        vmbreak;
-      }
-      vmcase(OP_GETI) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        int c = GETARG_C(i);
-        lu_byte tag;
-        vmkV_fastgeti(rb, c, s2v(ra), tag);
-        if (tagisempty(tag)) {
-          TValue key;
-          setivalue(&key, c);
-          Protect(vmkV_finishget(L, rb, &key, ra, tag));
-        }
-        vmbreak;
-      }
-      vmcase(OP_GETFIELD) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        lu_byte tag;
-        vmkV_fastget(rb, key, s2v(ra), vmkH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(vmkV_finishget(L, rb, rc, ra, tag));
-        vmbreak;
-      }
-      vmcase(OP_SETTABUP) {
-        int hres;
-        TValue *upval = cl->upvals[GETARG_A(i)]->v.p;
-        TValue *rb = KB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rb);  /* key must be a short string */
-        vmkV_fastset(upval, key, rc, hres, vmkH_psetshortstr);
-        if (hres == HOK)
-          vmkV_finishfastset(L, upval, rc);
-        else
-          Protect(vmkV_finishset(L, upval, rb, rc, hres));
-        vmbreak;
-      }
-      vmcase(OP_SETTABLE) {
-        StkId ra = RA(i);
-        int hres;
-        TValue *rb = vRB(i);  /* key (table is in 'ra') */
-        TValue *rc = RKC(i);  /* value */
-        if (ttisinteger(rb)) {  /* fast track for integers? */
-          vmkV_fastseti(s2v(ra), ivalue(rb), rc, hres);
-        }
-        else {
-          vmkV_fastset(s2v(ra), rb, rc, hres, vmkH_pset);
-        }
-        if (hres == HOK)
-          vmkV_finishfastset(L, s2v(ra), rc);
-        else
-          Protect(vmkV_finishset(L, s2v(ra), rb, rc, hres));
-        vmbreak;
-      }
-      vmcase(OP_SETI) {
-        StkId ra = RA(i);
-        int hres;
-        int b = GETARG_B(i);
-        TValue *rc = RKC(i);
-        vmkV_fastseti(s2v(ra), b, rc, hres);
-        if (hres == HOK)
-          vmkV_finishfastset(L, s2v(ra), rc);
-        else {
-          TValue key;
-          setivalue(&key, b);
-          Protect(vmkV_finishset(L, s2v(ra), &key, rc, hres));
-        }
-        vmbreak;
-      }
-      vmcase(OP_SETFIELD) {
-        StkId ra = RA(i);
-        int hres;
-        TValue *rb = KB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rb);  /* key must be a short string */
-        vmkV_fastset(s2v(ra), key, rc, hres, vmkH_psetshortstr);
-        if (hres == HOK)
-          vmkV_finishfastset(L, s2v(ra), rc);
-        else
-          Protect(vmkV_finishset(L, s2v(ra), rb, rc, hres));
-        vmbreak;
-      }
-      vmcase(OP_NEWTABLE) {
-        StkId ra = RA(i);
-        unsigned b = cast_uint(GETARG_vB(i));  /* log2(hash size) + 1 */
-        unsigned c = cast_uint(GETARG_vC(i));  /* array size */
-        Table *t;
-        if (b > 0)
-          b = 1u << (b - 1);  /* hash size is 2^(b - 1) */
-        if (TESTARG_k(i)) {  /* non-zero extra argument? */
-          vmk_assert(GETARG_Ax(*pc) != 0);
-          /* add it to array size */
-          c += cast_uint(GETARG_Ax(*pc)) * (MAXARG_vC + 1);
-        }
-        pc++;  /* skip extra argument */
-        L->top.p = ra + 1;  /* correct top in case of emergency GC */
-        t = vmkH_new(L);  /* memory allocation */
-        sethvalue2s(L, ra, t);
-        if (b != 0 || c != 0)
-          vmkH_resize(L, t, c, b);  /* idem */
-        checkGC(L, ra + 1);
-        vmbreak;
-      }
-      vmcase(OP_SELF) {
-        StkId ra = RA(i);
-        lu_byte tag;
-        TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        setobj2s(L, ra + 1, rb);
-        vmkV_fastget(rb, key, s2v(ra), vmkH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(vmkV_finishget(L, rb, rc, ra, tag));
-        vmbreak;
-      }
-      vmcase(OP_ADDI) {
-        op_arithI(L, l_addi, vmki_numadd);
-        vmbreak;
-      }
-      vmcase(OP_ADDK) {
-        op_arithK(L, l_addi, vmki_numadd);
-        vmbreak;
-      }
-      vmcase(OP_SUBK) {
-        op_arithK(L, l_subi, vmki_numsub);
-        vmbreak;
-      }
-      vmcase(OP_MULK) {
-        op_arithK(L, l_muli, vmki_nummul);
-        vmbreak;
-      }
-      vmcase(OP_MODK) {
-        savestate(L, ci);  /* in case of division by 0 */
-        op_arithK(L, vmkV_mod, vmkV_modf);
-        vmbreak;
-      }
-      vmcase(OP_POWK) {
-        op_arithfK(L, vmki_numpow);
-        vmbreak;
-      }
-      vmcase(OP_DIVK) {
-        op_arithfK(L, vmki_numdiv);
-        vmbreak;
-      }
-      vmcase(OP_IDIVK) {
-        savestate(L, ci);  /* in case of division by 0 */
-        op_arithK(L, vmkV_idiv, vmki_numidiv);
-        vmbreak;
-      }
-      vmcase(OP_BANDK) {
-        op_bitwiseK(L, l_band);
-        vmbreak;
-      }
-      vmcase(OP_BORK) {
-        op_bitwiseK(L, l_bor);
-        vmbreak;
-      }
-      vmcase(OP_BXORK) {
-        op_bitwiseK(L, l_bxor);
-        vmbreak;
-      }
-      vmcase(OP_SHRI) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        int ic = GETARG_sC(i);
-        vmk_Integer ib;
-        if (tointegerns(rb, &ib)) {
-          pc++; setivalue(s2v(ra), vmkV_shiftl(ib, -ic));
-        }
-        vmbreak;
-      }
-      vmcase(OP_SHLI) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        int ic = GETARG_sC(i);
-        vmk_Integer ib;
-        if (tointegerns(rb, &ib)) {
-          pc++; setivalue(s2v(ra), vmkV_shiftl(ic, ib));
-        }
-        vmbreak;
-      }
-      vmcase(OP_ADD) {
-        op_arith(L, l_addi, vmki_numadd);
-        vmbreak;
-      }
-      vmcase(OP_SUB) {
-        op_arith(L, l_subi, vmki_numsub);
-        vmbreak;
-      }
-      vmcase(OP_MUL) {
-        op_arith(L, l_muli, vmki_nummul);
-        vmbreak;
-      }
-      vmcase(OP_MOD) {
-        savestate(L, ci);  /* in case of division by 0 */
-        op_arith(L, vmkV_mod, vmkV_modf);
-        vmbreak;
-      }
-      vmcase(OP_POW) {
-        op_arithf(L, vmki_numpow);
-        vmbreak;
-      }
-      vmcase(OP_DIV) {  /* float division (always with floats) */
-        op_arithf(L, vmki_numdiv);
-        vmbreak;
-      }
-      vmcase(OP_IDIV) {  /* floor division */
-        savestate(L, ci);  /* in case of division by 0 */
-        op_arith(L, vmkV_idiv, vmki_numidiv);
-        vmbreak;
-      }
-      vmcase(OP_BAND) {
-        op_bitwise(L, l_band);
-        vmbreak;
-      }
-      vmcase(OP_BOR) {
-        op_bitwise(L, l_bor);
-        vmbreak;
-      }
-      vmcase(OP_BXOR) {
-        op_bitwise(L, l_bxor);
-        vmbreak;
-      }
-      vmcase(OP_SHR) {
-        op_bitwise(L, vmkV_shiftr);
-        vmbreak;
-      }
-      vmcase(OP_SHL) {
-        op_bitwise(L, vmkV_shiftl);
-        vmbreak;
-      }
-      vmcase(OP_MMBIN) {
-        StkId ra = RA(i);
-        Instruction pi = *(pc - 2);  /* original arith. expression */
-        TValue *rb = vRB(i);
-        TMS tm = (TMS)GETARG_C(i);
-        StkId result = RA(pi);
-        vmk_assert(OP_ADD <= GET_OPCODE(pi) && GET_OPCODE(pi) <= OP_SHR);
-        Protect(vmkT_trybinTM(L, s2v(ra), rb, result, tm));
-        vmbreak;
-      }
-      vmcase(OP_MMBINI) {
-        StkId ra = RA(i);
-        Instruction pi = *(pc - 2);  /* original arith. expression */
-        int imm = GETARG_sB(i);
-        TMS tm = (TMS)GETARG_C(i);
-        int flip = GETARG_k(i);
-        StkId result = RA(pi);
-        Protect(vmkT_trybiniTM(L, s2v(ra), imm, flip, result, tm));
-        vmbreak;
-      }
-      vmcase(OP_MMBINK) {
-        StkId ra = RA(i);
-        Instruction pi = *(pc - 2);  /* original arith. expression */
-        TValue *imm = KB(i);
-        TMS tm = (TMS)GETARG_C(i);
-        int flip = GETARG_k(i);
-        StkId result = RA(pi);
-        Protect(vmkT_trybinassocTM(L, s2v(ra), imm, flip, result, tm));
-        vmbreak;
-      }
-      vmcase(OP_UNM) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        vmk_Number nb;
-        if (ttisinteger(rb)) {
-          vmk_Integer ib = ivalue(rb);
-          setivalue(s2v(ra), intop(-, 0, ib));
-        }
-        else if (tonumberns(rb, nb)) {
-          setfltvalue(s2v(ra), vmki_numunm(L, nb));
-        }
-        else
-          Protect(vmkT_trybinTM(L, rb, rb, ra, TM_UNM));
-        vmbreak;
-      }
-      vmcase(OP_BNOT) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        vmk_Integer ib;
-        if (tointegerns(rb, &ib)) {
-          setivalue(s2v(ra), intop(^, ~l_castS2U(0), ib));
-        }
-        else
-          Protect(vmkT_trybinTM(L, rb, rb, ra, TM_BNOT));
-        vmbreak;
-      }
-      vmcase(OP_NOT) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        if (l_isfalse(rb))
-          setbtvalue(s2v(ra));
-        else
-          setbfvalue(s2v(ra));
-        vmbreak;
-      }
-      vmcase(OP_LEN) {
-        StkId ra = RA(i);
-        Protect(vmkV_objlen(L, ra, vRB(i)));
-        vmbreak;
-      }
-      vmcase(OP_CONCAT) {
-        StkId ra = RA(i);
-        int n = GETARG_B(i);  /* number of elements to concatenate */
-        L->top.p = ra + n;  /* mark the end of concat operands */
-        ProtectNT(vmkV_concat(L, n));
-        checkGC(L, L->top.p); /* 'vmkV_concat' ensures correct top */
-        vmbreak;
-      }
-      vmcase(OP_CLOSE) {
-        StkId ra = RA(i);
-        vmk_assert(!GETARG_B(i));  /* 'close must be alive */
-        Protect(vmkF_close(L, ra, VMK_OK, 1));
-        vmbreak;
-      }
-      vmcase(OP_TBC) {
-        StkId ra = RA(i);
-        /* create new to-be-closed upvalue */
-        halfProtect(vmkF_newtbcupval(L, ra));
-        vmbreak;
-      }
-      vmcase(OP_JMP) {
-        dojump(ci, i, 0);
-        vmbreak;
-      }
-      vmcase(OP_EQ) {
-        StkId ra = RA(i);
-        int cond;
-        TValue *rb = vRB(i);
-        Protect(cond = vmkV_equalobj(L, s2v(ra), rb));
-        docondjump();
-        vmbreak;
-      }
-      vmcase(OP_LT) {
-        op_order(L, l_lti, LTnum, lessthanothers);
-        vmbreak;
-      }
-      vmcase(OP_LE) {
-        op_order(L, l_lei, LEnum, lessequalothers);
-        vmbreak;
-      }
-      vmcase(OP_EQK) {
-        StkId ra = RA(i);
-        TValue *rb = KB(i);
-        /* basic types do not use '__eq'; we can use raw equality */
-        int cond = vmkV_rawequalobj(s2v(ra), rb);
-        docondjump();
-        vmbreak;
-      }
-      vmcase(OP_EQI) {
-        StkId ra = RA(i);
-        int cond;
-        int im = GETARG_sB(i);
-        if (ttisinteger(s2v(ra)))
-          cond = (ivalue(s2v(ra)) == im);
-        else if (ttisfloat(s2v(ra)))
-          cond = vmki_numeq(fltvalue(s2v(ra)), cast_num(im));
-        else
-          cond = 0;  /* other types cannot be equal to a number */
-        docondjump();
-        vmbreak;
-      }
-      vmcase(OP_LTI) {
-        op_orderI(L, l_lti, vmki_numlt, 0, TM_LT);
-        vmbreak;
-      }
-      vmcase(OP_LEI) {
-        op_orderI(L, l_lei, vmki_numle, 0, TM_LE);
-        vmbreak;
-      }
-      vmcase(OP_GTI) {
-        op_orderI(L, l_gti, vmki_numgt, 1, TM_LT);
-        vmbreak;
-      }
-      vmcase(OP_GEI) {
-        op_orderI(L, l_gei, vmki_numge, 1, TM_LE);
-        vmbreak;
-      }
-      vmcase(OP_TEST) {
-        StkId ra = RA(i);
-        int cond = !l_isfalse(s2v(ra));
-        docondjump();
-        vmbreak;
-      }
-      vmcase(OP_TESTSET) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        if (l_isfalse(rb) == GETARG_k(i))
-          pc++;
-        else {
-          setobj2s(L, ra, rb);
-          donextjump(ci);
-        }
-        vmbreak;
-      }
-      vmcase(OP_CALL) {
-        StkId ra = RA(i);
-        CallInfo *newci;
-        int b = GETARG_B(i);
-        int nresults = GETARG_C(i) - 1;
-        if (b != 0)  /* fixed number of arguments? */
-          L->top.p = ra + b;  /* top signals number of arguments */
-        /* else previous instruction set top */
-        savepc(L);  /* in case of errors */
-        if ((newci = vmkD_precall(L, ra, nresults)) == NULL)
-          updatetrap(ci);  /* C call; nothing else to be done */
-        else {  /* Vmk call: run fn in this same C frame */
-          ci = newci;
-          goto startfunc;
-        }
-        vmbreak;
-      }
-      vmcase(OP_TAILCALL) {
-        StkId ra = RA(i);
-        int b = GETARG_B(i);  /* number of arguments + 1 (fn) */
-        int n;  /* number of results when calling a C fn */
-        int nparams1 = GETARG_C(i);
-        /* delta is virtual 'func' - real 'func' (vararg functions) */
-        int delta = (nparams1) ? ci->u.l.nextraargs + nparams1 : 0;
-        if (b != 0)
-          L->top.p = ra + b;
-        else  /* previous instruction set top */
-          b = cast_int(L->top.p - ra);
-        savepc(ci);  /* several calls here can raise errors */
-        if (TESTARG_k(i)) {
-          vmkF_closeupval(L, base);  /* close upvalues from current call */
-          vmk_assert(L->tbclist.p < base);  /* no pending tbc variables */
-          vmk_assert(base == ci->func.p + 1);
-        }
-        if ((n = vmkD_pretailcall(L, ci, ra, b, delta)) < 0)  /* Vmk fn? */
-          goto startfunc;  /* execute the callee */
-        else {  /* C fn? */
-          ci->func.p -= delta;  /* restore 'func' (if vararg) */
-          vmkD_poscall(L, ci, n);  /* finish caller */
-          updatetrap(ci);  /* 'vmkD_poscall' can change hooks */
-          goto ret;  /* caller returns after the tail call */
-        }
-      }
-      vmcase(OP_RETURN) {
-        StkId ra = RA(i);
-        int n = GETARG_B(i) - 1;  /* number of results */
-        int nparams1 = GETARG_C(i);
-        if (n < 0)  /* not fixed? */
-          n = cast_int(L->top.p - ra);  /* get what is available */
-        savepc(ci);
-        if (TESTARG_k(i)) {  /* may there be open upvalues? */
-          ci->u2.nres = n;  /* save number of returns */
-          if (L->top.p < ci->top.p)
-            L->top.p = ci->top.p;
-          vmkF_close(L, base, CLOSEKTOP, 1);
-          updatetrap(ci);
-          updatestack(ci);
-        }
-        if (nparams1)  /* vararg fn? */
-          ci->func.p -= ci->u.l.nextraargs + nparams1;
-        L->top.p = ra + n;  /* set call for 'vmkD_poscall' */
-        vmkD_poscall(L, ci, n);
-        updatetrap(ci);  /* 'vmkD_poscall' can change hooks */
-        goto ret;
-      }
-      vmcase(OP_RETURN0) {
-        if (l_unlikely(L->hookmask)) {
-          StkId ra = RA(i);
-          L->top.p = ra;
-          savepc(ci);
-          vmkD_poscall(L, ci, 0);  /* no hurry... */
-          trap = 1;
-        }
-        else {  /* do the 'poscall' here */
-          int nres = get_nresults(ci->callstatus);
-          L->ci = ci->previous;  /* back to caller */
-          L->top.p = base - 1;
-          for (; l_unlikely(nres > 0); nres--)
-            setnilvalue(s2v(L->top.p++));  /* all results are nil */
-        }
-        goto ret;
-      }
-      vmcase(OP_RETURN1) {
-        if (l_unlikely(L->hookmask)) {
-          StkId ra = RA(i);
-          L->top.p = ra + 1;
-          savepc(ci);
-          vmkD_poscall(L, ci, 1);  /* no hurry... */
-          trap = 1;
-        }
-        else {  /* do the 'poscall' here */
-          int nres = get_nresults(ci->callstatus);
-          L->ci = ci->previous;  /* back to caller */
-          if (nres == 0)
-            L->top.p = base - 1;  /* asked for no results */
-          else {
-            StkId ra = RA(i);
-            setobjs2s(L, base - 1, ra);  /* at least this result */
-            L->top.p = base;
-            for (; l_unlikely(nres > 1); nres--)
-              setnilvalue(s2v(L->top.p++));  /* complete missing results */
-          }
-        }
-       ret:  /* return from a Vmk fn */
-        if (ci->callstatus & CIST_FRESH)
-          return;  /* end this frame */
-        else {
-          ci = ci->previous;
-          goto returning;  /* continue running caller in this frame */
-        }
-      }
-      vmcase(OP_FORLOOP) {
-        StkId ra = RA(i);
-        if (ttisinteger(s2v(ra + 1))) {  /* integer loop? */
-          vmk_Unsigned count = l_castS2U(ivalue(s2v(ra)));
-          if (count > 0) {  /* still more iterations? */
-            vmk_Integer step = ivalue(s2v(ra + 1));
-            vmk_Integer idx = ivalue(s2v(ra + 2));  /* control variable */
-            chgivalue(s2v(ra), l_castU2S(count - 1));  /* update counter */
-            idx = intop(+, idx, step);  /* add step to index */
-            chgivalue(s2v(ra + 2), idx);  /* update control variable */
-            pc -= GETARG_Bx(i);  /* jump back */
-          }
-        }
-        else if (floatforloop(ra))  /* float loop */
-          pc -= GETARG_Bx(i);  /* jump back */
-        updatetrap(ci);  /* allows a signal to break the loop */
-        vmbreak;
-      }
-      vmcase(OP_FORPREP) {
-        StkId ra = RA(i);
-        savestate(L, ci);  /* in case of errors */
-        if (forprep(L, ra))
-          pc += GETARG_Bx(i) + 1;  /* skip the loop */
-        vmbreak;
-      }
-      vmcase(OP_TFORPREP) {
-       /* before: 'ra' has the iterator fn, 'ra + 1' has the state,
-          'ra + 2' has the initial value for the control variable, and
-          'ra + 3' has the closing variable. This opcode then swaps the
-          control and the closing variables and marks the closing variable
-          as to-be-closed.
-       */
-       StkId ra = RA(i);
-       TValue temp;  /* to swap control and closing variables */
-       setobj(L, &temp, s2v(ra + 3));
-       setobjs2s(L, ra + 3, ra + 2);
-       setobj2s(L, ra + 2, &temp);
-        /* create to-be-closed upvalue (if closing var. is not nil) */
-        halfProtect(vmkF_newtbcupval(L, ra + 2));
-        pc += GETARG_Bx(i);  /* go to end of the loop */
-        i = *(pc++);  /* fetch next instruction */
-        vmk_assert(GET_OPCODE(i) == OP_TFORCALL && ra == RA(i));
-        goto l_tforcall;
-      }
-      vmcase(OP_TFORCALL) {
-       l_tforcall: {
-        /* 'ra' has the iterator fn, 'ra + 1' has the state,
-           'ra + 2' has the closing variable, and 'ra + 3' has the control
-           variable. The call will use the stack starting at 'ra + 3',
-           so that it preserves the first three values, and the first
-           return will be the new value for the control variable.
-        */
-        StkId ra = RA(i);
-        setobjs2s(L, ra + 5, ra + 3);  /* copy the control variable */
-        setobjs2s(L, ra + 4, ra + 1);  /* copy state */
-        setobjs2s(L, ra + 3, ra);  /* copy fn */
-        L->top.p = ra + 3 + 3;
-        ProtectNT(vmkD_call(L, ra + 3, GETARG_C(i)));  /* do the call */
-        updatestack(ci);  /* stack may have changed */
-        i = *(pc++);  /* go to next instruction */
-        vmk_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
-        goto l_tforloop;
-      }}
-      vmcase(OP_TFORLOOP) {
-       l_tforloop: {
-        StkId ra = RA(i);
-        if (!ttisnil(s2v(ra + 3)))  /* continue loop? */
-          pc -= GETARG_Bx(i);  /* jump back */
-        vmbreak;
-      }}
-      vmcase(OP_SETLIST) {
-        StkId ra = RA(i);
-        unsigned n = cast_uint(GETARG_vB(i));
-        unsigned int last = cast_uint(GETARG_vC(i));
-        Table *h = hvalue(s2v(ra));
-        if (n == 0)
-          n = cast_uint(L->top.p - ra) - 1;  /* get up to the top */
-        else
-          L->top.p = ci->top.p;  /* correct top in case of emergency GC */
-        last += n;
-        if (TESTARG_k(i)) {
-          last += cast_uint(GETARG_Ax(*pc)) * (MAXARG_vC + 1);
-          pc++;
-        }
-        /* when 'n' is known, table should have proper size */
-        if (last > h->asize) {  /* needs more space? */
-          /* fixed-size sets should have space preallocated */
-          vmk_assert(GETARG_vB(i) == 0);
-          vmkH_resizearray(L, h, last);  /* preallocate it at once */
-        }
-        for (; n > 0; n--) {
-          TValue *val = s2v(ra + n);
-          obj2arr(h, last - 1, val);
-          last--;
-          vmkC_barrierback(L, obj2gco(h), val);
-        }
-        vmbreak;
-      }
-      vmcase(OP_CLOSURE) {
-        StkId ra = RA(i);
-        Proto *p = cl->p->p[GETARG_Bx(i)];
-        halfProtect(pushclosure(L, p, cl->upvals, base, ra));
-        checkGC(L, ra + 1);
-        vmbreak;
-      }
-      vmcase(OP_VARARG) {
-        StkId ra = RA(i);
-        int n = GETARG_C(i) - 1;  /* required results */
-        Protect(vmkT_getvarargs(L, ci, ra, n));
-        vmbreak;
-      }
-      vmcase(OP_VARARGPREP) {
-        ProtectNT(vmkT_adjustvarargs(L, GETARG_A(i), ci, cl->p));
-        if (l_unlikely(trap)) {  /* previous "Protect" updated trap */
-          vmkD_hookcall(L, ci);
-          L->oldpc = 1;  /* next opcode will be seen as a "new" line */
-        }
-        updatebase(ci);  /* fn has new base after adjustment */
-        vmbreak;
-      }
-      vmcase(OP_EXTRAARG) {
-        vmk_assert(0);
-        vmbreak;
-      }
+#include "lvmops.h"
     }
   }
 }
 
+#else
+
+/*
+** Tail-call dispatch: each opcode is a fn, and each fn ends by
+** calling the fn of the next instruction as a tail call, so that the
+** machine stack does not grow. The interpreter state lives in the
+** parameters of these functions, which the calling convention keeps in
+** registers; 'cl' and 'k' are computed from 'ci' when needed. A Vmk
+** call does not return to its caller fn: the frame's 'CIST_FRESH'
+** ends the chain of tail calls, as in the interpreter loop.
+*/
+
+#define VMOP_PARAMS  \
+	vmk_State *L, CallInfo *ci, StkId base, const Instruction *pc,  \
+	Instruction i, int trap
+#define VMOP_ARGS	L, ci, base, pc, i, trap
+
+typedef void (*vmop_Function) (VMOP_PARAMS);
+
+#undef vmcase
+#undef vmbreak
+#undef vmgoto
+#undef vmlabel
+
+#define vmcase(l)	static void vmop_##l (VMOP_PARAMS)
+
+#define vmbreak  \
+  { vmfetch(); vmopcheck(); \
+    l_musttail return vmop_table[GET_OPCODE(i)](VMOP_ARGS); }
+
+#define vmgoto(l)	l_musttail return vmop_##l(VMOP_ARGS)
+
+#define vmlabel(l)	/* empty */
+
+/* the labels that are not functions of their own */
+#define vmop_l_tforcall		vmop_OP_TFORCALL
+#define vmop_l_tforloop		vmop_OP_TFORLOOP
+#define vmop_l_getfield		vmop_OP_GETFIELD
+#define vmop_l_call		vmop_OP_CALL
+
+/* checks done by the interpreter loop before each instruction */
+#define vmopcheck()  \
+  { vmk_assert(base == ci->func.p + 1);  \
+    vmk_assert(base <= L->top.p && L->top.p <= L->stack_last.p);  \
+    vmk_assert(vmkP_isIT(i) || (cast_void(L->top.p = base), 1)); }
+
+
+#define vmop(l)		static void vmop_##l (VMOP_PARAMS);
+#include "ltailtab.h"
+#undef vmop
+
+static const vmop_Function vmop_table[NUM_OPCODES] = {
+#define vmop(l)		vmop_##l,
+#include "ltailtab.h"
+#undef vmop
+};
+
+static void vmop_returning (VMOP_PARAMS);
+
+
+#define cl	ci_func(ci)
+#define k	(cl->p->k)
+
+
+static void vmop_startfunc (VMOP_PARAMS) {
+  trap = L->hookmask;
+  vmgoto(returning);
+}
+
+
+static void vmop_returning (VMOP_PARAMS) {  /* trap already set */
+  pc = ci->u.l.savedpc;
+  if (l_unlikely(trap))
+    trap = vmkG_tracecall(L);
+  base = ci->func.p + 1;
+  if (pc == cl->p->code)  /* starting the fn? */
+    jitcheck(ci);
+  vmbreak;
+}
+
+
+static void vmop_ret (VMOP_PARAMS) {  /* return from a Vmk fn */
+  if (ci->callstatus & CIST_FRESH)
+    return;  /* end this frame */
+  else {
+    ci = ci->previous;
+    vmgoto(returning);  /* continue running caller */
+  }
+}
+
+
+#include "lvmops.h"
+
+#undef cl
+#undef k
+
+
+void vmkV_execute (vmk_State *L, CallInfo *ci) {
+  vmop_startfunc(L, ci, NULL, NULL, 0, 0);
+}
+
+#endif
+
 /* }================================================================== */
@@ -10,6 +10,7 @@
 
 #include "ldo.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "ltm.h"
 
 
@@ -91,6 +92,15 @@ typedef enum {
   else { vmkH_fastgeti(hvalue(t), k, res, tag); }
 
 
+/*
+** Special case of 'vmkV_fastget' for short-string keys, using the
+** inline cache 'ic'.
+*/
+#define vmkV_fastgetshortstr(t,k,res,tag,ic) \
+  if (!ttistable(t)) tag = VMK_VNOTABLE; \
+  else { vmkH_fastgetshortstr(hvalue(t), k, res, tag, ic); }
+
+
 #define vmkV_fastset(t,k,val,hres,f) \
   (hres = (!ttistable(t) ? HNOTATABLE : f(hvalue(t), k, val)))
 
@@ -98,6 +108,10 @@ typedef enum {
   if (!ttistable(t)) hres = HNOTATABLE; \
   else { vmkH_fastseti(hvalue(t), k, val, hres); }
 
+#define vmkV_fastsetshortstr(t,k,val,hres,ic) \
+  if (!ttistable(t)) hres = HNOTATABLE; \
+  else { vmkH_fastsetshortstr(hvalue(t), k, val, hres, ic); }
+
 
 /*
 ** Finish a fast set operation (when fast set succeeds).
@@ -132,5 +146,37 @@ VMKI_FUNC vmk_Integer vmkV_mod (vmk_State *L, vmk_Integer x, vmk_Integer y);
 VMKI_FUNC vmk_Number vmkV_modf (vmk_State *L, vmk_Number x, vmk_Number y);
 VMKI_FUNC vmk_Integer vmkV_shiftl (vmk_Integer x, vmk_Integer y);
 VMKI_FUNC void vmkV_objlen (vmk_State *L, StkId ra, const TValue *rb);
+#if defined(VMKI_OPPAIRS)
+VMKI_FUNC void vmkV_initpairs (vmk_State *L);
+VMKI_FUNC void vmkV_closepairs (vmk_State *L);
+#endif
+
+
+#if defined(VMK_USE_OPSTATS)
+
+/*
+** Counters of the opcode profiler (see 'vmk_opstats'). One out of every
+** OPSTATS_SAMPLE instructions also has its cost measured in cycles.
+*/
+#define OPSTATS_SAMPLE	61
+
+typedef struct OpStats {
+  lu_mem count[NUM_OPCODES];  /* executions of each opcode */
+  lu_mem samples[NUM_OPCODES];  /* measured executions of each opcode */
+  lu_mem cycles[NUM_OPCODES];  /* cycles spent in measured executions */
+  lu_mem start;  /* cycle counter when measured instruction started */
+  int measured;  /* opcode being measured (-1 if none) */
+  int tick;  /* instructions until next measurement */
+  int perpc;  /* count executions of each instruction, too? */
+  unsigned int epoch;  /* number of resets */
+} OpStats;
+
+VMKI_FUNC void vmkV_initopstats (vmk_State *L);
+VMKI_FUNC void vmkV_closeopstats (vmk_State *L);
+VMKI_FUNC void vmkV_resetopstats (global_State *g, int perpc);
+VMKI_FUNC lu_mem *vmkV_opcount (global_State *g, Proto *p);
+VMKI_FUNC void vmkV_freeopcount (global_State *g, Proto *p);
+
+#endif
 
 #endif
@@ -0,0 +1,806 @@
+/*
+** $Id: lvmops.h $
+** Opcode implementations for the Vmk interpreter
+** See Copyright Notice in vmk.h
+*/
+
+/*
+** This file is not a regular header: 'lvm.c' includes it where the
+** code for the opcodes must go. Each opcode has the form
+**
+**   vmcase(OP_xxx) { ... vmbreak; }
+**
+** and moves to the labels 'startfunc', 'returning', 'ret', 'l_tforcall',
+** 'l_tforloop', 'l_getfield', and 'l_call' (marked with 'vmlabel') only
+** through 'vmgoto' (or 'vmfuse'). The interpreter loop defines these
+** macros to build a switch (or a jump table); the tail-call dispatch
+** defines them to build one fn per opcode. Either way, the code can
+** use the variables 'L', 'ci', 'cl', 'k', 'base', 'pc', 'trap', and 'i'.
+*/
+
+      vmcase(OP_MOVE) {
+        op_move(L);
+        vmbreak;
+      }
+      vmcase(OP_LOADI) {
+        StkId ra = RA(i);
+        vmk_Integer b = GETARG_sBx(i);
+        setivalue(s2v(ra), b);
+        vmbreak;
+      }
+      vmcase(OP_LOADF) {
+        StkId ra = RA(i);
+        int b = GETARG_sBx(i);
+        setfltvalue(s2v(ra), cast_num(b));
+        vmbreak;
+      }
+      vmcase(OP_LOADK) {
+        StkId ra = RA(i);
+        TValue *rb = k + GETARG_Bx(i);
+        setobj2s(L, ra, rb);
+        vmbreak;
+      }
+      vmcase(OP_LOADKX) {
+        StkId ra = RA(i);
+        TValue *rb;
+        rb = k + GETARG_Ax(*pc); pc++;
+        setobj2s(L, ra, rb);
+        vmbreak;
+      }
+      vmcase(OP_LOADFALSE) {
+        StkId ra = RA(i);
+        setbfvalue(s2v(ra));
+        vmbreak;
+      }
+      vmcase(OP_LFALSESKIP) {
+        StkId ra = RA(i);
+        setbfvalue(s2v(ra));
+        pc++;  /* skip next instruction */
+        vmbreak;
+      }
+      vmcase(OP_LOADTRUE) {
+        StkId ra = RA(i);
+        setbtvalue(s2v(ra));
+        vmbreak;
+      }
+      vmcase(OP_LOADNIL) {
+        StkId ra = RA(i);
+        int b = GETARG_B(i);
+        do {
+          setnilvalue(s2v(ra++));
+        } while (b--);
+        vmbreak;
+      }
+      vmcase(OP_GETUPVAL) {
+        StkId ra = RA(i);
+        int b = GETARG_B(i);
+        setobj2s(L, ra, cl->upvals[b]->v.p);
+        vmbreak;
+      }
+      vmcase(OP_SETUPVAL) {
+        StkId ra = RA(i);
+        UpVal *uv = cl->upvals[GETARG_B(i)];
+        setobj(L, uv->v.p, s2v(ra));
+        vmkC_barrier(L, uv, s2v(ra));
+        vmbreak;
+      }
+      vmcase(OP_GETTABUP) {
+        op_gettabup(L);
+        vmbreak;
+      }
+      vmcase(OP_GETTABLE) {
+        StkId ra = RA(i);
+        TValue *rb = vRB(i);
+        TValue *rc = vRC(i);
+        lu_byte tag;
+        if (ttisinteger(rc)) {  /* fast track for integers? */
+          vmkV_fastgeti(rb, ivalue(rc), s2v(ra), tag);
+        }
+        else
+          vmkV_fastget(rb, rc, s2v(ra), vmkH_get, tag);
+        if (tagisempty(tag))
+          Protect(vmkV_finishget(L, rb, rc, ra, tag));
+        vmbreak;
+      }
+      vmcase(OP_GETI) {
+        StkId ra = RA(i);
+        TValue *rb = vRB(i);
+        int c = GETARG_C(i);
+        lu_byte tag;
+        vmkV_fastgeti(rb, c, s2v(ra), tag);
+        if (tagisempty(tag)) {
+          TValue key;
+          setivalue(&key, c);
+          Protect(vmkV_finishget(L, rb, &key, ra, tag));
+        }
+        vmbreak;
+      }
+      vmcase(OP_GETFIELD) {
+       vmlabel(l_getfield) {
+        StkId ra = RA(i);
+        TValue *rb = vRB(i);
+        TValue *rc = KC(i);
+        TString *key = tsvalue(rc);  /* key must be a short string */
+        lu_byte tag;
+        vmkV_fastgetshortstr(rb, key, s2v(ra), tag, getIC());
+        if (tagisempty(tag))
+          Protect(vmkV_finishget(L, rb, rc, ra, tag));
+        vmbreak;
+      }}
+      vmcase(OP_SETTABUP) {
+        int hres;
+        TValue *upval = cl->upvals[GETARG_A(i)]->v.p;
+        TValue *rb = KB(i);
+        TValue *rc = RKC(i);
+        TString *key = tsvalue(rb);  /* key must be a short string */
+        vmkV_fastsetshortstr(upval, key, rc, hres, getIC());
+        if (hres == HOK)
+          vmkV_finishfastset(L, upval, rc);
+        else
+          Protect(vmkV_finishset(L, upval, rb, rc, hres));
+        vmbreak;
+      }
+      vmcase(OP_SETTABLE) {
+        StkId ra = RA(i);
+        int hres;
+        TValue *rb = vRB(i);  /* key (table is in 'ra') */
+        TValue *rc = RKC(i);  /* value */
+        if (ttisinteger(rb)) {  /* fast track for integers? */
+          vmkV_fastseti(s2v(ra), ivalue(rb), rc, hres);
+        }
+        else {
+          vmkV_fastset(s2v(ra), rb, rc, hres, vmkH_pset);
+        }
+        if (hres == HOK)
+          vmkV_finishfastset(L, s2v(ra), rc);
+        else
+          Protect(vmkV_finishset(L, s2v(ra), rb, rc, hres));
+        vmbreak;
+      }
+      vmcase(OP_SETI) {
+        StkId ra = RA(i);
+        int hres;
+        int b = GETARG_B(i);
+        TValue *rc = RKC(i);
+        vmkV_fastseti(s2v(ra), b, rc, hres);
+        if (hres == HOK)
+          vmkV_finishfastset(L, s2v(ra), rc);
+        else {
+          TValue key;
+          setivalue(&key, b);
+          Protect(vmkV_finishset(L, s2v(ra), &key, rc, hres));
+        }
+        vmbreak;
+      }
+      vmcase(OP_SETFIELD) {
+        StkId ra = RA(i);
+        int hres;
+        TValue *rb = KB(i);
+        TValue *rc = RKC(i);
+        TString *key = tsvalue(rb);  /* key must be a short string */
+        vmkV_fastsetshortstr(s2v(ra), key, rc, hres, getIC());
+        if (hres == HOK)
+          vmkV_finishfastset(L, s2v(ra), rc);
+        else
+          Protect(vmkV_finishset(L, s2v(ra), rb, rc, hres));
+        vmbreak;
+      }
+      vmcase(OP_NEWTABLE) {
+        StkId ra = RA(i);
+        unsigned b = cast_uint(GETARG_vB(i));  /* log2(hash size) + 1 */
+        unsigned c = cast_uint(GETARG_vC(i));  /* array size */
+        unsigned int *site = getIC();  /* size feedback */
+        Table *t;
+        if (b > 0)
+          b = 1u << (b - 1);  /* hash size is 2^(b - 1) */
+        if (TESTARG_k(i)) {  /* non-zero extra argument? */
+          vmk_assert(GETARG_Ax(*pc) != 0);
+          /* add it to array size */
+          c += cast_uint(GETARG_Ax(*pc)) * (MAXARG_vC + 1);
+        }
+        pc++;  /* skip extra argument */
+        L->top.p = ra + 1;  /* correct top in case of emergency GC */
+        t = vmkH_newsized(L, site, c, b);  /* memory allocation */
+        sethvalue2s(L, ra, t);
+        if (b != 0 || c != 0 || *site != 0)
+          vmkH_presize(L, t, c, b);  /* idem */
+        checkGC(L, ra + 1);
+        vmbreak;
+      }
+      vmcase(OP_SELF) {
+        op_self(L);
+        vmbreak;
+      }
+      vmcase(OP_ADDI) {
+        op_arithI(L, l_addi, vmki_numadd);
+        vmbreak;
+      }
+      vmcase(OP_ADDK) {
+        op_arithK(L, l_addi, vmki_numadd);
+        vmbreak;
+      }
+      vmcase(OP_SUBK) {
+        op_arithK(L, l_subi, vmki_numsub);
+        vmbreak;
+      }
+      vmcase(OP_MULK) {
+        op_arithK(L, l_muli, vmki_nummul);
+        vmbreak;
+      }
+      vmcase(OP_MODK) {
+        savestate(L, ci);  /* in case of division by 0 */
+        op_arithK(L, vmkV_mod, vmkV_modf);
+        vmbreak;
+      }
+      vmcase(OP_POWK) {
+        op_arithfK(L, vmki_numpow);
+        vmbreak;
+      }
+      vmcase(OP_DIVK) {
+        op_arithfK(L, vmki_numdiv);
+        vmbreak;
+      }
+      vmcase(OP_IDIVK) {
+        savestate(L, ci);  /* in case of division by 0 */
+        op_arithK(L, vmkV_idiv, vmki_numidiv);
+        vmbreak;
+      }
+      vmcase(OP_BANDK) {
+        op_bitwiseK(L, l_band);
+        vmbreak;
+      }
+      vmcase(OP_BORK) {
+        op_bitwiseK(L, l_bor);
+        vmbreak;
+      }
+      vmcase(OP_BXORK) {
+        op_bitwiseK(L, l_bxor);
+        vmbreak;
+      }
+      vmcase(OP_SHRI) {
+        StkId ra = RA(i);
+        TValue *rb = vRB(i);
+        int ic = GETARG_sC(i);
+        vmk_Integer ib;
+        if (tointegerns(rb, &ib)) {
+          pc++; setivalue(s2v(ra), vmkV_shiftl(ib, -ic));
+        }
+        vmbreak;
+      }
+      vmcase(OP_SHLI) {
+        StkId ra = RA(i);
+        TValue *rb = vRB(i);
+        int ic = GETARG_sC(i);
+        vmk_Integer ib;
+        if (tointegerns(rb, &ib)) {
+          pc++; setivalue(s2v(ra), vmkV_shiftl(ic, ib));
+        }
+        vmbreak;
+      }
+      vmcase(OP_ADD) {
+        quicken(vRB(i), vRC(i), OP_ADDINT, OP_ADDFLT);
+        op_arith(L, l_addi, vmki_numadd);
+        vmbreak;
+      }
+      vmcase(OP_SUB) {
+        quicken(vRB(i), vRC(i), OP_SUBINT, OP_SUBFLT);
+        op_arith(L, l_subi, vmki_numsub);
+        vmbreak;
+      }
+      vmcase(OP_MUL) {
+        quicken(vRB(i), vRC(i), OP_MULINT, OP_MULFLT);
+        op_arith(L, l_muli, vmki_nummul);
+        vmbreak;
+      }
+      vmcase(OP_MOD) {
+        savestate(L, ci);  /* in case of division by 0 */
+        op_arith(L, vmkV_mod, vmkV_modf);
+        vmbreak;
+      }
+      vmcase(OP_POW) {
+        op_arithf(L, vmki_numpow);
+        vmbreak;
+      }
+      vmcase(OP_DIV) {  /* float division (always with floats) */
+        op_arithf(L, vmki_numdiv);
+        vmbreak;
+      }
+      vmcase(OP_IDIV) {  /* floor division */
+        savestate(L, ci);  /* in case of division by 0 */
+        op_arith(L, vmkV_idiv, vmki_numidiv);
+        vmbreak;
+      }
+      vmcase(OP_BAND) {
+        op_bitwise(L, l_band);
+        vmbreak;
+      }
+      vmcase(OP_BOR) {
+        op_bitwise(L, l_bor);
+        vmbreak;
+      }
+      vmcase(OP_BXOR) {
+        op_bitwise(L, l_bxor);
+        vmbreak;
+      }
+      vmcase(OP_SHR) {
+        op_bitwise(L, vmkV_shiftr);
+        vmbreak;
+      }
+      vmcase(OP_SHL) {
+        op_bitwise(L, vmkV_shiftl);
+        vmbreak;
+      }
+      vmcase(OP_MMBIN) {
+        StkId ra = RA(i);
+        Instruction pi = *(pc - 2);  /* original arith. expression */
+        TValue *rb = vRB(i);
+        TMS tm = (TMS)GETARG_C(i);
+        StkId result = RA(pi);
+        vmk_assert(OP_ADD <= GET_OPCODE(pi) && GET_OPCODE(pi) <= OP_SHR);
+        Protect(vmkT_trybinTM(L, s2v(ra), rb, result, tm));
+        vmbreak;
+      }
+      vmcase(OP_MMBINI) {
+        StkId ra = RA(i);
+        Instruction pi = *(pc - 2);  /* original arith. expression */
+        int imm = GETARG_sB(i);
+        TMS tm = (TMS)GETARG_C(i);
+        int flip = GETARG_k(i);
+        StkId result = RA(pi);
+        Protect(vmkT_trybiniTM(L, s2v(ra), imm, flip, result, tm));
+        vmbreak;
+      }
+      vmcase(OP_MMBINK) {
+        StkId ra = RA(i);
+        Instruction pi = *(pc - 2);  /* original arith. expression */
+        TValue *imm = KB(i);
+        TMS tm = (TMS)GETARG_C(i);
+        int flip = GETARG_k(i);
+        StkId result = RA(pi);
+        Protect(vmkT_trybinassocTM(L, s2v(ra), imm, flip, result, tm));
+        vmbreak;
+      }
+      vmcase(OP_UNM) {
+        StkId ra = RA(i);
+        TValue *rb = vRB(i);
+        vmk_Number nb;
+        if (ttisinteger(rb)) {
+          vmk_Integer ib = ivalue(rb);
+          setivalue(s2v(ra), intop(-, 0, ib));
+        }
+        else if (tonumberns(rb, nb)) {
+          setfltvalue(s2v(ra), vmki_numunm(L, nb));
+        }
+        else
+          Protect(vmkT_trybinTM(L, rb, rb, ra, TM_UNM));
+        vmbreak;
+      }
+      vmcase(OP_BNOT) {
+        StkId ra = RA(i);
+        TValue *rb = vRB(i);
+        vmk_Integer ib;
+        if (tointegerns(rb, &ib)) {
+          setivalue(s2v(ra), intop(^, ~l_castS2U(0), ib));
+        }
+        else
+          Protect(vmkT_trybinTM(L, rb, rb, ra, TM_BNOT));
+        vmbreak;
+      }
+      vmcase(OP_NOT) {
+        StkId ra = RA(i);
+        TValue *rb = vRB(i);
+        if (l_isfalse(rb))
+          setbtvalue(s2v(ra));
+        else
+          setbfvalue(s2v(ra));
+        vmbreak;
+      }
+      vmcase(OP_LEN) {
+        StkId ra = RA(i);
+        Protect(vmkV_objlen(L, ra, vRB(i)));
+        vmbreak;
+      }
+      vmcase(OP_CONCAT) {
+        StkId ra = RA(i);
+        int n = GETARG_B(i);  /* number of elements to concatenate */
+        L->top.p = ra + n;  /* mark the end of concat operands */
+        ProtectNT(vmkV_concat(L, n));
+        checkGC(L, L->top.p); /* 'vmkV_concat' ensures correct top */
+        vmbreak;
+      }
+      vmcase(OP_CLOSE) {
+        StkId ra = RA(i);
+        vmk_assert(!GETARG_B(i));  /* 'close must be alive */
+        Protect(vmkF_close(L, ra, VMK_OK, 1));
+        vmbreak;
+      }
+      vmcase(OP_TBC) {
+        StkId ra = RA(i);
+        /* create new to-be-closed upvalue */
+        halfProtect(vmkF_newtbcupval(L, ra));
+        vmbreak;
+      }
+      vmcase(OP_JMP) {
+        dojump(ci, i, 0);
+        if (GETARG_sJ(i) < 0)  /* loop? */
+          jitcheck(ci);
+        vmbreak;
+      }
+      vmcase(OP_EQ) {
+        StkId ra = RA(i);
+        int cond;
+        TValue *rb = vRB(i);
+        Protect(cond = vmkV_equalobj(L, s2v(ra), rb));
+        docondjump();
+        vmbreak;
+      }
+      vmcase(OP_LT) {
+        quicken(s2v(RA(i)), vRB(i), OP_LTINT, OP_LTFLT);
+        op_order(L, l_lti, LTnum, lessthanothers);
+        vmbreak;
+      }
+      vmcase(OP_LE) {
+        quicken(s2v(RA(i)), vRB(i), OP_LEINT, OP_LEFLT);
+        op_order(L, l_lei, LEnum, lessequalothers);
+        vmbreak;
+      }
+      vmcase(OP_EQK) {
+        StkId ra = RA(i);
+        TValue *rb = KB(i);
+        /* basic types do not use '__eq'; we can use raw equality */
+        int cond = vmkV_rawequalobj(s2v(ra), rb);
+        docondjump();
+        vmbreak;
+      }
+      vmcase(OP_EQI) {
+        StkId ra = RA(i);
+        int cond;
+        int im = GETARG_sB(i);
+        if (ttisinteger(s2v(ra)))
+          cond = (ivalue(s2v(ra)) == im);
+        else if (ttisfloat(s2v(ra)))
+          cond = vmki_numeq(fltvalue(s2v(ra)), cast_num(im));
+        else
+          cond = 0;  /* other types cannot be equal to a number */
+        docondjump();
+        vmbreak;
+      }
+      vmcase(OP_LTI) {
+        op_orderI(L, l_lti, vmki_numlt, 0, TM_LT);
+        vmbreak;
+      }
+      vmcase(OP_LEI) {
+        op_orderI(L, l_lei, vmki_numle, 0, TM_LE);
+        vmbreak;
+      }
+      vmcase(OP_GTI) {
+        op_orderI(L, l_gti, vmki_numgt, 1, TM_LT);
+        vmbreak;
+      }
+      vmcase(OP_GEI) {
+        op_orderI(L, l_gei, vmki_numge, 1, TM_LE);
+        vmbreak;
+      }
+      vmcase(OP_TEST) {
+        StkId ra = RA(i);
+        int cond = !l_isfalse(s2v(ra));
+        docondjump();
+        vmbreak;
+      }
+      vmcase(OP_TESTSET) {
+        StkId ra = RA(i);
+        TValue *rb = vRB(i);
+        if (l_isfalse(rb) == GETARG_k(i))
+          pc++;
+        else {
+          setobj2s(L, ra, rb);
+          donextjump(ci);
+        }
+        vmbreak;
+      }
+      vmcase(OP_CALL) {
+       vmlabel(l_call) {
+        StkId ra = RA(i);
+        CallInfo *newci;
+        int b = GETARG_B(i);
+        int nresults = GETARG_C(i) - 1;
+        if (b != 0)  /* fixed number of arguments? */
+          L->top.p = ra + b;  /* top signals number of arguments */
+        /* else previous instruction set top */
+        savepc(L);  /* in case of errors */
+        if ((newci = vmkD_precall(L, ra, nresults)) == NULL)
+          updatetrap(ci);  /* C call; nothing else to be done */
+        else {  /* Vmk call: run fn in this same C frame */
+          ci = newci;
+          vmgoto(startfunc);
+        }
+        vmbreak;
+      }}
+      vmcase(OP_TAILCALL) {
+        StkId ra = RA(i);
+        int b = GETARG_B(i);  /* number of arguments + 1 (fn) */
+        int n;  /* number of results when calling a C fn */
+        int nparams1 = GETARG_C(i);
+        /* delta is virtual 'func' - real 'func' (vararg functions) */
+        int delta = (nparams1) ? ci->u.l.nextraargs + nparams1 : 0;
+        if (b != 0)
+          L->top.p = ra + b;
+        else  /* previous instruction set top */
+          b = cast_int(L->top.p - ra);
+        savepc(ci);  /* several calls here can raise errors */
+        if (TESTARG_k(i)) {
+          vmkF_closeupval(L, base);  /* close upvalues from current call */
+          vmk_assert(L->tbclist.p < base);  /* no pending tbc variables */
+          vmk_assert(base == ci->func.p + 1);
+        }
+        if ((n = vmkD_pretailcall(L, ci, ra, b, delta)) < 0)  /* Vmk fn? */
+          vmgoto(startfunc);  /* execute the callee */
+        else {  /* C fn? */
+          ci->func.p -= delta;  /* restore 'func' (if vararg) */
+          vmkD_poscall(L, ci, n);  /* finish caller */
+          updatetrap(ci);  /* 'vmkD_poscall' can change hooks */
+          vmgoto(ret);  /* caller returns after the tail call */
+        }
+      }
+      vmcase(OP_RETURN) {
+        StkId ra = RA(i);
+        int n = GETARG_B(i) - 1;  /* number of results */
+        int nparams1 = GETARG_C(i);
+        if (n < 0)  /* not fixed? */
+          n = cast_int(L->top.p - ra);  /* get what is available */
+        savepc(ci);
+        if (TESTARG_k(i)) {  /* may there be open upvalues? */
+          ci->u2.nres = n;  /* save number of returns */
+          if (L->top.p < ci->top.p)
+            L->top.p = ci->top.p;
+          vmkF_close(L, base, CLOSEKTOP, 1);
+          updatetrap(ci);
+          updatestack(ci);
+        }
+        if (nparams1)  /* vararg fn? */
+          ci->func.p -= ci->u.l.nextraargs + nparams1;
+        L->top.p = ra + n;  /* set call for 'vmkD_poscall' */
+        vmkD_poscall(L, ci, n);
+        updatetrap(ci);  /* 'vmkD_poscall' can change hooks */
+        vmgoto(ret);
+      }
+      vmcase(OP_RETURN0) {
+        if (l_unlikely(L->hookmask)) {
+          StkId ra = RA(i);
+          L->top.p = ra;
+          savepc(ci);
+          vmkD_poscall(L, ci, 0);  /* no hurry... */
+          trap = 1;
+        }
+        else {  /* do the 'poscall' here */
+          int nres = get_nresults(ci->callstatus);
+          L->ci = ci->previous;  /* back to caller */
+          L->top.p = base - 1;
+          for (; l_unlikely(nres > 0); nres--)
+            setnilvalue(s2v(L->top.p++));  /* all results are nil */
+        }
+        vmgoto(ret);
+      }
+      vmcase(OP_RETURN1) {
+        if (l_unlikely(L->hookmask)) {
+          StkId ra = RA(i);
+          L->top.p = ra + 1;
+          savepc(ci);
+          vmkD_poscall(L, ci, 1);  /* no hurry... */
+          trap = 1;
+        }
+        else {  /* do the 'poscall' here */
+          int nres = get_nresults(ci->callstatus);
+          L->ci = ci->previous;  /* back to caller */
+          if (nres == 0)
+            L->top.p = base - 1;  /* asked for no results */
+          else {
+            StkId ra = RA(i);
+            setobjs2s(L, base - 1, ra);  /* at least this result */
+            L->top.p = base;
+            for (; l_unlikely(nres > 1); nres--)
+              setnilvalue(s2v(L->top.p++));  /* complete missing results */
+          }
+        }
+       vmlabel(ret)  /* return from a Vmk fn */
+        if (ci->callstatus & CIST_FRESH)
+          return;  /* end this frame */
+        else {
+          ci = ci->previous;
+          vmgoto(returning);  /* continue running caller in this frame */
+        }
+      }
+      vmcase(OP_FORLOOP) {
+        StkId ra = RA(i);
+        if (ttisinteger(s2v(ra + 1))) {  /* integer loop? */
+          vmk_Unsigned count = l_castS2U(ivalue(s2v(ra)));
+          if (count > 0) {  /* still more iterations? */
+            vmk_Integer step = ivalue(s2v(ra + 1));
+            vmk_Integer idx = ivalue(s2v(ra + 2));  /* control variable */
+            chgivalue(s2v(ra), l_castU2S(count - 1));  /* update counter */
+            idx = intop(+, idx, step);  /* add step to index */
+            chgivalue(s2v(ra + 2), idx);  /* update control variable */
+            pc -= GETARG_Bx(i);  /* jump back */
+          }
+        }
+        else if (floatforloop(ra))  /* float loop */
+          pc -= GETARG_Bx(i);  /* jump back */
+        updatetrap(ci);  /* allows a signal to break the loop */
+        jitcheck(ci);
+        vmbreak;
+      }
+      vmcase(OP_FORPREP) {
+        StkId ra = RA(i);
+        savestate(L, ci);  /* in case of errors */
+        if (forprep(L, ra))
+          pc += GETARG_Bx(i) + 1;  /* skip the loop */
+        else
+          jitcheck(ci);
+        vmbreak;
+      }
+      vmcase(OP_TFORPREP) {
+       /* before: 'ra' has the iterator fn, 'ra + 1' has the state,
+          'ra + 2' has the initial value for the control variable, and
+          'ra + 3' has the closing variable. This opcode then swaps the
+          control and the closing variables and marks the closing variable
+          as to-be-closed.
+       */
+       StkId ra = RA(i);
+       TValue temp;  /* to swap control and closing variables */
+       setobj(L, &temp, s2v(ra + 3));
+       setobjs2s(L, ra + 3, ra + 2);
+       setobj2s(L, ra + 2, &temp);
+        /* create to-be-closed upvalue (if closing var. is not nil) */
+        halfProtect(vmkF_newtbcupval(L, ra + 2));
+        pc += GETARG_Bx(i);  /* go to end of the loop */
+        i = *(pc++);  /* fetch next instruction */
+        vmk_assert(GET_OPCODE(i) == OP_TFORCALL && ra == RA(i));
+        vmgoto(l_tforcall);
+      }
+      vmcase(OP_TFORCALL) {
+       vmlabel(l_tforcall) {
+        /* 'ra' has the iterator fn, 'ra + 1' has the state,
+           'ra + 2' has the closing variable, and 'ra + 3' has the control
+           variable. The call will use the stack starting at 'ra + 3',
+           so that it preserves the first three values, and the first
+           return will be the new value for the control variable.
+           ('tforcall' handles 'next' and 'ipairs' without the call.)
+        */
+        StkId ra = RA(i);
+        if (!tforcall(L, ra, GETARG_C(i))) {  /* must call the iterator? */
+          setobjs2s(L, ra + 5, ra + 3);  /* copy the control variable */
+          setobjs2s(L, ra + 4, ra + 1);  /* copy state */
+          setobjs2s(L, ra + 3, ra);  /* copy fn */
+          L->top.p = ra + 3 + 3;
+          ProtectNT(vmkD_call(L, ra + 3, GETARG_C(i)));  /* do the call */
+          updatestack(ci);  /* stack may have changed */
+        }
+        i = *(pc++);  /* go to next instruction */
+        vmk_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
+        vmgoto(l_tforloop);
+      }}
+      vmcase(OP_TFORLOOP) {
+       vmlabel(l_tforloop) {
+        StkId ra = RA(i);
+        if (!ttisnil(s2v(ra + 3))) {  /* continue loop? */
+          pc -= GETARG_Bx(i);  /* jump back */
+          jitcheck(ci);
+        }
+        vmbreak;
+      }}
+      vmcase(OP_SETLIST) {
+        StkId ra = RA(i);
+        unsigned n = cast_uint(GETARG_vB(i));
+        unsigned int last = cast_uint(GETARG_vC(i));
+        Table *h = hvalue(s2v(ra));
+        if (n == 0)
+          n = cast_uint(L->top.p - ra) - 1;  /* get up to the top */
+        else
+          L->top.p = ci->top.p;  /* correct top in case of emergency GC */
+        last += n;
+        if (TESTARG_k(i)) {
+          last += cast_uint(GETARG_Ax(*pc)) * (MAXARG_vC + 1);
+          pc++;
+        }
+        /* when 'n' is known, table should have proper size */
+        if (last > h->asize) {  /* needs more space? */
+          /* fixed-size sets should have space preallocated */
+          vmk_assert(GETARG_vB(i) == 0);
+          vmkH_resizearray(L, h, last);  /* preallocate it at once */
+        }
+        last -= n;  /* index of the first element */
+        for (; n > 0; n--) {  /* in order, to keep the border */
+          TValue *val = s2v(++ra);
+          if (isarrtyped(h))  /* (array part is not empty here) */
+            vmkH_setarray(L, h, last, val);
+          else {
+            obj2arr(h, last, val);
+            vmkH_setborder(h, last, val);
+          }
+          last++;
+          vmkC_barrierback(L, obj2gco(h), val);
+        }
+        vmbreak;
+      }
+      vmcase(OP_CLOSURE) {
+        StkId ra = RA(i);
+        Proto *p = cl->p->p[GETARG_Bx(i)];
+        halfProtect(pushclosure(L, p, cl->upvals, base, ra));
+        checkGC(L, ra + 1);
+        vmbreak;
+      }
+      vmcase(OP_VARARG) {
+        StkId ra = RA(i);
+        int n = GETARG_C(i) - 1;  /* required results */
+        Protect(vmkT_getvarargs(L, ci, ra, n));
+        vmbreak;
+      }
+      vmcase(OP_VARARGPREP) {
+        ProtectNT(vmkT_adjustvarargs(L, GETARG_A(i), ci, cl->p));
+        if (l_unlikely(trap)) {  /* previous "Protect" updated trap */
+          vmkD_hookcall(L, ci);
+          L->oldpc = 1;  /* next opcode will be seen as a "new" line */
+        }
+        updatebase(ci);  /* fn has new base after adjustment */
+        vmbreak;
+      }
+      vmcase(OP_EXTRAARG) {
+        vmk_assert(0);
+        vmbreak;
+      }
+      vmcase(OP_ADDINT) {
+        op_arithQI(L, l_addi, vmki_numadd, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_ADDFLT) {
+        op_arithQF(L, l_addi, vmki_numadd, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_SUBINT) {
+        op_arithQI(L, l_subi, vmki_numsub, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_SUBFLT) {
+        op_arithQF(L, l_subi, vmki_numsub, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_MULINT) {
+        op_arithQI(L, l_muli, vmki_nummul, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_MULFLT) {
+        op_arithQF(L, l_muli, vmki_nummul, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_LTINT) {
+        op_orderQ(L, ttisinteger, ivalue(s2v(ra)) < ivalue(rb),
+                  LTnum, lessthanothers, OP_LT);
+        vmbreak;
+      }
+      vmcase(OP_LTFLT) {
+        op_orderQ(L, ttisfloat, vmki_numlt(fltvalue(s2v(ra)), fltvalue(rb)),
+                  LTnum, lessthanothers, OP_LT);
+        vmbreak;
+      }
+      vmcase(OP_LEINT) {
+        op_orderQ(L, ttisinteger, ivalue(s2v(ra)) <= ivalue(rb),
+                  LEnum, lessequalothers, OP_LE);
+        vmbreak;
+      }
+      vmcase(OP_LEFLT) {
+        op_orderQ(L, ttisfloat, vmki_numle(fltvalue(s2v(ra)), fltvalue(rb)),
+                  LEnum, lessequalothers, OP_LE);
+        vmbreak;
+      }
+      vmcase(OP_GETTABUPF) {
+        op_gettabup(L);
+        vmfuse(l_getfield);
+      }
+      vmcase(OP_SELFCALL) {
+        op_self(L);
+        vmfuse(l_call);
+      }
+      vmcase(OP_MOVECALL) {
+        op_move(L);
+        vmfuse(l_call);
+      }
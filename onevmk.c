@@ -82,6 +82,7 @@
 #include "llex.c"
 #include "lcode.c"
 #include "lparser.c"
+#include "lopt.c"
 #include "ldebug.c"
 #include "lfunc.c"
 #include "lobject.c"
@@ -107,6 +108,7 @@
 #include "lstrlib.c"
 #include "ltablib.c"
 #include "lutf8lib.c"
+#include "lproflib.c"
 #include "linit.c"
 #endif
 
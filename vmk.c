@@ -37,6 +37,8 @@ static vmk_State *globalL = NULL;
 
 static const char *progname = VMK_PROGNAME;
 
+static const char *loadmode = NULL;  /* mode for chunks (set by -O) */
+
 
 #if defined(VMK_USE_POSIX)   /* { */
 
@@ -94,6 +96,7 @@ static void print_usage (const char *badoption) {
   "  -i        enter interactive mode after executing 'script'\n"
   "  -l mod    require library 'mod' into global 'mod'\n"
   "  -l g=mod  require library 'mod' into global 'g'\n"
+  "  -O        optimize the bytecode of the chunks given here\n"
   "  -v        show version information\n"
   "  -E        ignore environment variables\n"
   "  -W        turn warnings on\n"
@@ -201,12 +204,12 @@ static int dochunk (vmk_State *L, int status) {
 
 
 static int dofile (vmk_State *L, const char *name) {
-  return dochunk(L, vmkL_loadfile(L, name));
+  return dochunk(L, vmkL_loadfilex(L, name, loadmode));
 }
 
 
 static int dostring (vmk_State *L, const char *s, const char *name) {
-  return dochunk(L, vmkL_loadbuffer(L, s, strlen(s), name));
+  return dochunk(L, vmkL_loadbufferx(L, s, strlen(s), name, loadmode));
 }
 
 
@@ -260,7 +263,7 @@ static int handle_script (vmk_State *L, char **argv) {
   const char *fname = argv[0];
   if (strcmp(fname, "-") == 0 && strcmp(argv[-1], "--") != 0)
     fname = NULL;  /* stdin */
-  status = vmkL_loadfile(L, fname);
+  status = vmkL_loadfilex(L, fname, loadmode);
   if (status == VMK_OK) {
     int n = pushargs(L);  /* push arguments to script */
     status = docall(L, n, VMK_MULTRET);
@@ -316,6 +319,11 @@ static int collectargs (char **argv, int *first) {
         if (argv[i][2] != '\0')  /* extra characters? */
           return has_error;  /* invalid option */
         break;
+      case 'O':
+        if (argv[i][2] != '\0')  /* extra characters? */
+          return has_error;  /* invalid option */
+        loadmode = "btO";
+        break;
       case 'i':
         args |= has_i;  /* (-i implies -v) *//* FALLTHROUGH */
       case 'v':
@@ -578,7 +586,8 @@ static int pushline (vmk_State *L, int firstline) {
 static int addreturn (vmk_State *L) {
   const char *line = vmk_tostring(L, -1);  /* original line */
   const char *retline = vmk_pushfstring(L, "return %s;", line);
-  int status = vmkL_loadbuffer(L, retline, strlen(retline), "=stdin");
+  int status = vmkL_loadbufferx(L, retline, strlen(retline), "=stdin",
+                                   loadmode);
   if (status == VMK_OK)
     vmk_remove(L, -2);  /* remove modified line */
   else
@@ -609,7 +618,7 @@ static int multiline (vmk_State *L) {
   const char *line = vmk_tolstring(L, 1, &len);  /* get first line */
   checklocal(line);
   for (;;) {  /* repeat until gets a complete statement */
-    int status = vmkL_loadbuffer(L, line, len, "=stdin");  /* try it */
+    int status = vmkL_loadbufferx(L, line, len, "=stdin", loadmode);
     if (!incomplete(L, status) || !pushline(L, 0))
       return status;  /* should not or cannot try to add continuation line */
     vmk_remove(L, -2);  /* remove error message (from incomplete line) */
@@ -736,9 +745,20 @@ static int pmain (vmk_State *L) {
 }
 
 
+/*
+** With VMK_USE_SLAB, the interpreter runs on the slab allocator (see
+** 'vmkL_newslabstate').
+*/
+#if defined(VMK_USE_SLAB)
+#define newstate()	vmkL_newslabstate()
+#else
+#define newstate()	vmkL_newstate()
+#endif
+
+
 int main (int argc, char **argv) {
   int status, result;
-  vmk_State *L = vmkL_newstate();  /* create state */
+  vmk_State *L = newstate();  /* create state */
   if (L == NULL) {
     l_message(argv[0], "cannot create state: not enough memory");
     return EXIT_FAILURE;
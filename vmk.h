@@ -142,6 +142,11 @@ typedef struct vmk_Debug vmk_Debug;
 */
 typedef void (*vmk_Hook) (vmk_State *L, vmk_Debug *ar);
 
+/*
+** Type for sampling functions (see 'vmk_requestsample')
+*/
+typedef void (*vmk_Sampler) (vmk_State *L, void *ud);
+
 
 /*
 ** generic extra include file
@@ -268,6 +273,7 @@ VMK_API int (vmk_rawgeti) (vmk_State *L, int idx, vmk_Integer n);
 VMK_API int (vmk_rawgetp) (vmk_State *L, int idx, const void *p);
 
 VMK_API void  (vmk_createtable) (vmk_State *L, int narr, int nrec);
+VMK_API void  (vmk_clonetable) (vmk_State *L, int idx);
 VMK_API void *(vmk_newuserdatauv) (vmk_State *L, size_t sz, int nuvalue);
 VMK_API int   (vmk_getmetatable) (vmk_State *L, int objindex);
 VMK_API int  (vmk_getiuservalue) (vmk_State *L, int idx, int n);
@@ -338,6 +344,7 @@ VMK_API void (vmk_warning)  (vmk_State *L, const char *msg, int tocont);
 #define VMK_GCGEN		7
 #define VMK_GCINC		8
 #define VMK_GCPARAM		9
+#define VMK_GCSWEEPER		10
 
 
 /*
@@ -353,8 +360,11 @@ VMK_API void (vmk_warning)  (vmk_State *L, const char *msg, int tocont);
 #define VMK_GCPSTEPMUL		4  /* GC "speed" */
 #define VMK_GCPSTEPSIZE		5  /* GC granularity */
 
+/* parameter for full collections */
+#define VMK_GCPMARKTHREADS	6  /* number of threads marking objects */
+
 /* number of parameters */
-#define VMK_GCPN		6
+#define VMK_GCPN		7
 
 
 VMK_API int (vmk_gc) (vmk_State *L, int what, ...);
@@ -367,6 +377,8 @@ VMK_API int (vmk_gc) (vmk_State *L, int what, ...);
 VMK_API int   (vmk_error) (vmk_State *L);
 
 VMK_API int   (vmk_next) (vmk_State *L, int idx);
+VMK_API void  (vmk_setiterators) (vmk_State *L, vmk_CFunction next,
+                                                vmk_CFunction inext);
 
 VMK_API void  (vmk_concat) (vmk_State *L, int n);
 VMK_API void  (vmk_len)    (vmk_State *L, int idx);
@@ -490,6 +502,15 @@ VMK_API vmk_Hook (vmk_gethook) (vmk_State *L);
 VMK_API int (vmk_gethookmask) (vmk_State *L);
 VMK_API int (vmk_gethookcount) (vmk_State *L);
 
+VMK_API void (vmk_setsampler) (vmk_State *L, vmk_Sampler f, void *ud);
+VMK_API void (vmk_requestsample) (vmk_State *L);
+
+VMK_API int (vmk_oppairs) (vmk_State *L);
+VMK_API int (vmk_opstats) (vmk_State *L, int funcindex);
+VMK_API void (vmk_resetopstats) (vmk_State *L, int perpc);
+
+VMK_API int (vmk_tablesites) (vmk_State *L, int funcindex);
+
 
 struct vmk_Debug {
   int event;
@@ -508,6 +529,8 @@ struct vmk_Debug {
   char istailcall;	/* (t) */
   int ftransfer;   /* (r) index of first value transferred */
   int ntransfer;   /* (r) number of transferred values */
+  const char *inlined;  /* (i) name of the inlined fn running */
+  int callline;  /* (i) line where it was called */
   char short_src[VMK_IDSIZE]; /* (S) */
   /* private part */
   struct CallInfo *i_ci;  /* active fn */
@@ -54,6 +54,10 @@ VMKMOD_API int (vmkopen_table) (vmk_State *L);
 #define VMK_UTF8LIBK	(VMK_TABLIBK << 1)
 VMKMOD_API int (vmkopen_utf8) (vmk_State *L);
 
+#define VMK_PROFLIBNAME	"profiler"
+#define VMK_PROFLIBK	(VMK_UTF8LIBK << 1)
+VMKMOD_API int (vmkopen_profiler) (vmk_State *L);
+
 
 /* open selected libraries */
 VMKLIB_API void (vmkL_openselectedlibs) (vmk_State *L, int load, int preload);